@@ -0,0 +1,187 @@
+/*
+ * Worker on the second Cortex-A9 core
+ *
+ * U-Boot only runs on CPU0; after the FSBL, CPU1 waits in the BootROM for an
+ * address to be written to 0xFFFFFFF0. zynq_cpu1_start() points it at
+ * zynq_cpu1_entry, which sets CPU1 up with CPU0's page table and caches and
+ * then runs one job at a time from a mailbox in the high OCM.
+ *
+ * The page table U-Boot uses does not mark memory shareable, so the two L1
+ * data caches are not kept coherent. The worker cleans and invalidates its
+ * own data cache before and after every job; the caller has to flush
+ * anything the job reads with flush_dcache_range() before submitting it,
+ * invalidate anything it writes with invalidate_dcache_range() after
+ * zynq_cpu1_wait(), and keep its hands off both until then. The mailbox
+ * itself is in the OCM, which is mapped uncached, so it needs none of this.
+ *
+ * SPDX-License-Identifier:	GPL-2.0+
+ */
+#include <common.h>
+#include <asm/io.h>
+#include <linux/errno.h>
+#include <asm/system.h>
+#include <asm/arch/hardware.h>
+#include <asm/arch/sys_proto.h>
+
+DECLARE_GLOBAL_DATA_PTR;
+
+#define ZYNQ_CPU1_RELEASE_ADDR	0xFFFFFFF0
+#define ZYNQ_CPU1_MAILBOX	ZYNQ_OCM_HIGH_BASEADDR
+#define ZYNQ_CPU1_STACK_TOP	(ZYNQ_OCM_HIGH_BASEADDR + 0x10000)
+#define ZYNQ_CPU1_START_TIMEOUT	100 /* ms */
+
+#define A9_CPU_RST1		BIT(1)
+#define A9_CPU_CLKSTOP1		BIT(5)
+
+enum {
+	ZYNQ_CPU1_OFF,
+	ZYNQ_CPU1_IDLE,
+	ZYNQ_CPU1_BUSY,
+	ZYNQ_CPU1_STOPPED,
+	ZYNQ_CPU1_FAILED,
+};
+
+/* Offsets of sp and gd are used by cpu1_entry.S */
+struct zynq_cpu1_mailbox {
+	u32 state;
+	u32 sp;
+	u32 gd;
+	u32 ttbr0;
+	void (*fn)(void *);
+	void *arg;
+};
+
+#define mailbox ((volatile struct zynq_cpu1_mailbox *)ZYNQ_CPU1_MAILBOX)
+
+/* CPU0's view; the OCM holds whatever the FSBL left there until we start */
+static int cpu1_state = ZYNQ_CPU1_OFF;
+
+extern void zynq_cpu1_entry(void);
+
+static inline void zynq_cpu1_sev(void)
+{
+	asm volatile("dsb\n\tsev" : : : "memory");
+}
+
+static inline void zynq_cpu1_wfe(void)
+{
+	asm volatile("wfe" : : : "memory");
+}
+
+/* Runs on CPU1: turn on the MMU and caches like CPU0, then serve jobs */
+void zynq_cpu1_main(void)
+{
+	/* Nothing in CPU1's caches or TLB is valid coming out of the BootROM */
+	asm volatile("mcr p15, 0, %0, c8, c7, 0" : : "r" (0)); /* TLBIALL */
+	asm volatile("mcr p15, 0, %0, c7, c5, 0" : : "r" (0)); /* ICIALLU */
+	invalidate_dcache_all();
+
+	asm volatile("mcr p15, 0, %0, c2, c0, 0"
+		     : : "r" (mailbox->ttbr0) : "memory");
+	asm volatile("mcr p15, 0, %0, c3, c0, 0" : : "r" (~0));
+	isb();
+	set_cr(get_cr() | CR_M | CR_C | CR_I);
+
+	mailbox->state = ZYNQ_CPU1_IDLE;
+	zynq_cpu1_sev();
+
+	for (;;) {
+		while (mailbox->state != ZYNQ_CPU1_BUSY)
+			zynq_cpu1_wfe();
+		dmb();
+
+		/* Don't let stale lines from the last job hide CPU0's data */
+		flush_dcache_all();
+		mailbox->fn(mailbox->arg);
+		flush_dcache_all();
+
+		mailbox->state = ZYNQ_CPU1_IDLE;
+		zynq_cpu1_sev();
+	}
+}
+
+/*
+ * Wake CPU1 and wait for it to report in. Returns 0 if the worker is running,
+ * which includes it having been started before.
+ */
+int zynq_cpu1_start(void)
+{
+	ulong start;
+	u32 ttbr0;
+
+	if (cpu1_state == ZYNQ_CPU1_IDLE)
+		return 0;
+	if (cpu1_state == ZYNQ_CPU1_STOPPED || cpu1_state == ZYNQ_CPU1_FAILED)
+		return -EPERM;
+
+	mailbox->sp = ZYNQ_CPU1_STACK_TOP;
+	mailbox->gd = (u32)gd;
+	asm volatile("mrc p15, 0, %0, c2, c0, 0" : "=r" (ttbr0));
+	mailbox->ttbr0 = ttbr0;
+	mailbox->state = ZYNQ_CPU1_OFF;
+	dsb();
+
+	writel((u32)zynq_cpu1_entry, ZYNQ_CPU1_RELEASE_ADDR);
+	zynq_cpu1_sev();
+
+	start = get_timer(0);
+	while (mailbox->state != ZYNQ_CPU1_IDLE) {
+		if (get_timer(start) > ZYNQ_CPU1_START_TIMEOUT) {
+			printf("CPU1 did not start\n");
+			cpu1_state = ZYNQ_CPU1_FAILED;
+			return -ETIMEDOUT;
+		}
+	}
+	cpu1_state = ZYNQ_CPU1_IDLE;
+
+	return 0;
+}
+
+/* Hand fn(arg) to CPU1. The previous job must have been waited for. */
+int zynq_cpu1_submit(void (*fn)(void *), void *arg)
+{
+	if (cpu1_state != ZYNQ_CPU1_IDLE || mailbox->state != ZYNQ_CPU1_IDLE)
+		return -EBUSY;
+
+	mailbox->fn = fn;
+	mailbox->arg = arg;
+	dmb();
+	mailbox->state = ZYNQ_CPU1_BUSY;
+	zynq_cpu1_sev();
+
+	return 0;
+}
+
+/* Wait for the job handed to CPU1 to finish */
+void zynq_cpu1_wait(void)
+{
+	if (cpu1_state != ZYNQ_CPU1_IDLE)
+		return;
+
+	while (mailbox->state == ZYNQ_CPU1_BUSY)
+		zynq_cpu1_wfe();
+	dmb();
+}
+
+/*
+ * Put CPU1 back in reset so that the OS finds it the way it expects, and
+ * doesn't have it running out of memory that it is about to reuse.
+ */
+void zynq_cpu1_stop(void)
+{
+	if (cpu1_state != ZYNQ_CPU1_IDLE && cpu1_state != ZYNQ_CPU1_FAILED)
+		return;
+
+	zynq_cpu1_wait();
+
+	zynq_slcr_unlock();
+	setbits_le32(&slcr_base->a9_cpu_rst_ctrl, A9_CPU_RST1 | A9_CPU_CLKSTOP1);
+	zynq_slcr_lock();
+
+	cpu1_state = ZYNQ_CPU1_STOPPED;
+}
+
+void arch_preboot_os(void)
+{
+	zynq_cpu1_stop();
+}
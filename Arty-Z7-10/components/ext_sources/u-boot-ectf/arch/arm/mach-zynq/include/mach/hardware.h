@@ -21,6 +21,9 @@
 #define ZYNQ_EFUSE_BASEADDR		0xF800D000
 #define ZYNQ_USB_BASEADDR0		0xE0002000
 #define ZYNQ_USB_BASEADDR1		0xE0003000
+#define ZYNQ_SDHCI_BASEADDR0		0xE0100000
+#define ZYNQ_SDHCI_BASEADDR1		0xE0101000
+#define ZYNQ_OCM_HIGH_BASEADDR		0xFFFC0000
 
 /* Bootmode setting values */
 #define ZYNQ_BM_MASK		0x7
@@ -72,7 +75,8 @@ struct slcr_regs {
 	u32 pss_rst_ctrl; /* 0x200 */
 	u32 reserved2[15];
 	u32 fpga_rst_ctrl; /* 0x240 */
-	u32 reserved3[5];
+	u32 a9_cpu_rst_ctrl; /* 0x244 */
+	u32 reserved3[4];
 	u32 reboot_status; /* 0x258 */
 	u32 boot_mode; /* 0x25c */
 	u32 reserved4[116];
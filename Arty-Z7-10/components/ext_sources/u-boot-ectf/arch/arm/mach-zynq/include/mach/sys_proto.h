@@ -19,6 +19,12 @@ extern int zynq_slcr_get_mio_pin_status(const char *periph);
 extern void zynq_ddrc_init(void);
 extern unsigned int zynq_get_silicon_version(void);
 
+/* CPU1 worker, see cpu1.c */
+int zynq_cpu1_start(void);
+int zynq_cpu1_submit(void (*fn)(void *), void *arg);
+void zynq_cpu1_wait(void);
+void zynq_cpu1_stop(void);
+
 int zynq_board_read_rom_ethaddr(unsigned char *ethaddr);
 
 /* Driver extern functions */
@@ -14,15 +14,16 @@ static int blkc_show(cmd_tbl_t *cmdtp, int flag,
 		     int argc, char * const argv[])
 {
 	struct block_cache_stats stats;
-	blkcache_stats(&stats);
-
-	printf("hits: %u\n"
-	       "misses: %u\n"
-	       "entries: %u\n"
-	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	int pool;
+
+	printf("pool       hits   misses bypassed  entries  max blocks/entry\n");
+	for (pool = 0; pool < BLKCACHE_POOLS; pool++) {
+		blkcache_pool_stats(pool, &stats);
+		printf("%-6s %8u %8u %8u %4u/%-4u %u\n",
+		       blkcache_pool_name(pool), stats.hits, stats.misses,
+		       stats.bypassed, stats.entries, stats.max_entries,
+		       stats.max_blocks_per_entry);
+	}
 	return 0;
 }
 
@@ -30,20 +31,30 @@ static int blkc_configure(cmd_tbl_t *cmdtp, int flag,
 			  int argc, char * const argv[])
 {
 	unsigned blocks_per_entry, max_entries;
-	if (argc != 3)
+	int pool = BLKCACHE_DATA;
+
+	if (argc != 3 && argc != 4)
 		return CMD_RET_USAGE;
 
+	if (argc == 4) {
+		for (pool = 0; pool < BLKCACHE_POOLS; pool++)
+			if (!strcmp(argv[3], blkcache_pool_name(pool)))
+				break;
+		if (pool == BLKCACHE_POOLS)
+			return CMD_RET_USAGE;
+	}
+
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
 	max_entries = simple_strtoul(argv[2], 0, 0);
-	blkcache_configure(blocks_per_entry, max_entries);
-	printf("changed to max of %u entries of %u blocks each\n",
-	       max_entries, blocks_per_entry);
+	blkcache_configure_pool(pool, blocks_per_entry, max_entries);
+	printf("changed %s pool to max of %u entries of %u blocks each\n",
+	       blkcache_pool_name(pool), max_entries, blocks_per_entry);
 	return 0;
 }
 
 static cmd_tbl_t cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
-	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(configure, 4, 0, blkc_configure, "", ""),
 };
 
 static __maybe_unused void blkc_reloc(void)
@@ -80,8 +91,9 @@ static int do_blkcache(cmd_tbl_t *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 5, 0, do_blkcache,
 	"block cache diagnostics and control",
-	"show - show and reset statistics\n"
-	"blkcache configure blocks entries\n"
+	"show - show and reset statistics of each pool\n"
+	"blkcache configure blocks entries [data|inode|dir|index]\n"
+	"    - set the size of a pool (default data)\n"
 );
@@ -51,7 +51,13 @@ int do_ext4_size(cmd_tbl_t *cmdtp, int flag, int argc,
 int do_ext4_load(cmd_tbl_t *cmdtp, int flag, int argc,
 						char *const argv[])
 {
-	return do_load(cmdtp, flag, argc, argv, FS_TYPE_EXT);
+	int ret;
+
+	ret = do_load(cmdtp, flag, argc, argv, FS_TYPE_EXT);
+	if (ret == CMD_RET_SUCCESS)
+		setenv_ulong("ext4devreads", ext4fs_file_dev_reads);
+
+	return ret;
 }
 
 int do_ext4_ls(cmd_tbl_t *cmdtp, int flag, int argc, char *const argv[])
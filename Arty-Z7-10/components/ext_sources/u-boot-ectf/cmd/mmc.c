@@ -8,7 +8,9 @@
 #include <common.h>
 #include <command.h>
 #include <console.h>
+#include <div64.h>
 #include <mmc.h>
+#include <part.h>
 
 static int curr_device = -1;
 
@@ -24,6 +26,7 @@ static void print_mmcinfo(struct mmc *mmc)
 			(mmc->cid[1] >> 8) & 0xff, mmc->cid[1] & 0xff);
 
 	printf("Tran Speed: %d\n", mmc->tran_speed);
+	printf("Bus Speed: %d\n", mmc->clock);
 	printf("Rd Block Len: %d\n", mmc->read_bl_len);
 
 	printf("%s version %d.%d", IS_SD(mmc) ? "SD" : "MMC",
@@ -295,6 +298,75 @@ static int do_mmc_read(cmd_tbl_t *cmdtp, int flag,
 
 	return (n == cnt) ? CMD_RET_SUCCESS : CMD_RET_FAILURE;
 }
+
+static const char *mmc_timing_name(struct mmc *mmc)
+{
+	if (mmc->is_uhs)
+		return "UHS";
+	if (mmc->card_caps & (MMC_MODE_HS | MMC_MODE_HS_52MHz))
+		return "high speed";
+	return "default speed";
+}
+
+static int do_mmc_bench(cmd_tbl_t *cmdtp, int flag,
+			int argc, char * const argv[])
+{
+	struct mmc *mmc;
+	struct blk_desc *desc;
+	disk_partition_t info;
+	u32 part, blk, cnt, n;
+	ulong start, ms, kib;
+	void *addr;
+
+	if (argc != 5)
+		return CMD_RET_USAGE;
+
+	addr = (void *)simple_strtoul(argv[1], NULL, 16);
+	part = simple_strtoul(argv[2], NULL, 16);
+	blk = simple_strtoul(argv[3], NULL, 16);
+	cnt = simple_strtoul(argv[4], NULL, 16);
+
+	mmc = init_mmc_device(curr_device, false);
+	if (!mmc)
+		return CMD_RET_FAILURE;
+	desc = mmc_get_blk_desc(mmc);
+
+	/* Partition 0 stands for the whole device */
+	if (part) {
+		if (part_get_info(desc, part, &info)) {
+			printf("No partition %d on mmc %d\n", part,
+			       curr_device);
+			return CMD_RET_FAILURE;
+		}
+		if (blk + cnt > info.size) {
+			printf("Range exceeds partition %d (" LBAFU " blocks)\n",
+			       part, info.size);
+			return CMD_RET_FAILURE;
+		}
+		blk += info.start;
+	}
+
+	printf("MMC bench: dev # %d, %s, %u Hz, %d-bit bus\n", curr_device,
+	       mmc_timing_name(mmc), mmc->clock, mmc->bus_width);
+
+	/* Make sure every block really comes from the card */
+	blkcache_invalidate(desc->if_type, desc->devnum);
+
+	start = get_timer(0);
+	n = blk_dread(desc, blk, cnt, addr);
+	ms = get_timer(start);
+	if (n != cnt) {
+		printf("%d of %d blocks read: ERROR\n", n, cnt);
+		return CMD_RET_FAILURE;
+	}
+
+	kib = (ulong)(((u64)n * desc->blksz) >> 10);
+	printf("%d blocks (%lu KiB) read in %lu ms, %lu KiB/s\n", n, kib, ms,
+	       ms ? (ulong)lldiv((u64)kib * 1000, ms) : 0);
+
+	return CMD_RET_SUCCESS;
+}
+
 static int do_mmc_write(cmd_tbl_t *cmdtp, int flag,
 			int argc, char * const argv[])
 {
@@ -757,6 +829,7 @@ static int do_mmc_bkops_enable(cmd_tbl_t *cmdtp, int flag,
 static cmd_tbl_t cmd_mmc[] = {
 	U_BOOT_CMD_MKENT(info, 1, 0, do_mmcinfo, "", ""),
 	U_BOOT_CMD_MKENT(read, 4, 1, do_mmc_read, "", ""),
+	U_BOOT_CMD_MKENT(bench, 5, 1, do_mmc_bench, "", ""),
 	U_BOOT_CMD_MKENT(write, 4, 0, do_mmc_write, "", ""),
 	U_BOOT_CMD_MKENT(erase, 3, 0, do_mmc_erase, "", ""),
 	U_BOOT_CMD_MKENT(rescan, 1, 1, do_mmc_rescan, "", ""),
@@ -810,6 +883,8 @@ U_BOOT_CMD(
 	"MMC sub system",
 	"info - display info of the current MMC device\n"
 	"mmc read addr blk# cnt\n"
+	"mmc bench addr part blk# cnt - time reading cnt blocks from blk# of\n"
+	"    partition part (0 for the whole device) and report KiB/s\n"
 	"mmc write addr blk# cnt\n"
 	"mmc erase blk# cnt\n"
 	"mmc rescan\n"
@@ -55,6 +55,12 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
     #define Nr 10       // The number of rounds in AES Cipher.
 #endif
 
+// Number of counter blocks AES_CTR_xcrypt_buffer generates keystream for
+// before XORing it into the buffer.
+#ifndef AES_CTR_BATCH
+  #define AES_CTR_BATCH 16
+#endif
+
 // jcallan@github points out that declaring Multiply as a function
 // reduces code size considerably with the Keil ARM compiler.
 // See this link for more information: https://github.com/kokke/tiny-AES-C/pull/3
@@ -128,6 +134,87 @@ static const uint8_t Rcon[11] = {
  *  up to rcon[8] for AES-192, up to rcon[7] for AES-256. rcon[0] is not used in AES algorithm."
  */
 
+// T-table for the encryption rounds. Te0[x] holds the MixColumns column for
+// SubBytes(x) in row 0, i.e. the bytes {02}.s, s, s, {03}.s with s = sbox[x].
+// The tables for rows 1-3 are the same words rotated right by 8, 16 and 24
+// bits, so a whole round is 16 lookups and XORs on 32 bit words instead of
+// byte-wise SubBytes/ShiftRows/MixColumns. Only 1K of table has to stay in
+// the cache since ARM does the rotate for free.
+static const uint32_t Te0[256] = {
+  0xc66363a5, 0xf87c7c84, 0xee777799, 0xf67b7b8d,
+  0xfff2f20d, 0xd66b6bbd, 0xde6f6fb1, 0x91c5c554,
+  0x60303050, 0x02010103, 0xce6767a9, 0x562b2b7d,
+  0xe7fefe19, 0xb5d7d762, 0x4dababe6, 0xec76769a,
+  0x8fcaca45, 0x1f82829d, 0x89c9c940, 0xfa7d7d87,
+  0xeffafa15, 0xb25959eb, 0x8e4747c9, 0xfbf0f00b,
+  0x41adadec, 0xb3d4d467, 0x5fa2a2fd, 0x45afafea,
+  0x239c9cbf, 0x53a4a4f7, 0xe4727296, 0x9bc0c05b,
+  0x75b7b7c2, 0xe1fdfd1c, 0x3d9393ae, 0x4c26266a,
+  0x6c36365a, 0x7e3f3f41, 0xf5f7f702, 0x83cccc4f,
+  0x6834345c, 0x51a5a5f4, 0xd1e5e534, 0xf9f1f108,
+  0xe2717193, 0xabd8d873, 0x62313153, 0x2a15153f,
+  0x0804040c, 0x95c7c752, 0x46232365, 0x9dc3c35e,
+  0x30181828, 0x379696a1, 0x0a05050f, 0x2f9a9ab5,
+  0x0e070709, 0x24121236, 0x1b80809b, 0xdfe2e23d,
+  0xcdebeb26, 0x4e272769, 0x7fb2b2cd, 0xea75759f,
+  0x1209091b, 0x1d83839e, 0x582c2c74, 0x341a1a2e,
+  0x361b1b2d, 0xdc6e6eb2, 0xb45a5aee, 0x5ba0a0fb,
+  0xa45252f6, 0x763b3b4d, 0xb7d6d661, 0x7db3b3ce,
+  0x5229297b, 0xdde3e33e, 0x5e2f2f71, 0x13848497,
+  0xa65353f5, 0xb9d1d168, 0x00000000, 0xc1eded2c,
+  0x40202060, 0xe3fcfc1f, 0x79b1b1c8, 0xb65b5bed,
+  0xd46a6abe, 0x8dcbcb46, 0x67bebed9, 0x7239394b,
+  0x944a4ade, 0x984c4cd4, 0xb05858e8, 0x85cfcf4a,
+  0xbbd0d06b, 0xc5efef2a, 0x4faaaae5, 0xedfbfb16,
+  0x864343c5, 0x9a4d4dd7, 0x66333355, 0x11858594,
+  0x8a4545cf, 0xe9f9f910, 0x04020206, 0xfe7f7f81,
+  0xa05050f0, 0x783c3c44, 0x259f9fba, 0x4ba8a8e3,
+  0xa25151f3, 0x5da3a3fe, 0x804040c0, 0x058f8f8a,
+  0x3f9292ad, 0x219d9dbc, 0x70383848, 0xf1f5f504,
+  0x63bcbcdf, 0x77b6b6c1, 0xafdada75, 0x42212163,
+  0x20101030, 0xe5ffff1a, 0xfdf3f30e, 0xbfd2d26d,
+  0x81cdcd4c, 0x180c0c14, 0x26131335, 0xc3ecec2f,
+  0xbe5f5fe1, 0x359797a2, 0x884444cc, 0x2e171739,
+  0x93c4c457, 0x55a7a7f2, 0xfc7e7e82, 0x7a3d3d47,
+  0xc86464ac, 0xba5d5de7, 0x3219192b, 0xe6737395,
+  0xc06060a0, 0x19818198, 0x9e4f4fd1, 0xa3dcdc7f,
+  0x44222266, 0x542a2a7e, 0x3b9090ab, 0x0b888883,
+  0x8c4646ca, 0xc7eeee29, 0x6bb8b8d3, 0x2814143c,
+  0xa7dede79, 0xbc5e5ee2, 0x160b0b1d, 0xaddbdb76,
+  0xdbe0e03b, 0x64323256, 0x743a3a4e, 0x140a0a1e,
+  0x924949db, 0x0c06060a, 0x4824246c, 0xb85c5ce4,
+  0x9fc2c25d, 0xbdd3d36e, 0x43acacef, 0xc46262a6,
+  0x399191a8, 0x319595a4, 0xd3e4e437, 0xf279798b,
+  0xd5e7e732, 0x8bc8c843, 0x6e373759, 0xda6d6db7,
+  0x018d8d8c, 0xb1d5d564, 0x9c4e4ed2, 0x49a9a9e0,
+  0xd86c6cb4, 0xac5656fa, 0xf3f4f407, 0xcfeaea25,
+  0xca6565af, 0xf47a7a8e, 0x47aeaee9, 0x10080818,
+  0x6fbabad5, 0xf0787888, 0x4a25256f, 0x5c2e2e72,
+  0x381c1c24, 0x57a6a6f1, 0x73b4b4c7, 0x97c6c651,
+  0xcbe8e823, 0xa1dddd7c, 0xe874749c, 0x3e1f1f21,
+  0x964b4bdd, 0x61bdbddc, 0x0d8b8b86, 0x0f8a8a85,
+  0xe0707090, 0x7c3e3e42, 0x71b5b5c4, 0xcc6666aa,
+  0x904848d8, 0x06030305, 0xf7f6f601, 0x1c0e0e12,
+  0xc26161a3, 0x6a35355f, 0xae5757f9, 0x69b9b9d0,
+  0x17868691, 0x99c1c158, 0x3a1d1d27, 0x279e9eb9,
+  0xd9e1e138, 0xebf8f813, 0x2b9898b3, 0x22111133,
+  0xd26969bb, 0xa9d9d970, 0x078e8e89, 0x339494a7,
+  0x2d9b9bb6, 0x3c1e1e22, 0x15878792, 0xc9e9e920,
+  0x87cece49, 0xaa5555ff, 0x50282878, 0xa5dfdf7a,
+  0x038c8c8f, 0x59a1a1f8, 0x09898980, 0x1a0d0d17,
+  0x65bfbfda, 0xd7e6e631, 0x844242c6, 0xd06868b8,
+  0x824141c3, 0x299999b0, 0x5a2d2d77, 0x1e0f0f11,
+  0x7bb0b0cb, 0xa85454fc, 0x6dbbbbd6, 0x2c16163a };
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define Te1(x) ROTR32(Te0[(x)], 8)
+#define Te2(x) ROTR32(Te0[(x)], 16)
+#define Te3(x) ROTR32(Te0[(x)], 24)
+
+// Big endian load/store of a word, independent of host byte order and alignment
+#define GETU32(p) (((uint32_t)(p)[0] << 24) ^ ((uint32_t)(p)[1] << 16) ^ ((uint32_t)(p)[2] <<  8) ^ ((uint32_t)(p)[3]))
+#define PUTU32(p, v) { (p)[0] = (uint8_t)((v) >> 24); (p)[1] = (uint8_t)((v) >> 16); (p)[2] = (uint8_t)((v) >>  8); (p)[3] = (uint8_t)(v); }
+
 
 /*****************************************************************************/
 /* Private functions:                                                        */
@@ -221,14 +308,52 @@ static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
   }
 }
 
+// The encryption rounds work on words, so keep a copy of the round keys as
+// big endian words too.
+static void RoundKeyWords(uint32_t* RoundKeyW, const uint8_t* RoundKey)
+{
+  unsigned i;
+  for (i = 0; i < Nb * (Nr + 1); ++i)
+  {
+    RoundKeyW[i] = GETU32(RoundKey + (i * 4));
+  }
+}
+
+#if defined(AES_NEON) && (AES_NEON == 1)
+// The bitsliced round keys: byte j of RoundKeyBS[round][k] is 0xff if bit k
+// of byte j of the round key is set and 0 otherwise.
+static void RoundKeyBitslice(uint8_t* RoundKeyBS, const uint8_t* RoundKey)
+{
+  unsigned i, j, k;
+  for (i = 0; i < Nr + 1; ++i)
+  {
+    for (k = 0; k < 8; ++k)
+    {
+      for (j = 0; j < AES_BLOCKLEN; ++j)
+      {
+        RoundKeyBS[(i * 8 + k) * AES_BLOCKLEN + j] = ((RoundKey[i * AES_BLOCKLEN + j] >> k) & 1) ? 0xff : 0x00;
+      }
+    }
+  }
+}
+#endif
+
 void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key)
 {
   KeyExpansion(ctx->RoundKey, key);
+  RoundKeyWords(ctx->RoundKeyW, ctx->RoundKey);
+#if defined(AES_NEON) && (AES_NEON == 1)
+  RoundKeyBitslice(ctx->RoundKeyBS, ctx->RoundKey);
+#endif
 }
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
 void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
 {
   KeyExpansion(ctx->RoundKey, key);
+  RoundKeyWords(ctx->RoundKeyW, ctx->RoundKey);
+#if defined(AES_NEON) && (AES_NEON == 1)
+  RoundKeyBitslice(ctx->RoundKeyBS, ctx->RoundKey);
+#endif
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
 }
 void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
@@ -251,72 +376,11 @@ static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
   }
 }
 
-// The SubBytes Function Substitutes the values in the
-// state matrix with values in an S-box.
-static void SubBytes(state_t* state)
-{
-  uint8_t i, j;
-  for (i = 0; i < 4; ++i)
-  {
-    for (j = 0; j < 4; ++j)
-    {
-      (*state)[j][i] = getSBoxValue((*state)[j][i]);
-    }
-  }
-}
-
-// The ShiftRows() function shifts the rows in the state to the left.
-// Each row is shifted with different offset.
-// Offset = Row number. So the first row is not shifted.
-static void ShiftRows(state_t* state)
-{
-  uint8_t temp;
-
-  // Rotate first row 1 columns to left
-  temp           = (*state)[0][1];
-  (*state)[0][1] = (*state)[1][1];
-  (*state)[1][1] = (*state)[2][1];
-  (*state)[2][1] = (*state)[3][1];
-  (*state)[3][1] = temp;
-
-  // Rotate second row 2 columns to left
-  temp           = (*state)[0][2];
-  (*state)[0][2] = (*state)[2][2];
-  (*state)[2][2] = temp;
-
-  temp           = (*state)[1][2];
-  (*state)[1][2] = (*state)[3][2];
-  (*state)[3][2] = temp;
-
-  // Rotate third row 3 columns to left
-  temp           = (*state)[0][3];
-  (*state)[0][3] = (*state)[3][3];
-  (*state)[3][3] = (*state)[2][3];
-  (*state)[2][3] = (*state)[1][3];
-  (*state)[1][3] = temp;
-}
-
 static uint8_t xtime(uint8_t x)
 {
   return ((x<<1) ^ (((x>>7) & 1) * 0x1b));
 }
 
-// MixColumns function mixes the columns of the state matrix
-static void MixColumns(state_t* state)
-{
-  uint8_t i;
-  uint8_t Tmp, Tm, t;
-  for (i = 0; i < 4; ++i)
-  {
-    t   = (*state)[i][0];
-    Tmp = (*state)[i][0] ^ (*state)[i][1] ^ (*state)[i][2] ^ (*state)[i][3] ;
-    Tm  = (*state)[i][0] ^ (*state)[i][1] ; Tm = xtime(Tm);  (*state)[i][0] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][1] ^ (*state)[i][2] ; Tm = xtime(Tm);  (*state)[i][1] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][2] ^ (*state)[i][3] ; Tm = xtime(Tm);  (*state)[i][2] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][3] ^ t ;              Tm = xtime(Tm);  (*state)[i][3] ^= Tm ^ Tmp ;
-  }
-}
-
 // Multiply is used to multiply numbers in the field GF(2^8)
 // Note: The last call to xtime() is unneeded, but often ends up generating a smaller binary
 //       The compiler seems to be able to vectorize the operation better this way.
@@ -406,30 +470,49 @@ static void InvShiftRows(state_t* state)
 }
 #endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 
-// Cipher is the main function that encrypts the PlainText.
-static void Cipher(state_t* state, const uint8_t* RoundKey)
+// Cipher is the main function that encrypts the PlainText. It encrypts the
+// 16 bytes at in into out (which may be the same buffer) with the T-table.
+static void Cipher(const uint8_t* in, uint8_t* out, const uint32_t* RoundKeyW)
 {
-  uint8_t round = 0;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  const uint32_t* rk = RoundKeyW;
+  uint8_t round;
 
   // Add the First round key to the state before starting the rounds.
-  AddRoundKey(0, state, RoundKey);
+  s0 = GETU32(in     ) ^ rk[0];
+  s1 = GETU32(in +  4) ^ rk[1];
+  s2 = GETU32(in +  8) ^ rk[2];
+  s3 = GETU32(in + 12) ^ rk[3];
 
   // There will be Nr rounds.
-  // The first Nr-1 rounds are identical.
-  // These Nr-1 rounds are executed in the loop below.
+  // The first Nr-1 rounds are identical: SubBytes, ShiftRows and MixColumns
+  // are all folded into the table lookups, followed by AddRoundKey.
   for (round = 1; round < Nr; ++round)
   {
-    SubBytes(state);
-    ShiftRows(state);
-    MixColumns(state);
-    AddRoundKey(round, state, RoundKey);
+    rk += Nb;
+    t0 = Te0[s0 >> 24] ^ Te1((s1 >> 16) & 0xff) ^ Te2((s2 >> 8) & 0xff) ^ Te3(s3 & 0xff) ^ rk[0];
+    t1 = Te0[s1 >> 24] ^ Te1((s2 >> 16) & 0xff) ^ Te2((s3 >> 8) & 0xff) ^ Te3(s0 & 0xff) ^ rk[1];
+    t2 = Te0[s2 >> 24] ^ Te1((s3 >> 16) & 0xff) ^ Te2((s0 >> 8) & 0xff) ^ Te3(s1 & 0xff) ^ rk[2];
+    t3 = Te0[s3 >> 24] ^ Te1((s0 >> 16) & 0xff) ^ Te2((s1 >> 8) & 0xff) ^ Te3(s2 & 0xff) ^ rk[3];
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
   }
 
   // The last round is given below.
-  // The MixColumns function is not here in the last round.
-  SubBytes(state);
-  ShiftRows(state);
-  AddRoundKey(Nr, state, RoundKey);
+  // The MixColumns function is not here in the last round, so only the sbox is used.
+  rk += Nb;
+  t0 = ((uint32_t)getSBoxValue(s0 >> 24) << 24) ^ ((uint32_t)getSBoxValue((s1 >> 16) & 0xff) << 16) ^
+       ((uint32_t)getSBoxValue((s2 >> 8) & 0xff) << 8) ^ (uint32_t)getSBoxValue(s3 & 0xff) ^ rk[0];
+  t1 = ((uint32_t)getSBoxValue(s1 >> 24) << 24) ^ ((uint32_t)getSBoxValue((s2 >> 16) & 0xff) << 16) ^
+       ((uint32_t)getSBoxValue((s3 >> 8) & 0xff) << 8) ^ (uint32_t)getSBoxValue(s0 & 0xff) ^ rk[1];
+  t2 = ((uint32_t)getSBoxValue(s2 >> 24) << 24) ^ ((uint32_t)getSBoxValue((s3 >> 16) & 0xff) << 16) ^
+       ((uint32_t)getSBoxValue((s0 >> 8) & 0xff) << 8) ^ (uint32_t)getSBoxValue(s1 & 0xff) ^ rk[2];
+  t3 = ((uint32_t)getSBoxValue(s3 >> 24) << 24) ^ ((uint32_t)getSBoxValue((s0 >> 16) & 0xff) << 16) ^
+       ((uint32_t)getSBoxValue((s1 >> 8) & 0xff) << 8) ^ (uint32_t)getSBoxValue(s2 & 0xff) ^ rk[3];
+
+  PUTU32(out     , t0);
+  PUTU32(out +  4, t1);
+  PUTU32(out +  8, t2);
+  PUTU32(out + 12, t3);
 }
 
 #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
@@ -459,6 +542,300 @@ static void InvCipher(state_t* state, const uint8_t* RoundKey)
 }
 #endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 
+#if defined(AES_NEON) && (AES_NEON == 1)
+/*****************************************************************************/
+/* Bitsliced CTR (AES_NEON):                                                 */
+/*****************************************************************************/
+// AES_BS_BLOCKS blocks are encrypted at once. The state is kept as eight
+// 128 bit vectors, one per bit of a byte: byte j of vector k holds bit k of
+// state byte j of every block (block b in bit b). SubBytes is then a boolean
+// circuit over the vectors and ShiftRows/MixColumns are byte shuffles, so
+// there are no key or data dependent table lookups, and GCC turns the vector
+// operations into NEON instructions on ARM (SSE on a PC, so the same code
+// can be checked on the host).
+#define AES_BS_BLOCKS 8
+
+typedef uint8_t aes_vec __attribute__ ((vector_size (AES_BLOCKLEN)));
+
+#define AES_VEC_SPLAT(x) { x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x }
+
+// Byte shuffles, indexed by state byte (column * 4 + row).
+// ShiftRows moves row r left by r columns, RotateColumn1/2 move each byte up 1/2 rows in its column.
+static const aes_vec ShiftRowsMask = { 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11 };
+static const aes_vec RotateColumn1 = { 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12 };
+static const aes_vec RotateColumn2 = { 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 };
+
+// Swaps the bits of b selected by mask with the bits of a selected by mask << n
+#define SWAPMOVE(a, b, mask, n)                 \
+  {                                             \
+    aes_vec t_ = ((b) ^ ((a) >> (n))) & (mask); \
+    (b) ^= t_;                                  \
+    (a) ^= t_ << (n);                           \
+  }
+
+// Transposes the 8x8 bit matrix formed by byte j of q[0..7], for every j.
+// This turns eight blocks into the bitsliced state and back again.
+static void Transpose8(aes_vec* q)
+{
+  const aes_vec m1 = AES_VEC_SPLAT(0x55);
+  const aes_vec m2 = AES_VEC_SPLAT(0x33);
+  const aes_vec m4 = AES_VEC_SPLAT(0x0f);
+
+  SWAPMOVE(q[0], q[1], m1, 1);
+  SWAPMOVE(q[2], q[3], m1, 1);
+  SWAPMOVE(q[4], q[5], m1, 1);
+  SWAPMOVE(q[6], q[7], m1, 1);
+
+  SWAPMOVE(q[0], q[2], m2, 2);
+  SWAPMOVE(q[1], q[3], m2, 2);
+  SWAPMOVE(q[4], q[6], m2, 2);
+  SWAPMOVE(q[5], q[7], m2, 2);
+
+  SWAPMOVE(q[0], q[4], m4, 4);
+  SWAPMOVE(q[1], q[5], m4, 4);
+  SWAPMOVE(q[2], q[6], m4, 4);
+  SWAPMOVE(q[3], q[7], m4, 4);
+}
+
+// The AES S-box as a boolean circuit (Boyar and Peralta, "A depth-16 circuit
+// for the AES S-box", 2011), applied to all 128 state bytes at once.
+static void SubBytesBS(aes_vec* q)
+{
+  aes_vec x0, x1, x2, x3, x4, x5, x6, x7;
+  aes_vec y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  aes_vec y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  aes_vec y20, y21;
+  aes_vec z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  aes_vec z10, z11, z12, z13, z14, z15, z16, z17;
+  aes_vec t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  aes_vec t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  aes_vec t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  aes_vec t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  aes_vec t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  aes_vec t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  aes_vec t60, t61, t62, t63, t64, t65, t66, t67;
+  aes_vec s0, s1, s2, s3, s4, s5, s6, s7;
+
+  // x0 is the most significant bit
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  // Top linear transformation
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // Non-linear section
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // Bottom linear transformation
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+static void AddRoundKeyBS(aes_vec* q, const uint8_t* RoundKeyBS)
+{
+  uint8_t k;
+  aes_vec key;
+  for (k = 0; k < 8; ++k)
+  {
+    memcpy(&key, RoundKeyBS + k * AES_BLOCKLEN, AES_BLOCKLEN);
+    q[k] ^= key;
+  }
+}
+
+static void ShiftRowsBS(aes_vec* q)
+{
+  uint8_t k;
+  for (k = 0; k < 8; ++k)
+  {
+    q[k] = __builtin_shuffle(q[k], ShiftRowsMask);
+  }
+}
+
+// Each column becomes {02}.(a0 ^ a1) ^ a1 ^ a2 ^ a3 (and rotations of it).
+// With t = a ^ a rotated up one row that is xtime(t) ^ a rotated up one row
+// ^ t rotated up two rows. xtime is a shift across the bit vectors with the
+// top bit fed back into bits 0, 1, 3 and 4 (0x1b).
+static void MixColumnsBS(aes_vec* q)
+{
+  aes_vec r[8], t[8];
+  uint8_t k;
+  for (k = 0; k < 8; ++k)
+  {
+    r[k] = __builtin_shuffle(q[k], RotateColumn1);
+    t[k] = q[k] ^ r[k];
+    q[k] = r[k] ^ __builtin_shuffle(t[k], RotateColumn2);
+  }
+
+  q[0] ^= t[7];
+  q[1] ^= t[0] ^ t[7];
+  q[2] ^= t[1];
+  q[3] ^= t[2] ^ t[7];
+  q[4] ^= t[3] ^ t[7];
+  q[5] ^= t[4];
+  q[6] ^= t[5];
+  q[7] ^= t[6];
+}
+
+// Encrypts AES_BS_BLOCKS blocks from in to out (which may be the same buffer)
+static void CipherBS(const uint8_t* in, uint8_t* out, const uint8_t* RoundKeyBS)
+{
+  aes_vec q[8];
+  uint8_t round, k;
+
+  for (k = 0; k < 8; ++k)
+  {
+    memcpy(&q[k], in + k * AES_BLOCKLEN, AES_BLOCKLEN);
+  }
+  Transpose8(q);
+
+  AddRoundKeyBS(q, RoundKeyBS);
+  for (round = 1; round < Nr; ++round)
+  {
+    SubBytesBS(q);
+    ShiftRowsBS(q);
+    MixColumnsBS(q);
+    AddRoundKeyBS(q, RoundKeyBS + round * 8 * AES_BLOCKLEN);
+  }
+  SubBytesBS(q);
+  ShiftRowsBS(q);
+  AddRoundKeyBS(q, RoundKeyBS + Nr * 8 * AES_BLOCKLEN);
+
+  Transpose8(q);
+  for (k = 0; k < 8; ++k)
+  {
+    memcpy(out + k * AES_BLOCKLEN, &q[k], AES_BLOCKLEN);
+  }
+}
+#endif // #if defined(AES_NEON) && (AES_NEON == 1)
+
 /*****************************************************************************/
 /* Public functions:                                                         */
 /*****************************************************************************/
@@ -468,7 +845,7 @@ static void InvCipher(state_t* state, const uint8_t* RoundKey)
 void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf)
 {
   // The next function call encrypts the PlainText with the Key using AES algorithm.
-  Cipher((state_t*)buf, ctx->RoundKey);
+  Cipher(buf, buf, ctx->RoundKeyW);
 }
 
 void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf)
@@ -503,7 +880,7 @@ void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, uint32_t length)
   for (i = 0; i < length; i += AES_BLOCKLEN)
   {
     XorWithIv(buf, Iv);
-    Cipher((state_t*)buf, ctx->RoundKey);
+    Cipher(buf, buf, ctx->RoundKeyW);
     Iv = buf;
     buf += AES_BLOCKLEN;
     //printf("Step %d - %d", i/16, i);
@@ -533,37 +910,83 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf,  uint32_t length)
 
 #if defined(CTR) && (CTR == 1)
 
+/* Increment the big endian counter in Iv and handle overflow */
+static void IncrementIv(uint8_t* Iv)
+{
+  int bi;
+  for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+  {
+    if (++Iv[bi] != 0)
+    {
+      break;
+    }
+  }
+}
+
+/* Generate the keystream for the next nblocks counter values into out, which must hold nblocks * AES_BLOCKLEN bytes */
+void AES_CTR_keystream(struct AES_ctx* ctx, uint8_t* out, uint32_t nblocks)
+{
+  uint32_t i;
+#if defined(AES_NEON) && (AES_NEON == 1)
+  /* lay the counters out in out and encrypt them AES_BS_BLOCKS at a time */
+  for (; nblocks >= AES_BS_BLOCKS; nblocks -= AES_BS_BLOCKS, out += AES_BS_BLOCKS * AES_BLOCKLEN)
+  {
+    for (i = 0; i < AES_BS_BLOCKS; ++i)
+    {
+      memcpy(out + i * AES_BLOCKLEN, ctx->Iv, AES_BLOCKLEN);
+      IncrementIv(ctx->Iv);
+    }
+    CipherBS(out, out, ctx->RoundKeyBS);
+  }
+#endif
+  for (i = 0; i < nblocks; ++i, out += AES_BLOCKLEN)
+  {
+    Cipher(ctx->Iv, out, ctx->RoundKeyW);
+    IncrementIv(ctx->Iv);
+  }
+}
+
 /* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
 {
-  uint8_t buffer[AES_BLOCKLEN];
+  union
+  {
+    uint8_t b[AES_CTR_BATCH * AES_BLOCKLEN];
+    uint32_t w[AES_CTR_BATCH * AES_BLOCKLEN / 4];
+  } keystream;
+  uint32_t nblocks, n, i;
 
-  unsigned i;
-  int bi;
-  for (i = 0, bi = AES_BLOCKLEN; i < length; ++i, ++bi)
+  while (length > 0)
   {
-    if (bi == AES_BLOCKLEN) /* we need to regen xor compliment in buffer */
+    /* generate the keystream for a batch of counters, then XOR it in */
+    nblocks = (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+    if (nblocks > AES_CTR_BATCH)
     {
+      nblocks = AES_CTR_BATCH;
+    }
+    AES_CTR_keystream(ctx, keystream.b, nblocks);
 
-      memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
-      Cipher((state_t*)buffer,ctx->RoundKey);
+    n = nblocks * AES_BLOCKLEN;
+    if (n > length)
+    {
+      n = length;
+    }
 
-      /* Increment Iv and handle overflow */
-      for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+    i = 0;
+    if (((uintptr_t)buf & 3) == 0)
+    {
+      for (; i + 4 <= n; i += 4)
       {
-	/* inc will overflow */
-        if (ctx->Iv[bi] == 255)
-	{
-          ctx->Iv[bi] = 0;
-          continue;
-        }
-        ctx->Iv[bi] += 1;
-        break;
+        *(uint32_t*)(buf + i) ^= keystream.w[i / 4];
       }
-      bi = 0;
+    }
+    for (; i < n; ++i)
+    {
+      buf[i] ^= keystream.b[i];
     }
 
-    buf[i] = (buf[i] ^ buffer[bi]);
+    buf += n;
+    length -= n;
   }
 }
 
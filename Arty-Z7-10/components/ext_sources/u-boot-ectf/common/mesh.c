@@ -9,17 +9,27 @@
 #include <spi_flash.h>
 #include <command.h>
 #include <u-boot/sha256.h>
+#include <mapmem.h>
+#include <memalign.h>
+#include <mmc.h>
+#include <div64.h>
+#include <u-boot/crc.h>
 #include <mesh.h>
-#include <mesh_users.h>
-#include <default_games.h>
 #include <aes.c>
 #include <os.h>
+#ifdef CONFIG_ZYNQ_CPU1_WORKER
+#include <asm/arch/sys_proto.h>
+#endif
 
 #define MESH_TOK_BUFSIZE 64
 #define MESH_TOK_DELIM " \t\r\n\a"
 #define MESH_RL_BUFSIZE 1024
 #define MESH_SHUTDOWN -2
 
+// SPI settings the flash is probed with (same as "sf probe 0 2000000 0")
+#define MESH_FLASH_SPEED 2000000
+#define MESH_FLASH_MODE SPI_MODE_0
+
 #ifndef EXIT_SUCCESS
 #define EXIT_SUCCESS 0
 #endif
@@ -32,6 +42,37 @@
 // declare user global
 User user;
 
+// flash device probed by mesh_flash_init
+struct spi_flash *mesh_flash;
+
+// users, game key and default games, loaded once by mesh_loop
+struct mesh_data mesh_data;
+
+// game index from the games partition, loaded once by mesh_loop
+struct mesh_game_index game_index;
+
+// RAM copy of the install table, loaded once by mesh_loop
+struct mesh_table_cache table_cache;
+
+// games partition, mounted by mesh_loop and kept mounted
+struct mesh_ext4_session ext4_session;
+
+// buffers games are hashed through, allocated on first use
+struct mesh_hash_ring hash_ring;
+
+// chunk being decrypted, see mesh_decrypt_submit. It is cache line aligned
+// so that it can be flushed to and invalidated from CPU1 on its own.
+struct mesh_decrypt_job {
+    struct AES_ctx ctx;
+    uint8_t *buf;
+    loff_t length;
+} __aligned(ARCH_DMA_MINALIGN);
+
+struct mesh_decrypt_job decrypt_job;
+#ifdef CONFIG_ZYNQ_CPU1_WORKER
+int decrypt_on_cpu1;
+#endif
+
 /*
     List of builtin commands, followed by their corresponding functions.
  */
@@ -43,7 +84,13 @@ char *builtin_str[] = {
         "play",
         "query",
         "install",
-        "uninstall"
+        "uninstall",
+#ifdef CONFIG_MESH_FLASH_BENCH
+        "flashbench",
+#endif
+#ifdef CONFIG_MESH_GAME_BENCH
+        "gamebench",
+#endif
 };
 
 int (*builtin_func[]) (char **) = {
@@ -54,7 +101,13 @@ int (*builtin_func[]) (char **) = {
         &mesh_play,
         &mesh_query,
         &mesh_install,
-        &mesh_uninstall
+        &mesh_uninstall,
+#ifdef CONFIG_MESH_FLASH_BENCH
+        &mesh_flash_bench,
+#endif
+#ifdef CONFIG_MESH_GAME_BENCH
+        &mesh_game_bench,
+#endif
 };
 
 
@@ -63,178 +116,920 @@ int (*builtin_func[]) (char **) = {
 /******************************************************************************/
 
 /*
-    This function initializes the game install table. If the the sentinel is
-    written already, then, it does nothing, otherwise, it writes the sentinel
-    and the MESH_TABLE_END flag to the beginning of the game install table.
+    This function initialized the flash memory for the Arty Z7. This must be done
+    before executing any flash memory commands. The probed flash is kept in
+    mesh_flash and used directly by the other mesh flash functions, rather than
+    going through the "sf" command.
 */
-int mesh_init_table(void)
+int mesh_flash_init(void)
 {
-    /* Initialize the table where games will be installed */
-    char* sentinel = (char*) malloc(sizeof(char) * MESH_SENTINEL_LENGTH);
-    int ret = 1;
+    mesh_flash = spi_flash_probe(CONFIG_SF_DEFAULT_BUS, CONFIG_SF_DEFAULT_CS,
+                                 MESH_FLASH_SPEED, MESH_FLASH_MODE);
+    if (!mesh_flash) {
+        printf("Failed to initialize flash\n");
+        return 1;
+    }
+    return 0;
+}
 
-    mesh_flash_read(sentinel, MESH_SENTINEL_LOCATION, MESH_SENTINEL_LENGTH);
-    if (*((unsigned int*) sentinel) != MESH_SENTINEL_VALUE)
+/*
+    This function reads flash_length bytes from the flash memory at flash_location
+    to the byte array data.
+*/
+int mesh_flash_read(void* data, unsigned int flash_location, unsigned int flash_length)
+{
+    return spi_flash_read(mesh_flash, flash_location, flash_length, data);
+}
+
+/*
+    This function programs flash_length bytes from data to flash_location
+    without erasing first. Programming can only toggle 1's to 0's, so this is
+    only useful on erased flash or when the new data only clears bits (e.g.
+    flipping an install flag from MESH_TABLE_INSTALLED to
+    MESH_TABLE_UNINSTALLED). It only touches the flash pages that hold the
+    data.
+*/
+int mesh_flash_program(void* data, unsigned int flash_location, unsigned int flash_length)
+{
+    return spi_flash_write(mesh_flash, flash_location, flash_length, data);
+}
+
+/*
+    This function erases flash_length bytes of flash starting at
+    flash_location, resetting them to 1's. Both must be on erase block
+    boundaries (4K on this part). Blocks that are already erased are
+    skipped, which saves both time and flash wear.
+*/
+int mesh_flash_erase(unsigned int flash_location, unsigned int flash_length)
+{
+    unsigned int block_size = mesh_flash->erase_size;
+    unsigned int *block;
+    int ret = 0;
+
+    if (flash_location % block_size || flash_length % block_size)
+        return 1;
+
+    block = malloc(block_size);
+    if (!block)
+        return 1;
+
+    for (unsigned int address = flash_location;
+         !ret && address < flash_location + flash_length;
+         address += block_size)
     {
-        unsigned int sentinel_value = MESH_SENTINEL_VALUE;
-        mesh_flash_write(&sentinel_value, MESH_SENTINEL_LOCATION, MESH_SENTINEL_LENGTH);
-        unsigned int tend = MESH_TABLE_END;
+        unsigned int i;
 
-        // write table end
-        mesh_flash_write(&tend, MESH_INSTALL_GAME_OFFSET, sizeof(char));
-        ret = 0;
+        ret = spi_flash_read(mesh_flash, address, block_size, block);
+        if (ret)
+            break;
+
+        for (i = 0; i < block_size / sizeof(unsigned int) && block[i] == 0xffffffff; ++i)
+            ;
+        if (i != block_size / sizeof(unsigned int))
+            ret = spi_flash_erase(mesh_flash, address, block_size);
     }
-    free(sentinel);
+
+    free(block);
     return ret;
 }
 
+#ifdef CONFIG_MESH_FLASH_BENCH
 /*
-    This function initialized the flash memory for the Arty Z7. This must be done
-    before executing any flash memory commands.
+    This is a development utility that times a row by row scan of an install
+    table sector, first through the "sf read" command (the way the mesh flash
+    functions used to work) and then through spi_flash_read directly.
+
+    Usage: flashbench [rows]
 */
-int mesh_flash_init(void)
+int mesh_flash_bench(char **args)
 {
-    char* probe_cmd[] = {"sf", "probe", "0", "2000000", "0"};
+    struct games_tbl_row row;
+    unsigned int rows = MESH_TABLE_MAX_ROWS;
+    unsigned long start, cmd_us, direct_us;
     cmd_tbl_t* sf_tp = find_cmd("sf");
-    return sf_tp->cmd(sf_tp, 0, 5, probe_cmd);
+
+    if (mesh_get_argv(args) > 1)
+        rows = simple_strtoul(args[1], NULL, 10);
+
+    // "sf read" only works once "sf probe" has been run, so probe outside of
+    // the timed loop with the same settings mesh_flash_init uses
+    char* probe_cmd[] = {"sf", "probe", "0", "2000000", "0"};
+    if (sf_tp->cmd(sf_tp, 0, 5, probe_cmd)) {
+        printf("sf probe failed\n");
+        return 1;
+    }
+
+    start = timer_get_us();
+    for (unsigned int i = 0; i < rows; ++i)
+    {
+        char str_ptr[11] = "";
+        char offset_ptr[11] = "";
+        char length_ptr[11] = "";
+        ptr_to_string(&row, str_ptr);
+        ptr_to_string((unsigned int *) (MESH_TABLE_SECTOR_A + i * sizeof(row)), offset_ptr);
+        ptr_to_string((unsigned int *) sizeof(row), length_ptr);
+
+        char* read_cmd[] = {"sf", "read", str_ptr, offset_ptr, length_ptr};
+        if (sf_tp->cmd(sf_tp, 0, 5, read_cmd)) {
+            printf("sf read failed at row %u\n", i);
+            mesh_flash_init();
+            return 1;
+        }
+    }
+    cmd_us = timer_get_us() - start;
+
+    // sf probe removes and re-probes the flash device, which frees the
+    // spi_flash that mesh_flash points to, so probe it again
+    if (mesh_flash_init())
+        return 1;
+
+    start = timer_get_us();
+    for (unsigned int i = 0; i < rows; ++i)
+        spi_flash_read(mesh_flash, MESH_TABLE_SECTOR_A + i * sizeof(row), sizeof(row), &row);
+    direct_us = timer_get_us() - start;
+
+    printf("Scanned %u rows\n", rows);
+    printf("  sf command:     %lu us (%lu us/row)\n", cmd_us, rows ? cmd_us / rows : 0);
+    printf("  spi_flash_read: %lu us (%lu us/row)\n", direct_us, rows ? direct_us / rows : 0);
+
+    return 0;
 }
+#endif
+
+/******************************************************************************/
+/******************************** End Flash Commands **************************/
+/******************************************************************************/
+
+/******************************************************************************/
+/****************************** Install Table Cache ***************************/
+/******************************************************************************/
 
 /*
-    This is an improved version of the u-boot sf write. It allows you to update
-    the flash not on the page bounderies. Normally, the flash write can only
-    toggle 1's to 0's and erase can only reset the flash to 1's on page boundaries
-    and in chunks of a single page.
+    The install table is kept in flash as an append only log (see mesh.h).
+    Installing a game programs one new row into erased flash and uninstalling
+    one programs its install flag from MESH_TABLE_INSTALLED to
+    MESH_TABLE_UNINSTALLED in place, so neither needs an erase. Rows are
+    written in two steps: first with the install flag left at MESH_TABLE_END,
+    then the flag itself. A row whose flag is still MESH_TABLE_END but isn't
+    fully erased was torn by a reset and is skipped.
+*/
 
-    This is a wrapper that reads a page, updates the necessary bits, and then
-    updates the entire page in flash.
+/*
+    This function returns the flash address of the given row slot in a table
+    sector.
+*/
+static unsigned int mesh_table_slot_address(unsigned int sector, unsigned int slot)
+{
+    return sector + sizeof(struct mesh_table_header) + slot * sizeof(struct games_tbl_row);
+}
 
-    It writes the byte array data of length flash_length to flash address at
-    flash_location.
+/*
+    This function reads the header of a table sector. It returns 1 if the
+    sector holds a valid table and 0 otherwise.
 */
+static int mesh_table_read_header(unsigned int sector, struct mesh_table_header *header)
+{
+    mesh_flash_read(header, sector, sizeof(struct mesh_table_header));
 
-int mesh_flash_write(void* data, unsigned int flash_location, unsigned int flash_length)
+    return header->magic == MESH_TABLE_MAGIC &&
+           header->version == MESH_TABLE_VERSION &&
+           header->row_size == sizeof(struct games_tbl_row);
+}
+
+/*
+    This function returns 1 if every byte of the row is erased flash.
+*/
+static int mesh_table_row_erased(struct games_tbl_row *row)
 {
-    /* Write flash_length number of bytes starting at what's pointed to by data
-     * to address flash_location in flash.
-     */
+    unsigned char *bytes = (unsigned char *) row;
 
-    if (flash_length < 1)
-        return 0;
+    for (unsigned int i = 0; i < sizeof(struct games_tbl_row); ++i)
+    {
+        if (bytes[i] != 0xff)
+            return 0;
+    }
+    return 1;
+}
 
-    // We use the "sf update" command to update flash. Under the hood, this
-    // calls out to "sf erase" and "sf write". The "sf erase" command needs
-    // to be called on erase page boundaries (size 64 KB), so we need to make
-    // sure that we only call "sf update" on those boundaries as well.
-    // Since we want to write data to arbitrary locations in flash
-    // (potentially across page boundaries) we need to break our data up so
-    // that we can write to said boundaries.
-    //
-    // To do so, we read in the whole page that we're going to write to into RAM,
-    // update (in RAM) the data, and then write the page back out.
-
-    // Determine the starting and ending pages so that we know how many pages
-    // we need to write to
-    unsigned int starting_page = flash_location / FLASH_PAGE_SIZE;
-    unsigned int ending_page = (flash_location + flash_length) / FLASH_PAGE_SIZE;
-
-    // malloc space to hold an entire page
-    char* flash_data = malloc(sizeof(char) * FLASH_PAGE_SIZE);
-
-    // Find the sf sub command, defined by u-boot
-    cmd_tbl_t* sf_tp = find_cmd("sf");
+/*
+    This function adds a string to a running (djb2) hash and returns the new
+    hash. Start with a hash of 5381.
+*/
+static unsigned int mesh_hash_str(unsigned int hash, char *str)
+{
+    while (*str)
+        hash = hash * 33 + (unsigned char) *str++;
+    return hash * 33;
+}
+
+/*
+    This function hashes a user name and game short name into a bucket of the
+    install table cache.
+*/
+static unsigned int mesh_cache_bucket(char *user_name, char *game_name)
+{
+    return mesh_hash_str(mesh_hash_str(5381, user_name), game_name) % MESH_TABLE_CACHE_BUCKETS;
+}
+
+/*
+    This function empties an install table cache. The active sector and
+    generation are left alone.
+*/
+static void mesh_cache_reset(struct mesh_table_cache *cache)
+{
+    free(cache->rows);
+    free(cache->slot);
+    free(cache->next);
+    cache->rows = NULL;
+    cache->slot = NULL;
+    cache->next = NULL;
+    cache->num_rows = 0;
+    cache->capacity = 0;
+    cache->num_slots = 0;
+    for (int i = 0; i < MESH_TABLE_CACHE_BUCKETS; ++i)
+    {
+        cache->head[i] = MESH_TABLE_CACHE_NONE;
+        cache->tail[i] = MESH_TABLE_CACHE_NONE;
+    }
+}
+
+/*
+    This function adds a row to the end of an install table cache. It does
+    not touch flash. Returns the index of the row or -1 if out of memory.
+*/
+static int mesh_cache_add(struct mesh_table_cache *cache, struct games_tbl_row *row, unsigned int slot)
+{
+    unsigned int bucket;
+    int index;
+
+    if (cache->num_rows == cache->capacity)
+    {
+        unsigned int capacity = cache->capacity ? cache->capacity * 2 : MESH_TABLE_CACHE_READ_ROWS;
+        struct games_tbl_row *rows = realloc(cache->rows, capacity * sizeof(struct games_tbl_row));
+        if (!rows)
+            return -1;
+        cache->rows = rows;
+
+        unsigned int *slots = realloc(cache->slot, capacity * sizeof(unsigned int));
+        if (!slots)
+            return -1;
+        cache->slot = slots;
+
+        int *next = realloc(cache->next, capacity * sizeof(int));
+        if (!next)
+            return -1;
+        cache->next = next;
+
+        cache->capacity = capacity;
+    }
+
+    index = cache->num_rows++;
+    memcpy(&cache->rows[index], row, sizeof(struct games_tbl_row));
+    cache->slot[index] = slot;
+    cache->next[index] = MESH_TABLE_CACHE_NONE;
+
+    // keep each chain in flash order so lookups see rows in the same order
+    // as a walk of the table would
+    bucket = mesh_cache_bucket(row->user_name, row->game_name);
+    if (cache->tail[bucket] == MESH_TABLE_CACHE_NONE)
+        cache->head[bucket] = index;
+    else
+        cache->next[cache->tail[bucket]] = index;
+    cache->tail[bucket] = index;
+
+    return index;
+}
+
+/*
+    This function writes every row in a cache to the given sector as a fresh
+    table with the given generation. The sector is erased first and the
+    header is programmed last, so the sector only becomes valid once all of
+    its rows are in place. The cache's slots, sector and generation are only
+    updated on success. Returns 0 on success.
+*/
+static int mesh_table_write_sector(struct mesh_table_cache *cache, unsigned int sector,
+                                   unsigned int generation)
+{
+    struct mesh_table_header header;
+
+    if (cache->num_rows > MESH_TABLE_MAX_ROWS)
+        return 1;
+
+    if (mesh_flash_erase(sector, MESH_TABLE_SECTOR_SIZE))
+        return 1;
+
+    // the cached rows are contiguous in RAM and only hold valid install
+    // flags, so they can go out in one program
+    if (cache->num_rows &&
+        mesh_flash_program(cache->rows, mesh_table_slot_address(sector, 0),
+                           cache->num_rows * sizeof(struct games_tbl_row)))
+        return 1;
+
+    header.magic = MESH_TABLE_MAGIC;
+    header.version = MESH_TABLE_VERSION;
+    header.generation = generation;
+    header.row_size = sizeof(struct games_tbl_row);
+    if (mesh_flash_program(&header, sector, sizeof(struct mesh_table_header)))
+        return 1;
 
-    // The number of bytes that we've copied to flash so far
-    // This is so that we know when we've copied flash_length
-    // number of bytes
-    unsigned int bytes_copied = 0;
+    for (unsigned int i = 0; i < cache->num_rows; ++i)
+        cache->slot[i] = i;
+    cache->num_slots = cache->num_rows;
+    cache->sector = sector;
+    cache->generation = generation;
 
-    // Loop over all of the pages that our data would touch and
-    // write the modified pages
-    for(unsigned int i = starting_page; i <= ending_page; ++i)
+    return 0;
+}
+
+/*
+    This function determines if a row has to survive compaction. Installed
+    rows always do. An uninstalled row only does if it is the newest version
+    of that game the user has had, since it is what stops a downgrade.
+*/
+static int mesh_table_row_needed(int index)
+{
+    struct games_tbl_row *row = &table_cache.rows[index];
+    struct games_tbl_row *other;
+    int i;
+
+    if (row->install_flag == MESH_TABLE_INSTALLED)
+        return 1;
+
+    for (i = mesh_cache_find(row->user_name, row->game_name, MESH_TABLE_CACHE_NONE);
+         i != MESH_TABLE_CACHE_NONE;
+         i = mesh_cache_find(row->user_name, row->game_name, i))
+    {
+        if (i == index)
+            continue;
+        other = &table_cache.rows[i];
+
+        if (other->major_version > row->major_version ||
+            (other->major_version == row->major_version && other->minor_version > row->minor_version))
+            return 0;
+        // for the same version keep the installed row, or else the last one
+        if (other->major_version == row->major_version &&
+            other->minor_version == row->minor_version &&
+            (other->install_flag == MESH_TABLE_INSTALLED || i > index))
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+    This function compacts the install table into the inactive sector,
+    dropping rows that are no longer needed, and then erases the old sector.
+    The surviving rows are gathered into a new cache, which only replaces
+    the install table cache once the new sector has been written, so on a
+    failure the cache still matches the old sector. Returns 0 on success.
+*/
+static int mesh_table_compact(void)
+{
+    struct mesh_table_cache *cache = &table_cache;
+    struct mesh_table_cache compacted = { 0 };
+    unsigned int old_sector = cache->sector;
+    unsigned int new_sector = old_sector == MESH_TABLE_SECTOR_A ? MESH_TABLE_SECTOR_B : MESH_TABLE_SECTOR_A;
+    unsigned int num_live = 0;
+
+    mesh_cache_reset(&compacted);
+    for (unsigned int i = 0; i < cache->num_rows; ++i)
     {
-        // Get the address (in flash) of the page we need to write
-        unsigned int page_starting_address = i * FLASH_PAGE_SIZE;
-        // read all of the page data into a buffer
-        mesh_flash_read(flash_data, page_starting_address, FLASH_PAGE_SIZE);
-
-        // If this is the first page, we need to stop on the page boundary
-        // or once we've written the correct number of bytes specified by
-        // flash_length
-        if (i == starting_page)
+        if (!mesh_table_row_needed(i))
+            continue;
+        if (mesh_cache_add(&compacted, &cache->rows[i], num_live++) < 0)
         {
-            // Copy (byte by byte) until we've either reached the end of
-            // this page, or we've copied the appropriate number of bytes
-            for (;
-                    (flash_location + bytes_copied < page_starting_address + FLASH_PAGE_SIZE) && (bytes_copied < flash_length);
-                    ++bytes_copied)
-            {
-                flash_data[(flash_location % FLASH_PAGE_SIZE) + bytes_copied] = ((char*) data)[bytes_copied];
-            }
+            mesh_cache_reset(&compacted);
+            return 1;
         }
-            // Otherwise, we either have an entire page that needs to be updated,
-            // or a partial page that we need to update. Either way, this page
-            // starts on a page bound
-        else
+    }
+
+    if (mesh_table_write_sector(&compacted, new_sector, cache->generation + 1))
+    {
+        mesh_cache_reset(&compacted);
+        return 1;
+    }
+
+    mesh_cache_reset(cache);
+    memcpy(cache, &compacted, sizeof(struct mesh_table_cache));
+
+    // the new sector has the higher generation, so if this erase fails
+    // mesh_cache_load finishes it on the next boot
+    return mesh_flash_erase(old_sector, MESH_TABLE_SECTOR_SIZE);
+}
+
+/*
+    This function reads the original (pre log) install table into the cache
+    so it can be migrated.
+*/
+static int mesh_table_load_legacy(void)
+{
+    struct games_tbl_row row;
+    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
+
+    for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
+        (unsigned char) row.install_flag != MESH_TABLE_END;
+        mesh_flash_read(&row, offset, sizeof(struct games_tbl_row)))
+    {
+        if (mesh_cache_add(&table_cache, &row, 0) < 0)
+            return 1;
+        offset += sizeof(struct games_tbl_row);
+    }
+
+    return 0;
+}
+
+/*
+    This function initializes the game install table. If the board still has
+    the original sentinel based table, its rows are carried over. A new table
+    is written to sector B and sector A (which held the original table) is
+    erased. Returns 0 on success.
+*/
+int mesh_init_table(void)
+{
+    unsigned int sentinel = 0;
+    int ret;
+
+    mesh_cache_reset(&table_cache);
+
+    mesh_flash_read(&sentinel, MESH_SENTINEL_LOCATION, MESH_SENTINEL_LENGTH);
+    if (sentinel == MESH_SENTINEL_VALUE && mesh_table_load_legacy())
+        return 1;
+
+    ret = mesh_table_write_sector(&table_cache, MESH_TABLE_SECTOR_B, 1);
+    if (!ret)
+        ret = mesh_flash_erase(MESH_TABLE_SECTOR_A, MESH_TABLE_SECTOR_SIZE);
+
+    return ret;
+}
+
+/*
+    This function reads the active install table sector from flash into the
+    install table cache. The table is read MESH_TABLE_CACHE_READ_ROWS rows at
+    a time rather than row by row. It must be called after mesh_init_table
+    and before any other mesh_cache_* function.
+*/
+int mesh_cache_load(void)
+{
+    struct mesh_table_cache *cache = &table_cache;
+    struct mesh_table_header header_a, header_b;
+    struct games_tbl_row *chunk;
+    int valid_a, valid_b;
+    unsigned int slot = 0;
+    int done = 0;
+
+    mesh_cache_reset(cache);
+
+    valid_a = mesh_table_read_header(MESH_TABLE_SECTOR_A, &header_a);
+    valid_b = mesh_table_read_header(MESH_TABLE_SECTOR_B, &header_b);
+    if (!valid_a && !valid_b)
+        return 1;
+
+    if (valid_a && (!valid_b || header_a.generation > header_b.generation))
+    {
+        cache->sector = MESH_TABLE_SECTOR_A;
+        cache->generation = header_a.generation;
+    }
+    else
+    {
+        cache->sector = MESH_TABLE_SECTOR_B;
+        cache->generation = header_b.generation;
+    }
+
+    // Both sectors are only valid if a compaction was cut off before it
+    // erased the old sector, so finish it now
+    if (valid_a && valid_b)
+        mesh_flash_erase(cache->sector == MESH_TABLE_SECTOR_A ? MESH_TABLE_SECTOR_B : MESH_TABLE_SECTOR_A,
+                         MESH_TABLE_SECTOR_SIZE);
+
+    chunk = malloc(MESH_TABLE_CACHE_READ_ROWS * sizeof(struct games_tbl_row));
+    if (!chunk)
+        return 1;
+
+    while (!done && slot < MESH_TABLE_MAX_ROWS)
+    {
+        mesh_flash_read(chunk, mesh_table_slot_address(cache->sector, slot),
+                        MESH_TABLE_CACHE_READ_ROWS * sizeof(struct games_tbl_row));
+
+        for (int i = 0; i < MESH_TABLE_CACHE_READ_ROWS && slot < MESH_TABLE_MAX_ROWS; ++i, ++slot)
         {
-            // Copy (byte by byte) until we've either reached the end of
-            // this page, or we've copied the appropriate number of bytes
-            for (unsigned int j = 0;
-                 (i * FLASH_PAGE_SIZE + j < (i + 1) * FLASH_PAGE_SIZE) && (bytes_copied < flash_length);
-                 ++j)
+            if (chunk[i].install_flag == MESH_TABLE_INSTALLED ||
+                chunk[i].install_flag == MESH_TABLE_UNINSTALLED)
             {
-                flash_data[j] = ((char*) data)[bytes_copied];
-                ++bytes_copied;
+                if (mesh_cache_add(cache, &chunk[i], slot) < 0)
+                {
+                    free(chunk);
+                    return 1;
+                }
             }
+            else if (mesh_table_row_erased(&chunk[i]))
+            {
+                done = 1;
+                break;
+            }
+            // anything else is a torn or damaged row, skip over its slot
         }
+    }
+    cache->num_slots = slot;
+
+    free(chunk);
+    return 0;
+}
+
+/*
+    This function finds the next row in the install table cache for the given
+    user and game. game_name may either be the short name or the full name
+    (name-vmajor.minor); only the short name is used for the lookup.
+
+    Pass MESH_TABLE_CACHE_NONE as prev to get the first row, and the previous
+    return value to get the following one. Returns MESH_TABLE_CACHE_NONE when
+    there are no more rows.
+*/
+int mesh_cache_find(char *user_name, char *game_name, int prev)
+{
+    struct mesh_table_cache *cache = &table_cache;
+    char short_game_name[MAX_GAME_LENGTH + 1] = "";
+    int index;
 
-        // We need to convert things to strings since this mimics the command prompt
-        char data_ptr_str[11] = "";
-        char offset_str[11] = "";
-        char length_str[11] = "";
+    // must make a copy, otherwise, it modified game_name
+    strncpy(short_game_name, game_name, MAX_GAME_LENGTH);
+    strtok(short_game_name, "-");
 
-        // Convert the pointer to a string representation (0xffffffff)
-        ptr_to_string(flash_data, data_ptr_str);
-        ptr_to_string((void *) page_starting_address, offset_str);
-        ptr_to_string((void *) FLASH_PAGE_SIZE, length_str);
+    if (prev == MESH_TABLE_CACHE_NONE)
+        index = cache->head[mesh_cache_bucket(user_name, short_game_name)];
+    else
+        index = cache->next[prev];
 
-        // Perform an update on this page
-        char* write_cmd[] = {"sf", "update", data_ptr_str, offset_str, length_str};
-        sf_tp->cmd(sf_tp, 0, 5, write_cmd);
+    // other users and games can share the chain, so skip those
+    for (; index != MESH_TABLE_CACHE_NONE; index = cache->next[index])
+    {
+        if (strcmp(cache->rows[index].user_name, user_name) == 0 &&
+            strcmp(cache->rows[index].game_name, short_game_name) == 0)
+            return index;
     }
 
-    free(flash_data);
+    return MESH_TABLE_CACHE_NONE;
+}
+
+/*
+    This function appends a row to the install table. The row is programmed
+    into the next erased slot of the active sector, compacting the table first
+    if the sector is full, and then added to the cache. The row is only added
+    to the cache once it is in flash. Returns 0 on success.
+*/
+int mesh_cache_append(struct games_tbl_row *row)
+{
+    struct mesh_table_cache *cache = &table_cache;
+    struct games_tbl_row pending;
+    unsigned int address;
+
+    if (cache->num_slots >= MESH_TABLE_MAX_ROWS)
+    {
+        if (mesh_table_compact())
+            return 1;
+        if (cache->num_slots >= MESH_TABLE_MAX_ROWS)
+        {
+            printf("Install table is full\n");
+            return 1;
+        }
+    }
+
+    address = mesh_table_slot_address(cache->sector, cache->num_slots);
+
+    // program everything but the install flag, then the flag, so a reset in
+    // between leaves a row that is recognized as torn
+    memcpy(&pending, row, sizeof(struct games_tbl_row));
+    pending.install_flag = MESH_TABLE_END;
+    if (mesh_flash_program(&pending, address, sizeof(struct games_tbl_row)) ||
+        mesh_flash_program(&row->install_flag, address, sizeof(char)))
+    {
+        // a partly programmed slot can't be used again and is skipped as a
+        // torn row the next time the table is loaded. One that is still
+        // erased would end the table there instead, so it is reused
+        mesh_flash_read(&pending, address, sizeof(struct games_tbl_row));
+        if (!mesh_table_row_erased(&pending))
+            cache->num_slots++;
+        return 1;
+    }
+
+    return mesh_cache_add(cache, row, cache->num_slots++) < 0;
+}
+
+/*
+    This function sets the install flag of the row at index in both the cache
+    and flash. Since the flag is programmed in place, it may only clear bits,
+    i.e. go from MESH_TABLE_INSTALLED to MESH_TABLE_UNINSTALLED. The cache
+    is only changed once the flag is in flash. Returns 0 on success.
+*/
+int mesh_cache_set_flag(int index, char install_flag)
+{
+    struct mesh_table_cache *cache = &table_cache;
+
+    if (index < 0 || index >= cache->num_rows)
+        return 1;
+    if (install_flag & ~cache->rows[index].install_flag)
+        return 1;
+
+    if (mesh_flash_program(&install_flag,
+                           mesh_table_slot_address(cache->sector, cache->slot[index]),
+                           sizeof(char)))
+        return 1;
 
+    cache->rows[index].install_flag = install_flag;
     return 0;
 }
 
+/******************************************************************************/
+/**************************** End Install Table Cache *************************/
+/******************************************************************************/
+
+/******************************************************************************/
+/******************************* Provisioning Data ****************************/
+/******************************************************************************/
+
 /*
-    This function reads flash_length bytes from the flash memory at flash_location
-    to the byte array data.
+    This function zeroes len bytes at p in a way the compiler can't drop
+    because the memory isn't read again, for clearing keys before they go
+    out of scope or are freed.
 */
-int mesh_flash_read(void* data, unsigned int flash_location, unsigned int flash_length)
+static void mesh_wipe(void *p, size_t len)
 {
-    /* Read "flash_length" number of bytes from "flash_location" into "data" */
+    memset(p, 0, len);
+    barrier_data(p);
+}
 
-    // Find the sf sub command
-    cmd_tbl_t* sf_tp = find_cmd("sf");
+/*
+    This function checks the provisioning data the FSBL loaded at
+    MESH_DATA_ADDR and copies it into mesh_data, then clears it from where it
+    was loaded so the key doesn't stay there for the kernel to find.
+    Returns 0 on success, or 1 if there is no valid provisioning data.
+*/
+int mesh_data_init(void)
+{
+    struct mesh_data_header *header;
+    unsigned int users_size;
+    unsigned int games_size;
+    char *blob;
+    int ret = 1;
 
-    // We need to convert things to strings since this mimics the command prompt,
-    // so get us space for strings
-    char str_ptr[11] = "";
-    char offset_ptr[11] = "";
-    char length_ptr[11] = "";
-    // Convert the point to a string representation
-    ptr_to_string(data, str_ptr);
-    ptr_to_string((unsigned int *) flash_location, offset_ptr);
-    ptr_to_string((unsigned int *) flash_length, length_ptr);
+    blob = map_sysmem(MESH_DATA_ADDR, MESH_DATA_MAX_SIZE);
+    header = (struct mesh_data_header *) blob;
+
+    if (header->magic != MESH_DATA_MAGIC ||
+        header->version != MESH_DATA_VERSION ||
+        header->size < sizeof(struct mesh_data_header) ||
+        header->size > MESH_DATA_MAX_SIZE ||
+        header->num_users > MESH_DATA_MAX_SIZE / sizeof(struct mesh_user) ||
+        header->num_default_games > MESH_DATA_MAX_SIZE / MAX_STR_LEN)
+        goto out;
+
+    users_size = header->num_users * sizeof(struct mesh_user);
+    games_size = header->num_default_games * MAX_STR_LEN;
+    if (sizeof(struct mesh_data_header) + users_size + games_size != header->size ||
+        crc32(0, (unsigned char *) (header + 1), header->size - sizeof(struct mesh_data_header)) != header->crc)
+        goto out;
+
+    mesh_data.data = malloc(users_size + games_size + 1);
+    if (!mesh_data.data)
+        goto out;
+    memcpy(mesh_data.data, header + 1, users_size + games_size);
+
+    // every string has to end inside its field
+    memcpy(mesh_data.key, header->key, MESH_KEY_LENGTH);
+    mesh_data.key[MESH_KEY_LENGTH] = '\0';
+    memcpy(mesh_data.nonce, header->nonce, MESH_NONCE_LENGTH);
+    mesh_data.nonce[MESH_NONCE_LENGTH] = '\0';
+
+    mesh_data.users = (struct mesh_user *) mesh_data.data;
+    mesh_data.num_users = header->num_users;
+    for (unsigned int i = 0; i < mesh_data.num_users; ++i)
+    {
+        mesh_data.users[i].username[MAX_USERNAME_LENGTH] = '\0';
+        mesh_data.users[i].pin[64] = '\0';
+        mesh_data.users[i].salt[16] = '\0';
+    }
 
-    // Perform an update
-    char* read_cmd[] = {"sf", "read", str_ptr, offset_ptr, length_ptr};
-    return sf_tp->cmd(sf_tp, 0, 5, read_cmd);
+    mesh_data.default_games = (char (*)[MAX_STR_LEN]) (mesh_data.data + users_size);
+    mesh_data.num_default_games = header->num_default_games;
+    for (unsigned int i = 0; i < mesh_data.num_default_games; ++i)
+        mesh_data.default_games[i][MAX_STR_LEN - 1] = '\0';
+    ret = 0;
+
+out:
+    memset(blob, 0, header->size <= MESH_DATA_MAX_SIZE ? header->size : sizeof(struct mesh_data_header));
+    flush_dcache_range(MESH_DATA_ADDR, MESH_DATA_ADDR + MESH_DATA_MAX_SIZE);
+    unmap_sysmem(blob);
+    return ret;
+}
+
+/*
+    This function clears the game key, nonce, user table and default games
+    that mesh_data_init copied out. Nothing that needs them works after this.
+*/
+void mesh_data_wipe(void)
+{
+    if (mesh_data.data) {
+        mesh_wipe(mesh_data.data, mesh_data.num_users * sizeof(struct mesh_user) +
+                                  mesh_data.num_default_games * MAX_STR_LEN);
+        free(mesh_data.data);
+    }
+    mesh_wipe(&mesh_data, sizeof(struct mesh_data));
 }
 
 /******************************************************************************/
-/******************************** End Flash Commands **************************/
+/***************************** End Provisioning Data **************************/
+/******************************************************************************/
+
+/******************************************************************************/
+/*********************************** Game Index *******************************/
+/******************************************************************************/
+
+/*
+    This function computes the HMAC-SHA256 of data with the given key, which
+    must be at most 64 bytes.
+*/
+static void mesh_hmac_sha256(const uint8_t *key, unsigned int key_len,
+                             const uint8_t *data, unsigned int len,
+                             uint8_t mac[MESH_INDEX_MAC_LENGTH])
+{
+    uint8_t pad[64];
+    uint8_t inner[MESH_INDEX_MAC_LENGTH];
+    sha256_context ctx;
+
+    memset(pad, 0x36, sizeof(pad));
+    for (unsigned int i = 0; i < key_len; ++i)
+        pad[i] ^= key[i];
+    sha256_starts(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, data, len);
+    sha256_finish(&ctx, inner);
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (unsigned int i = 0; i < key_len; ++i)
+        pad[i] ^= key[i];
+    sha256_starts(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, inner, sizeof(inner));
+    sha256_finish(&ctx, mac);
+
+    mesh_wipe(pad, sizeof(pad));
+}
+
+/*
+    This function frees the game index, leaving it empty.
+*/
+static void mesh_index_free(void)
+{
+    if (game_index.data)
+        mesh_wipe(game_index.data, game_index.size);
+    free(game_index.data);
+    free(game_index.next);
+    memset(&game_index, 0, sizeof(struct mesh_game_index));
+}
+
+/*
+    This function reads MESH_INDEX_FILE from the games partition and checks
+    its format and HMAC. If it is valid, game headers, sizes and hashes are
+    looked up in it from then on instead of in the games themselves. If it
+    is missing or invalid, the shell falls back to reading the games.
+    Returns 0 if the index was loaded.
+*/
+int mesh_index_load(void)
+{
+    struct mesh_index_header *header;
+    uint8_t mac[MESH_INDEX_MAC_LENGTH];
+    loff_t size;
+    unsigned int body_size;
+    uint8_t diff = 0;
+
+    mesh_index_free();
+
+    size = mesh_size_ext4(MESH_INDEX_FILE);
+    if (size < (loff_t) (sizeof(struct mesh_index_header) + MESH_INDEX_MAC_LENGTH))
+        return 1;
+
+    game_index.data = malloc(size);
+    if (!game_index.data)
+        return 1;
+    game_index.size = size;
+    if (mesh_read_ext4(MESH_INDEX_FILE, game_index.data, size) != size)
+        goto invalid;
+
+    header = (struct mesh_index_header *) game_index.data;
+    body_size = sizeof(struct mesh_index_header) + header->num_games * sizeof(struct mesh_index_entry);
+    if (header->magic != MESH_INDEX_MAGIC ||
+        header->version != MESH_INDEX_VERSION ||
+        header->entry_size != sizeof(struct mesh_index_entry) ||
+        header->num_games > (size - sizeof(struct mesh_index_header)) / sizeof(struct mesh_index_entry) ||
+        body_size + MESH_INDEX_MAC_LENGTH != size)
+        goto invalid;
+
+    // compare every byte so the time taken doesn't depend on the MAC
+    mesh_hmac_sha256((uint8_t *) mesh_data.key, MESH_KEY_LENGTH, (uint8_t *) game_index.data, body_size, mac);
+    for (int i = 0; i < MESH_INDEX_MAC_LENGTH; ++i)
+        diff |= mac[i] ^ (uint8_t) game_index.data[body_size + i];
+    if (diff)
+        goto invalid;
+
+    game_index.num_games = header->num_games;
+    game_index.next = malloc(game_index.num_games * sizeof(int) + 1);
+    if (!game_index.next)
+        goto invalid;
+    game_index.entries = (struct mesh_index_entry *) (game_index.data + sizeof(struct mesh_index_header));
+
+    for (int i = 0; i < MESH_INDEX_BUCKETS; ++i)
+        game_index.head[i] = MESH_TABLE_CACHE_NONE;
+    for (int i = game_index.num_games - 1; i >= 0; --i)
+    {
+        struct mesh_index_entry *entry = &game_index.entries[i];
+        unsigned int bucket;
+
+        // never trust the strings to be terminated
+        entry->file_name[MAX_GAME_LENGTH] = '\0';
+        entry->name[MAX_GAME_LENGTH] = '\0';
+        if (entry->num_users > MAX_NUM_USERS)
+            entry->num_users = MAX_NUM_USERS;
+        for (int j = 0; j < MAX_NUM_USERS; ++j)
+            entry->users[j][MAX_USERNAME_LENGTH] = '\0';
+
+        bucket = mesh_hash_str(5381, entry->file_name) % MESH_INDEX_BUCKETS;
+        game_index.next[i] = game_index.head[bucket];
+        game_index.head[bucket] = i;
+    }
+
+    return 0;
+
+invalid:
+    printf("Ignoring invalid game index\n");
+    mesh_index_free();
+    return 1;
+}
+
+/*
+    This function looks up a game by its full name (name-vmajor.minor) in the
+    game index. It returns NULL if the game isn't in the index or there is no
+    index loaded.
+*/
+struct mesh_index_entry *mesh_index_find(char *game_name)
+{
+    int i;
+
+    if (!game_index.entries)
+        return NULL;
+
+    for (i = game_index.head[mesh_hash_str(5381, game_name) % MESH_INDEX_BUCKETS];
+         i != MESH_TABLE_CACHE_NONE;
+         i = game_index.next[i])
+    {
+        if (strcmp(game_index.entries[i].file_name, game_name) == 0)
+            return &game_index.entries[i];
+    }
+
+    return NULL;
+}
+
+/*
+    This function compares ascii_hash, SHA256_DIGEST_LENGTH hex characters as
+    stored in a hash file, the game index or the install table, to gen_hash.
+    Every character is compared so the time taken doesn't depend on where
+    they differ. It returns 0 if they match and 1 if they don't.
+*/
+static int mesh_hash_differs(const char *ascii_hash, const unsigned char gen_hash[32]){
+    char ascii_gen_hash[SHA256_DIGEST_LENGTH + 1];
+    unsigned char diff = 0;
+
+    for (int i = 0; i < 32; i++)
+        sprintf(&ascii_gen_hash[i*2], "%02x", gen_hash[i]);
+
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+        diff |= ascii_gen_hash[i] ^ ascii_hash[i];
+
+    return diff != 0;
+}
+
+/*
+    This function returns the size of the game once loaded, from the game
+    index if it is loaded and from the games partition otherwise.
+*/
+loff_t mesh_game_size(char *game_name)
+{
+    struct mesh_index_entry *entry;
+    struct mesh_game_layout layout;
+    loff_t size;
+
+    if (!game_index.entries) {
+        if (mesh_game_open(game_name, &layout))
+            return -1;
+        size = layout.size;
+        mesh_game_close(&layout);
+        return size;
+    }
+
+    entry = mesh_index_find(game_name);
+    return entry ? entry->size : -1;
+}
+
+/******************************************************************************/
+/********************************* End Game Index *****************************/
 /******************************************************************************/
 
 /******************************************************************************/
@@ -289,23 +1084,44 @@ int mesh_logout(char **args)
 */
 int mesh_list(char **args)
 {
-    struct games_tbl_row row;
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
+    struct games_tbl_row *row;
 
-    // loop through install table untill end of table is found.
-    for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
-        row.install_flag != MESH_TABLE_END;
-        mesh_flash_read(&row, offset, sizeof(struct games_tbl_row)))
+    // loop through the cached install table in flash order
+    for(unsigned int i = 0; i < table_cache.num_rows; ++i)
     {
+        row = &table_cache.rows[i];
         // print the game if it is found.
-        if (strcmp(row.user_name, user.name) == 0 && row.install_flag == MESH_TABLE_INSTALLED)
-            printf("%s-v%d.%d\n", row.game_name, row.major_version, row.minor_version);
-        offset += sizeof(struct games_tbl_row);
+        if (strcmp(row->user_name, user.name) == 0 && row->install_flag == MESH_TABLE_INSTALLED)
+            printf("%s-v%d.%d\n", row->game_name, row->major_version, row->minor_version);
     }
 
     return 0;
 }
 
+/*
+    This function clears everything u-boot holds that is derived from the
+    game key before Linux is booted: the provisioning data, the game index
+    and the AES context and buffers games are decrypted through. u-boot's
+    memory is handed to Linux, so anything left there could be read from
+    it.
+*/
+static void mesh_wipe_secrets(void)
+{
+    mesh_data_wipe();
+    mesh_index_free();
+
+    mesh_wipe(&decrypt_job, sizeof(decrypt_job));
+    flush_dcache_range((ulong) &decrypt_job, (ulong) (&decrypt_job + 1));
+
+    for (int i = 0; i < MESH_HASH_RING_BUFFERS; ++i) {
+        if (!hash_ring.buf[i])
+            continue;
+        mesh_wipe(hash_ring.buf[i], MESH_HASH_RING_BUF_SIZE);
+        free(hash_ring.buf[i]);
+        hash_ring.buf[i] = NULL;
+    }
+}
+
 /*
     This function writes the specified game to ram address 0x1fc00040 and the
     size of the specified game binary to 0x1fc00000. It then boots the linux
@@ -316,6 +1132,11 @@ int mesh_list(char **args)
 */
 int mesh_play(char **args)
 {
+    unsigned char gen_hash[32];
+    char *game_mem;
+    loff_t offset;
+    loff_t size;
+
     if (!mesh_play_validate_args(args)){
         return 0;
     }
@@ -328,32 +1149,41 @@ int mesh_play(char **args)
         return 0;
     }
 
-    loff_t size = 0;
-
-    // get size of binary
-    size = mesh_size_ext4(args[1]);
-
-    // write game size to memory
-    char *size_str = (char *)malloc(sizeof(int));
-    sprintf(size_str, "0x%x", (int) size);
-    char * const mw_argv[3] = { "mw.l", "0x1fc00000", size_str };
-    cmd_tbl_t* mem_write_tp = find_cmd("mw.l");
-    mem_write_tp->cmd(mem_write_tp, 0, 3, mw_argv);
-
-    // load game binary into memory
-    char * const argv[5] = { "ext4load", "mmc", "0:2", "0x1fc00040", args[1] };
-    cmd_tbl_t* load_tp = find_cmd("ext4load");
+    // read, decrypt and hash the game straight into the reserved memory the
+    // game loader picks it up from, so the game is only read once
+    game_mem = map_sysmem(MESH_GAME_MEM_BASE, MESH_GAME_MEM_SIZE);
+    size = mesh_stream_game(args[1], game_mem, &offset, gen_hash);
+    if (size < 0) {
+        printf("Failed to load %s.\n", args[1]);
+        unmap_sysmem(game_mem);
+        return 0;
+    }
 
-    load_tp->cmd(load_tp, 0, 5, argv);
+    // assert game hash matches
+    if (mesh_check_hash(args[1], gen_hash)){
+        printf("Error playing %s, integrity check failed.\n", args[1]);
+        unmap_sysmem(game_mem);
+        return 0;
+    }
 
-    // cleanup - this is here because boot may not execute following commands
-    free(size_str);
+    // write game size to memory and tell the loader it is already decrypted
+    // and where it starts
+    ((u32 *) game_mem)[0] = (u32) size;
+    ((u32 *) game_mem)[1] = MESH_GAME_DECRYPTED;
+    ((u32 *) game_mem)[2] = (u32) offset;
+    unmap_sysmem(game_mem);
+    mesh_ext4_unmount();
+    mesh_wipe_secrets();
 
     // boot petalinux
     char * const boot_argv[2] = { "bootm", "0x10000000"};
     cmd_tbl_t* boot_tp = find_cmd("bootm");
     boot_tp->cmd(boot_tp, 0, 2, boot_argv);
 
+    // the key is gone, so the shell can't carry on without starting over
+    printf("Failed to boot the game, resetting\n");
+    do_reset(NULL, 0, 0, NULL);
+
     return 0;
 }
 
@@ -365,6 +1195,21 @@ int mesh_query(char **args)
 {
     /* List all games available to download */
     printf("%s's games...\n", user.name);
+
+    if (game_index.entries) {
+        Game game;
+        unsigned int game_num = 1;
+
+        for (unsigned int i = 0; i < game_index.num_games; ++i) {
+            mesh_get_game_header(&game, game_index.entries[i].file_name);
+            if (mesh_check_user(&game)) {
+                printf("%d      ", game_num++);
+                printf("%s\n", game_index.entries[i].file_name);
+            }
+        }
+        return 1;
+    }
+
     return mesh_query_ext4("/", NULL) < 0 ? 0 : 1;
 }
 
@@ -378,31 +1223,20 @@ int mesh_query(char **args)
 int mesh_install(char **args)
 {
     /* Install the game */
-    char ascii_gen_hash[SHA256_DIGEST_LENGTH];
+    unsigned char gen_hash[32];
     int i;
     int validated = 0;
-    if ((validated = mesh_install_validate_args(args))){
+    // validation hashes the game, so gen_hash is filled in from here on
+    if ((validated = mesh_install_validate_args(args, gen_hash))){
         return validated;
     }
 
-    // store hash value
-    char read_hash[SHA256_DIGEST_LENGTH];
+    // store the hash the game was just checked against
+    char read_hash[SHA256_DIGEST_LENGTH + 1];
     if (mesh_read_hash(args[1], read_hash)) {
         printf("Failed to read hash");
         return 1;
     }
-    char gen_hash[SHA256_DIGEST_LENGTH];
-    if(mesh_sha256_file(args[1], gen_hash)){
-        printf("Failed to gen hash");
-        return 1;
-    }
-    for(i = 0; i < 32; i++)
-    {
-        sprintf(&ascii_gen_hash[i*2],"%02x", gen_hash[i]);
-    }
-    ascii_gen_hash[SHA256_DIGEST_LENGTH] = '\0';
-    memcpy(read_hash, ascii_gen_hash, 1);
-    read_hash[SHA256_DIGEST_LENGTH] = '\0';
 
     char* full_game_name = args[1];
 
@@ -438,41 +1272,17 @@ int mesh_install(char **args)
     row.minor_version = simple_strtoul(minor_version, NULL, 10);
 
 
-    for (int i = 0; i < SHA256_DIGEST_LENGTH && read_hash[i] != '\0'; i++) {
-        row.hash[i] = read_hash[i];
-    }
-    row.hash[64] = '\0';
+    memcpy(row.hash, read_hash, SHA256_DIGEST_LENGTH);
+    row.hash[SHA256_DIGEST_LENGTH] = '\0';
 
     printf("Installing game %s for %s...\n", row.game_name, row.user_name);
 
-
-    // Get the initial offset into the games table
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
-    // Flag for if this row is in use
-
-    struct games_tbl_row flash_row;
-    // Find the end of the table
-    for(mesh_flash_read(&flash_row, offset, sizeof(struct games_tbl_row));
-        flash_row.install_flag != MESH_TABLE_END;
-        mesh_flash_read(&flash_row, offset, sizeof(struct games_tbl_row)))
-    {
-        offset += sizeof(struct games_tbl_row);
+    // Append the row (and the new end of table marker) to the install table
+    if (mesh_cache_append(&row)) {
+        printf("Failed to write install table\n");
+        return 1;
     }
 
-    // Write this row at the specified offset
-    mesh_flash_write(&row, offset, sizeof(struct games_tbl_row));
-    // Now we need to potentially signal the end of the table
-    // I say potentially because it's possible that we wrote over a game
-    // that was uninstalled, in which case we don't need to write the end of
-    // the table since we can assume that it's already there
-
-    // Increase the offset to past this row
-    offset += sizeof(struct games_tbl_row);
-
-    // Write the end of the table
-    char end = MESH_TABLE_END;
-    mesh_flash_write(&end, offset, sizeof(char));
-
     printf("%s was successfully installed for %s\n", row.game_name, row.user_name);
     return 0;
 }
@@ -492,30 +1302,28 @@ int mesh_uninstall(char **args)
         return 0;
     }
 
-    struct games_tbl_row row;
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
+    struct games_tbl_row *row;
+    char full_name[MESH_FULL_NAME_LENGTH];
+    int index;
 
     printf("Uninstalling %s for %s...\n", args[1], user.name);
-    for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
-        row.install_flag != MESH_TABLE_END;
-        mesh_flash_read(&row, offset, sizeof(struct games_tbl_row)))
+    for(index = mesh_cache_find(user.name, args[1], MESH_TABLE_CACHE_NONE);
+        index != MESH_TABLE_CACHE_NONE;
+        index = mesh_cache_find(user.name, args[1], index))
     {
-        // the most space that we could need to store the full game name
-        char* full_name = (char*) malloc(snprintf(NULL, 0, "%s-v%d.%d", row.game_name, row.major_version, row.minor_version) + 1);
-        full_name_from_short_name(full_name, &row);
+        row = &table_cache.rows[index];
+        full_name_from_short_name(full_name, row);
 
-        if (strcmp(row.user_name, user.name) == 0 &&
-            strcmp(full_name, args[1]) == 0 &&
-            row.install_flag == MESH_TABLE_INSTALLED)
+        if (strcmp(full_name, args[1]) == 0 &&
+            row->install_flag == MESH_TABLE_INSTALLED)
         {
-            row.install_flag = MESH_TABLE_UNINSTALLED;
-            mesh_flash_write(&row, offset, sizeof(struct games_tbl_row));
+            if (mesh_cache_set_flag(index, MESH_TABLE_UNINSTALLED)) {
+                printf("Failed to write install table\n");
+                return 1;
+            }
             printf("%s was successfully uninstalled for %s\n", args[1], user.name);
-            free(full_name);
             break;
         }
-        free(full_name);
-        offset += sizeof(struct games_tbl_row);
     }
 
     return 0;
@@ -592,23 +1400,48 @@ void mesh_loop(void) {
     memset(user.pin, 0, MAX_STR_LEN);
 
 
-    mesh_flash_init();
+    // Nothing works without the users and game key
+    if (mesh_data_init())
+    {
+        printf("Error loading the provisioning data\n");
+        while(1);
+    }
+
+    if (mesh_flash_init())
+        while(1);
     if (mesh_is_first_table_write())
     {
         printf("Performing first time setup...\n");
-        mesh_init_table();
+        if (mesh_init_table())
+        {
+            printf("Error setting up the install table\n");
+            while(1);
+        }
         printf("Done!\n");
     }
 
+    // Every game file access goes through this one mount of the games partition
+    if (mesh_ext4_mount())
+        printf("Error mounting the games partition\n");
+
+    // Headers, sizes and hashes come from the game index if there is one
+    mesh_index_load();
+
+    // Pull the install table into RAM so commands don't have to walk flash
+    if (mesh_cache_load())
+    {
+        printf("Error loading the install table\n");
+        while(1);
+    }
 
     // Perform first time initialization to ensure that the default
     // games are present
     strncpy(user.name, "demo", 5);
     strncpy(user.pin, "00000000", 9);
 
-    for(int i = 0; i < NUM_DEFAULT_GAMES; ++i)
+    for(int i = 0; i < mesh_data.num_default_games; ++i)
     {
-        char* install_args[] = {"install", default_games[i], '\0'};
+        char* install_args[] = {"install", mesh_data.default_games[i], '\0'};
         int ret_code = mesh_install(install_args);
         if (ret_code != 0 && ret_code != 5 && ret_code != 6)
         {
@@ -650,6 +1483,8 @@ void mesh_loop(void) {
         if (status == MESH_SHUTDOWN)
             break;
     }
+
+    mesh_ext4_unmount();
 }
 
 /******************************************************************************/
@@ -775,7 +1610,8 @@ int mesh_ls_iterate_dir(struct ext2fs_node *dir, char *fname)
                 switch (type) {
                     case FILETYPE_REG:
                         // only print name if the user is in valid install list
-                        if (strstr(filename, "SHA256") == NULL) {
+                        if (strstr(filename, "SHA256") == NULL &&
+                            strcmp(filename, MESH_INDEX_FILE) != 0) {
                             mesh_get_game_header(&game, filename);
                             if (mesh_check_user(&game)) {
                                 printf("%d      ", game_num++);
@@ -783,157 +1619,1042 @@ int mesh_ls_iterate_dir(struct ext2fs_node *dir, char *fname)
                             }
                         }
 
-                        break;
-                    default:
-                        break;
-                }
-            }
-            free(fdiro);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            free(fdiro);
+        }
+        fpos += le16_to_cpu(dirent.direntlen);
+    }
+    return 0;
+}
+
+/*
+    This function returns the card behind the games partition, or NULL if it
+    is gone.
+*/
+static struct mmc *mesh_ext4_card(void){
+    struct mmc *mmc = find_mmc_device(ext4_session.dev_desc->devnum);
+
+    if (!mmc || !mmc->has_init || mmc_getcd(mmc) == 0)
+        return NULL;
+
+    return mmc;
+}
+
+/*
+    This function makes sure the games partition is mounted. It only goes to
+    the SD card if it isn't mounted yet, something else has mounted or closed
+    an ext4 filesystem since, or the card has changed; otherwise it is just a
+    few comparisons. It returns 0 on success.
+*/
+int mesh_ext4_mount(void){
+    struct mmc *mmc;
+
+    if (ext4_session.root && ext4_session.root == ext4fs_root &&
+        get_fs()->dev_desc == ext4_session.dev_desc) {
+        mmc = mesh_ext4_card();
+        if (mmc && !memcmp(mmc->cid, ext4_session.cid, sizeof(ext4_session.cid)))
+            return 0;
+    }
+
+    mesh_ext4_unmount();
+
+    if (blk_get_device_part_str(MESH_GAMES_IFNAME, MESH_GAMES_PART, &ext4_session.dev_desc,
+                                &ext4_session.info, 1) < 0)
+        return -1;
+
+    ext4fs_set_blk_dev(ext4_session.dev_desc, &ext4_session.info);
+    if (!ext4fs_mount(ext4_session.info.size)) {
+        ext4fs_close();
+        return -1;
+    }
+
+    ext4_session.root = ext4fs_root;
+    mmc = mesh_ext4_card();
+    if (mmc)
+        memcpy(ext4_session.cid, mmc->cid, sizeof(ext4_session.cid));
+
+    return 0;
+}
+
+/*
+    This function closes the games partition if it is still the mounted ext4
+    filesystem.
+*/
+void mesh_ext4_unmount(void){
+    if (ext4_session.root && ext4_session.root == ext4fs_root)
+        ext4fs_close();
+
+    ext4_session.root = NULL;
+}
+
+/*
+    This function frees the node ext4fs_open leaves in ext4fs_file, which
+    ext4fs_close would otherwise do.
+*/
+static void mesh_ext4_release_file(void){
+    if (ext4fs_file && ext4fs_root) {
+        ext4fs_free_node(ext4fs_file, &ext4fs_root->diropen);
+        ext4fs_file = NULL;
+    }
+}
+
+/*
+    This is derived from the ext4fs_ls function in ext4fs.c:158
+    It is meant to be a standalone function by setting the correct
+    device to read from and then querying files from the custom mesh
+    file iterator.
+*/
+int mesh_ls_ext4(const char *dirname, char *filename)
+{
+    int ret = 0;
+
+    struct ext2fs_node *dirnode;
+    int status;
+
+    if (dirname == NULL)
+        return 0;
+
+    status = ext4fs_find_file(dirname, &ext4fs_root->diropen, &dirnode,
+                              FILETYPE_DIRECTORY);
+    if (status != 1) {
+        printf("** Can not find directory. **\n");
+        return -1;
+    }
+
+    ret = mesh_ls_iterate_dir(dirnode, filename);
+    ext4fs_free_node(dirnode, &ext4fs_root->diropen);
+
+    return ret ;
+}
+
+int mesh_query_ext4(const char *dirname, char *filename){
+
+    int ret = 0;
+
+    if (mesh_ext4_mount())
+        return -1;
+
+    // fs/fs.c:281
+    ret = mesh_ls_ext4(dirname, filename);
+
+    return ret;
+}
+
+/*
+    This function gets the size of a file on a ext4 partion. It uses the
+    u-boot ext4 fs functions to determine the size.
+*/
+loff_t mesh_size_ext4(char *fname){
+    loff_t size = -1;
+
+    if (mesh_ext4_mount())
+        return -1;
+
+    // fs/fs.c:281
+    if (ext4fs_size(fname, &size) < 0)
+        size = -1;
+
+    mesh_ext4_release_file();
+
+    return size;
+}
+
+loff_t mesh_read_ext4(char *fname, char*buf, loff_t size){
+    return mesh_read_ext4_offset(fname, buf, 0, size);
+}
+
+/*
+    This function reads size bytes starting at offset of a file on the ext4
+    partition into buf. It returns the number of bytes read, which is less
+    than size if the file ends first, or -1 on error.
+*/
+loff_t mesh_read_ext4_offset(char *fname, char *buf, loff_t offset, loff_t size){
+    loff_t actually_read = 0;
+
+    if (mesh_ext4_mount())
+        return -1;
+
+    if (ext4_read_file(fname, buf, offset, size, &actually_read) < 0)
+        actually_read = -1;
+
+    mesh_ext4_release_file();
+
+    return actually_read;
+}
+
+/*
+    This function starts reading size bytes at offset of a file on the ext4
+    partition into buf and returns without waiting for the bulk of it, so the
+    caller can decrypt or hash the last chunk while the SD card transfers this
+    one. buf must be cache line aligned for the transfer to run in the
+    background. The read has to be finished with mesh_read_ext4_wait, even if
+    this fails. It returns 0 on success.
+*/
+int mesh_read_ext4_submit(char *fname, char *buf, loff_t offset, loff_t size,
+                          struct ext4fs_read_req *req){
+    loff_t file_len;
+    int ret = -1;
+
+    req->num = 0;
+    req->len = 0;
+
+    if (mesh_ext4_mount())
+        return -1;
+
+    if (ext4fs_open(fname, &file_len) < 0)
+        printf("** File not found %s **\n", fname);
+    else
+        ret = ext4fs_read_submit(req, buf, offset, size);
+
+    mesh_ext4_release_file();
+
+    return ret;
+}
+
+/*
+    This function waits for a read started by mesh_read_ext4_submit. It
+    returns the number of bytes read or -1 on error.
+*/
+loff_t mesh_read_ext4_wait(struct ext4fs_read_req *req){
+    loff_t actually_read;
+
+    if (ext4fs_read_wait(req, &actually_read))
+        return -1;
+
+    return actually_read;
+}
+
+/******************************************************************************/
+/******************************* End MESH Ext4 ********************************/
+/******************************************************************************/
+
+/******************************************************************************/
+/************************************* Helpers ********************************/
+/******************************************************************************/
+
+/*
+    This function moves the big endian counter block on by the number of
+    AES_BLOCKLEN blocks in offset, which is where CTR mode is offset bytes
+    after starting from counter.
+*/
+static void mesh_ctr_add(uint8_t counter[AES_BLOCKLEN], loff_t offset){
+    u64 block = offset / AES_BLOCKLEN;
+    unsigned int carry = 0;
+
+    for (int i = AES_BLOCKLEN - 1; i >= 0; --i)
+    {
+        carry += counter[i] + (block & 0xff);
+        counter[i] = carry & 0xff;
+        carry >>= 8;
+        block >>= 8;
+    }
+}
+
+/*
+    This function sets up an AES-CTR context for decrypting data that was
+    encrypted from the counter block iv, starting offset bytes in. offset
+    must be a multiple of AES_BLOCKLEN.
+*/
+static void mesh_aes_ctr_init(struct AES_ctx *ctx, const uint8_t iv[AES_BLOCKLEN], loff_t offset){
+    uint8_t counter[AES_BLOCKLEN];
+
+    memcpy(counter, iv, AES_BLOCKLEN);
+    mesh_ctr_add(counter, offset);
+
+    AES_init_ctx_iv(ctx, (uint8_t*) mesh_data.key, counter);
+}
+
+/*
+    This function stores the counter block a plain game is at offset bytes
+    in. A plain game is encrypted from the 8 byte nonce followed by zeros.
+*/
+static void mesh_game_iv(uint8_t iv[AES_BLOCKLEN], loff_t offset){
+    memset(iv, 0, AES_BLOCKLEN);
+    memcpy(iv, mesh_data.nonce, MESH_NONCE_LENGTH);
+    mesh_ctr_add(iv, offset);
+}
+
+/*
+    This function frees what mesh_game_open read about a game.
+*/
+void mesh_game_close(struct mesh_game_layout *layout){
+    free(layout->manifest);
+    memset(layout, 0, sizeof(struct mesh_game_layout));
+}
+
+/*
+    This function returns 1 if the game index lists game_name as a
+    deduplicated game, whose manifest hash is set, and 0 otherwise.
+*/
+static int mesh_index_is_manifest(struct mesh_index_entry *entry){
+    unsigned char bits = 0;
+
+    for (int i = 0; i < sizeof(entry->manifest_hash); ++i)
+        bits |= entry->manifest_hash[i];
+
+    return bits != 0;
+}
+
+/*
+    This function finds out how a game is stored on the games partition and
+    its size once loaded. The manifest of a deduplicated game is read and
+    checked. When there is a game index, the manifest must also match the
+    hash the index holds for it, so it is covered by the index HMAC like the
+    rest of the entry. Its chunks aren't, but the hash of the loaded game is
+    compared with the index by play and install. The layout must be freed
+    with mesh_game_close. It returns 0 on success.
+*/
+int mesh_game_open(char *game_name, struct mesh_game_layout *layout){
+    struct mesh_manifest_header header;
+    struct mesh_index_entry *entry = NULL;
+    loff_t file_size;
+    loff_t total;
+
+    memset(layout, 0, sizeof(struct mesh_game_layout));
+
+    if (game_index.entries) {
+        entry = mesh_index_find(game_name);
+        if (!entry)
+            return 1;
+    }
+
+    file_size = mesh_size_ext4(game_name);
+    if (file_size < 0)
+        return 1;
+    layout->size = entry ? entry->size : file_size;
+
+    if (file_size < (loff_t) sizeof(header) ||
+        mesh_read_ext4_offset(game_name, (char *) &header, 0, sizeof(header)) != sizeof(header) ||
+        header.magic != MESH_MANIFEST_MAGIC ||
+        header.version != MESH_MANIFEST_VERSION) {
+        // a game the index lists as a manifest can't be swapped for a
+        // plain one
+        if (entry && mesh_index_is_manifest(entry))
+            goto invalid;
+        return 0;
+    }
+    if (entry && !mesh_index_is_manifest(entry))
+        goto invalid;
+
+    // chunks are read straight into the hash ring and into place in the
+    // game memory, so they have to fit a ring buffer and keep cache lines
+    // whole
+    layout->header_offset = sizeof(header) + (loff_t) header.num_chunks * sizeof(struct mesh_manifest_chunk);
+    if (header.num_chunks > MESH_MANIFEST_MAX_CHUNKS ||
+        header.header_size == 0 || header.header_size > MESH_GAME_HEADER_MAX ||
+        header.chunk_size == 0 || header.chunk_size > MESH_HASH_RING_CHUNK ||
+        header.chunk_size % ARCH_DMA_MINALIGN ||
+        file_size != layout->header_offset + header.header_size ||
+        (entry && entry->size != header.size))
+        goto invalid;
+
+    layout->manifest = malloc(file_size);
+    if (!layout->manifest || mesh_read_ext4(game_name, layout->manifest, file_size) != file_size)
+        goto invalid;
+
+    if (entry) {
+        unsigned char manifest_hash[32];
+        unsigned char diff = 0;
+
+        sha256_csum_wd((unsigned char *) layout->manifest, file_size, manifest_hash, CHUNKSZ_SHA256);
+        for (int i = 0; i < sizeof(manifest_hash); ++i)
+            diff |= manifest_hash[i] ^ entry->manifest_hash[i];
+        if (diff)
+            goto invalid;
+    }
+
+    layout->chunks = (struct mesh_manifest_chunk *) (layout->manifest + sizeof(header));
+    layout->num_chunks = header.num_chunks;
+    layout->chunk_size = header.chunk_size;
+    layout->header_size = header.header_size;
+    layout->size = header.size;
+
+    total = layout->header_size;
+    for (unsigned int i = 0; i < layout->num_chunks; ++i) {
+        loff_t length = layout->chunks[i].length;
+        loff_t stored_length = layout->chunks[i].stored_length;
+
+        if (length == 0 || length > layout->chunk_size ||
+            (i + 1 < layout->num_chunks && length != layout->chunk_size) ||
+            stored_length == 0 || stored_length > length)
+            goto invalid;
+#ifndef CONFIG_LZ4
+        if (stored_length != length) {
+            printf("%s is compressed, which needs CONFIG_LZ4\n", game_name);
+            goto invalid;
+        }
+#endif
+        total += length;
+    }
+    if (total != layout->size)
+        goto invalid;
+
+    return 0;
+
+invalid:
+    printf("Invalid manifest for %s\n", game_name);
+    mesh_game_close(layout);
+    return 1;
+}
+
+/*
+    This function returns how many pieces mesh_game_piece splits a game into.
+    A plain game is split into chunk byte pieces; a deduplicated one into its
+    header and its chunks.
+*/
+static unsigned int mesh_game_pieces(struct mesh_game_layout *layout, loff_t chunk){
+    if (layout->manifest)
+        return layout->num_chunks + 1;
+
+    return DIV_ROUND_UP(layout->size, chunk);
+}
+
+/*
+    This function describes piece i of a game: which file it is read from and
+    where, where it goes in the game, and the counter it is decrypted from.
+    Pieces of a deduplicated game are at most MESH_HASH_RING_CHUNK bytes, and
+    all but the first start and end on a cache line of the game binary.
+*/
+static void mesh_game_piece(char *game_name, struct mesh_game_layout *layout, loff_t chunk,
+                            unsigned int i, struct mesh_game_piece *piece){
+    struct mesh_manifest_chunk *c;
+
+    piece->fname = game_name;
+
+    if (!layout->manifest) {
+        piece->offset = (loff_t) i * chunk;
+        piece->file_offset = piece->offset;
+        piece->length = min_t(loff_t, layout->size - piece->offset, chunk);
+        piece->stored_length = piece->length;
+        mesh_game_iv(piece->iv, piece->offset);
+        return;
+    }
+
+    if (i == 0) {
+        piece->offset = 0;
+        piece->file_offset = layout->header_offset;
+        piece->length = layout->header_size;
+        piece->stored_length = piece->length;
+        mesh_game_iv(piece->iv, 0);
+        return;
+    }
+
+    c = &layout->chunks[i - 1];
+    sprintf(piece->chunk_name, "%s/", MESH_CHUNK_DIR);
+    for (int j = 0; j < sizeof(c->id); ++j)
+        sprintf(piece->chunk_name + sizeof(MESH_CHUNK_DIR) + 2 * j, "%02x", c->id[j]);
+
+    piece->fname = piece->chunk_name;
+    piece->offset = layout->header_size + (loff_t) (i - 1) * layout->chunk_size;
+    piece->file_offset = 0;
+    piece->length = c->length;
+    piece->stored_length = c->stored_length;
+    memcpy(piece->iv, c->iv, AES_BLOCKLEN);
+}
+
+/*
+    This function returns how far into a buffer a piece is read so that it
+    can be decompressed to the start of the same buffer: it then ends
+    MESH_LZ4_MARGIN bytes past the end of the decompressed piece, less what
+    it takes to start on a cache line. A piece that isn't compressed is read
+    to the start of the buffer.
+*/
+static loff_t mesh_inplace_offset(loff_t length, loff_t stored_length){
+    if (stored_length == length)
+        return 0;
+
+    return round_down(length + MESH_LZ4_MARGIN - stored_length, ARCH_DMA_MINALIGN);
+}
+
+/*
+    This function decompresses the LZ4 frame of a compressed piece of a game,
+    which has already been decrypted, from src to dest. src may be in the
+    same buffer as dest if it starts where mesh_inplace_offset says. It
+    returns 0 if the piece came out the size it should.
+*/
+static int mesh_inflate(void *src, loff_t stored_length, void *dest, loff_t length){
+#ifdef CONFIG_LZ4
+    size_t out = length;
+
+    if (!ulz4fn(src, stored_length, dest, &out) && out == length)
+        return 0;
+#endif
+    printf("Failed to decompress a chunk of the game\n");
+    return 1;
+}
+
+/*
+    This function reads a compressed piece of a game whole, decrypts and
+    decompresses it, and copies length bytes of it from skip bytes in to buf.
+    It returns the number of bytes copied or -1 on error.
+*/
+static loff_t mesh_read_compressed_piece(struct mesh_game_piece *piece, char *buf,
+                                         loff_t skip, loff_t length){
+    struct AES_ctx ctx;
+    loff_t ret = -1;
+    char *tmp;
+    char *src;
+
+    tmp = malloc_cache_aligned(piece->length + MESH_LZ4_MARGIN);
+    if (!tmp)
+        return -1;
+    src = tmp + mesh_inplace_offset(piece->length, piece->stored_length);
+
+    if (mesh_read_ext4_offset(piece->fname, src, piece->file_offset,
+                              piece->stored_length) == piece->stored_length) {
+        mesh_aes_ctr_init(&ctx, piece->iv, 0);
+        AES_CTR_xcrypt_buffer(&ctx, (uint8_t *) src, piece->stored_length);
+        if (!mesh_inflate(src, piece->stored_length, tmp, piece->length)) {
+            memcpy(buf, tmp + skip, length);
+            ret = length;
         }
-        fpos += le16_to_cpu(dirent.direntlen);
     }
-    return 0;
+
+    mesh_wipe(&ctx, sizeof(ctx));
+    free(tmp);
+
+    return ret;
 }
 
 /*
-    This is derived from the ext4fs_ls function in ext4fs.c:158
-    It is meant to be a standalone function by setting the correct
-    device to read from and then querying files from the custom mesh
-    file iterator.
+    This function reads length bytes of the game starting at offset and
+    decrypts just those bytes into outputBuffer, so callers that only need
+    part of a game (e.g. its header) don't have to read and decrypt all of it.
+    offset must be a multiple of AES_BLOCKLEN, and of a deduplicated game
+    fall on a whole block of one of its pieces unless that piece is
+    compressed, in which case the whole piece is read. It returns the number
+    of bytes read or -1 on error.
 */
-int mesh_ls_ext4(const char *dirname, char *filename)
-{
-    int ret = 0;
+loff_t mesh_decrypt_game_range(char *game_name, char *outputBuffer, loff_t offset, loff_t length){
+    struct mesh_game_layout layout;
+    struct mesh_game_piece piece;
+    struct AES_ctx ctx;
+    unsigned int pieces;
+    loff_t done = 0;
+    loff_t skip;
+    loff_t want;
+    loff_t read;
 
-    struct ext2fs_node *dirnode;
-    int status;
+    if (offset % AES_BLOCKLEN)
+        return -1;
+    if (mesh_game_open(game_name, &layout))
+        return -1;
 
-    if (dirname == NULL)
-        return 0;
+    pieces = mesh_game_pieces(&layout, MESH_STREAM_CHUNK);
+    for (unsigned int i = 0; i < pieces && done < length; ++i) {
+        mesh_game_piece(game_name, &layout, MESH_STREAM_CHUNK, i, &piece);
+        if (offset + done >= piece.offset + piece.length)
+            continue;
 
-    status = ext4fs_find_file(dirname, &ext4fs_root->diropen, &dirnode,
-                              FILETYPE_DIRECTORY);
-    if (status != 1) {
-        printf("** Can not find directory. **\n");
-        return -1;
+        skip = offset + done - piece.offset;
+        want = min_t(loff_t, piece.length - skip, length - done);
+        if (piece.stored_length != piece.length) {
+            read = mesh_read_compressed_piece(&piece, outputBuffer + done, skip, want);
+        } else if (skip % AES_BLOCKLEN) {
+            done = -1;
+            break;
+        } else {
+            read = mesh_read_ext4_offset(piece.fname, outputBuffer + done, piece.file_offset + skip, want);
+            if (read > 0) {
+                mesh_aes_ctr_init(&ctx, piece.iv, skip);
+                AES_CTR_xcrypt_buffer(&ctx, (uint8_t *) outputBuffer + done, read);
+            }
+        }
+        if (read <= 0) {
+            if (read < 0 && done == 0)
+                done = -1;
+            break;
+        }
+
+        done += read;
+        if (read != want)
+            break;
     }
 
-    ret = mesh_ls_iterate_dir(dirnode, filename);
+    mesh_wipe(&ctx, sizeof(ctx));
+    mesh_game_close(&layout);
 
-    return ret ;
+    return done;
 }
 
-int mesh_query_ext4(const char *dirname, char *filename){
+/*
+    This function reads and decrypts the whole game into outputBuffer, which
+    must be large enough to hold it.
+*/
+int mesh_decrypt_game(char *game_name, char *outputBuffer){
+    loff_t game_size;
 
-    int ret = 0;
+    // get the size of the game
+    game_size = mesh_game_size(game_name);
 
-    if(fs_set_blk_dev("mmc", "0:2", FS_TYPE_EXT) < 0){
-        return -1;
+    return mesh_decrypt_game_range(game_name, outputBuffer, 0, game_size) != game_size;
+}
+
+/*
+    This function decrypts a chunk of a game with decrypt_job's AES context.
+    It is the job run on CPU1 by mesh_decrypt_submit.
+*/
+static void mesh_decrypt_run(void *arg){
+    struct mesh_decrypt_job *job = arg;
+
+    AES_CTR_xcrypt_buffer(&job->ctx, job->buf, job->length);
+}
+
+/*
+    This function starts decrypting length bytes at buf in place, carrying on
+    from where the last chunk left off in decrypt_job.ctx. With
+    CONFIG_ZYNQ_CPU1_WORKER the chunk is decrypted on CPU1, so CPU0 can read
+    and hash other chunks meanwhile; otherwise it is decrypted right away.
+    A chunk that doesn't start on a cache line, like the header of a
+    deduplicated game, is always decrypted right away. The last cache line of
+    buf must not hold anything else, and buf must be left alone until
+    mesh_decrypt_wait.
+*/
+static void mesh_decrypt_submit(uint8_t *buf, loff_t length){
+    decrypt_job.buf = buf;
+    decrypt_job.length = length;
+
+#ifdef CONFIG_ZYNQ_CPU1_WORKER
+    // the caches of the two cores aren't coherent, see cpu1.c
+    if (IS_ALIGNED((ulong) buf, ARCH_DMA_MINALIGN) && !zynq_cpu1_start()) {
+        flush_dcache_range((ulong) buf, ALIGN((ulong) buf + length, ARCH_DMA_MINALIGN));
+        flush_dcache_range((ulong) &decrypt_job, (ulong) (&decrypt_job + 1));
+
+        if (!zynq_cpu1_submit(mesh_decrypt_run, &decrypt_job)) {
+            decrypt_on_cpu1 = 1;
+            return;
+        }
     }
+#endif
 
-    // fs/fs.c:281
-    ret = mesh_ls_ext4(dirname, filename);
+    mesh_decrypt_run(&decrypt_job);
+}
+
+/*
+    This function waits for the chunk passed to mesh_decrypt_submit to be
+    decrypted.
+*/
+static void mesh_decrypt_wait(void){
+#ifdef CONFIG_ZYNQ_CPU1_WORKER
+    ulong buf = (ulong) decrypt_job.buf;
 
-    ext4fs_close();
+    if (!decrypt_on_cpu1)
+        return;
 
-    return ret;
+    zynq_cpu1_wait();
+    invalidate_dcache_range((ulong) &decrypt_job, (ulong) (&decrypt_job + 1));
+    invalidate_dcache_range(buf, ALIGN(buf + decrypt_job.length, ARCH_DMA_MINALIGN));
+    decrypt_on_cpu1 = 0;
+#endif
 }
 
 /*
-    This function gets the size of a file on a ext4 partion. It uses the
-    u-boot ext4 fs functions to determine the size.
+    This function allocates the hash ring buffers the first time it is called.
+    They are kept for the life of the shell so hashing never has to go back to
+    the heap. It returns 0 on success.
 */
-loff_t mesh_size_ext4(char *fname){
-    loff_t size;
+static int mesh_hash_ring_init(void){
+    for (int i = 0; i < MESH_HASH_RING_BUFFERS; ++i) {
+        if (hash_ring.buf[i])
+            continue;
 
-    if(fs_set_blk_dev("mmc", "0:2", FS_TYPE_EXT) < 0){
-        return -1;
+        hash_ring.buf[i] = malloc_cache_aligned(MESH_HASH_RING_BUF_SIZE);
+        if (!hash_ring.buf[i]) {
+            printf("Failed to allocate the hash buffers\n");
+            return 1;
+        }
     }
 
-    // fs/fs.c:281
-    ext4fs_size(fname, &size);
+    return 0;
+}
 
-    ext4fs_close();
+/*
+    This function returns where mesh_stream_game reads piece i of a game to.
+    A piece that isn't compressed is read straight into its place in the
+    game. A compressed one is read into a hash ring buffer, which aren't used
+    while a game is streamed, and decompressed from there once it has been
+    decrypted; three pieces are on the go at once, so each has a buffer.
+*/
+static char *mesh_stream_buf(char *dest, struct mesh_game_piece *piece, unsigned int i){
+    if (piece->stored_length != piece->length)
+        return hash_ring.buf[i % MESH_HASH_RING_BUFFERS];
 
-    return size;
+    return dest + piece->offset;
 }
 
-loff_t mesh_read_ext4(char *fname, char*buf, loff_t size){
-    loff_t actually_read;
+/*
+    This function finishes piece i of a game once mesh_stream_game has
+    decrypted it: a compressed piece is decompressed into its place in the
+    game, then the piece is hashed. It returns 0 on success.
+*/
+static int mesh_stream_finish(sha256_context *sha_ctx, char *dest,
+                              struct mesh_game_piece *piece, unsigned int i){
+    if (piece->stored_length != piece->length &&
+        mesh_inflate(mesh_stream_buf(dest, piece, i), piece->stored_length,
+                     dest + piece->offset, piece->length))
+        return 1;
+
+    sha256_update(sha_ctx, (uint8_t *) dest + piece->offset, piece->length);
+
+    return 0;
+}
 
-    if(fs_set_blk_dev("mmc", "0:2", FS_TYPE_EXT) < 0){
+/*
+    This function loads the game into game_mem in a single pass. Each piece
+    is read from the SD card straight into its place in the game memory and
+    decrypted in place, and is hashed while the next one is decrypted (on
+    CPU1 with CONFIG_ZYNQ_CPU1_WORKER), so the game is only read once. A
+    compressed piece is decompressed into place on CPU0 at the same time. The
+    read of the next piece runs in the background meanwhile. The game starts
+    game_offset bytes into game_mem, which is MESH_GAME_OFFSET unless the
+    chunks of a deduplicated game need moving onto cache lines. game_mem
+    must be cache line aligned and MESH_GAME_MEM_SIZE bytes. It returns the
+    size of the game and stores the SHA256 of the decrypted game in hash, or
+    returns -1 on error.
+*/
+loff_t mesh_stream_game(char *game_name, char *game_mem, loff_t *game_offset, unsigned char hash[32]){
+    sha256_context sha_ctx;
+    struct mesh_game_layout layout;
+    struct mesh_game_piece piece;
+    struct mesh_game_piece next;
+    struct mesh_game_piece prev;
+    struct ext4fs_read_req read_req;
+    unsigned int pieces;
+    char *dest;
+    loff_t game_size = -1;
+
+    if (mesh_hash_ring_init())
         return -1;
+    if (mesh_game_open(game_name, &layout))
+        return -1;
+
+    *game_offset = MESH_GAME_OFFSET;
+    if (layout.manifest)
+        *game_offset = ALIGN(MESH_GAME_OFFSET + layout.header_size, ARCH_DMA_MINALIGN) - layout.header_size;
+    dest = game_mem + *game_offset;
+
+    if (layout.size > MESH_GAME_MEM_SIZE - *game_offset) {
+        printf("%s does not fit in the game memory\n", game_name);
+        goto out;
     }
 
-    ext4_read_file(fname, buf, 0, size, &actually_read);
+    sha256_starts(&sha_ctx);
+
+    pieces = mesh_game_pieces(&layout, MESH_STREAM_CHUNK);
+    if (pieces) {
+        mesh_game_piece(game_name, &layout, MESH_STREAM_CHUNK, 0, &piece);
+        if (mesh_read_ext4_submit(piece.fname, mesh_stream_buf(dest, &piece, 0), piece.file_offset,
+                                  piece.stored_length, &read_req)) {
+            mesh_read_ext4_wait(&read_req);
+            goto out;
+        }
+    }
 
-    ext4fs_close();
+    for (unsigned int i = 0; i < pieces; ++i) {
+        if (mesh_read_ext4_wait(&read_req) != piece.stored_length) {
+            mesh_decrypt_wait();
+            goto out;
+        }
 
-    return actually_read;
+        // start reading the next piece while this one is decrypted
+        if (i + 1 < pieces) {
+            mesh_game_piece(game_name, &layout, MESH_STREAM_CHUNK, i + 1, &next);
+            if (mesh_read_ext4_submit(next.fname, mesh_stream_buf(dest, &next, i + 1), next.file_offset,
+                                      next.stored_length, &read_req)) {
+                mesh_read_ext4_wait(&read_req);
+                mesh_decrypt_wait();
+                goto out;
+            }
+        }
+
+        // then decrypt this piece while the last one is decompressed and
+        // hashed
+        mesh_decrypt_wait();
+        mesh_aes_ctr_init(&decrypt_job.ctx, piece.iv, 0);
+        mesh_decrypt_submit((uint8_t *) mesh_stream_buf(dest, &piece, i), piece.stored_length);
+        if (i > 0 && mesh_stream_finish(&sha_ctx, dest, &prev, i - 1)) {
+            mesh_read_ext4_wait(&read_req);
+            mesh_decrypt_wait();
+            goto out;
+        }
+
+        prev = piece;
+        if (i + 1 < pieces)
+            piece = next;
+    }
+
+    mesh_decrypt_wait();
+    if (pieces && mesh_stream_finish(&sha_ctx, dest, &prev, pieces - 1))
+        goto out;
+    sha256_finish(&sha_ctx, hash);
+    game_size = layout.size;
+
+out:
+    mesh_game_close(&layout);
 
+    return game_size;
 }
 
-/******************************************************************************/
-/******************************* End MESH Ext4 ********************************/
-/******************************************************************************/
+/*
+    This function returns where the piece in a hash ring buffer is read to
+    and decrypted.
+*/
+static char *mesh_hash_ring_data(unsigned int slot){
+    return hash_ring.buf[slot] + mesh_inplace_offset(hash_ring.length[slot],
+                                                     hash_ring.stored_length[slot]);
+}
 
-/******************************************************************************/
-/************************************* Helpers ********************************/
-/******************************************************************************/
+/*
+    This function starts reading ahead into every free buffer of the hash
+    ring, one piece of the game each, up to the end of the game. The reads
+    carry on in the background until mesh_hash_ring_decrypt is called on their
+    buffer. A compressed piece is read into the end of its buffer, to be
+    decompressed in place once it is decrypted. It returns 0 on success.
+*/
+static int mesh_hash_ring_fill(char *game_name, struct mesh_game_layout *layout,
+                               unsigned int *next_piece, unsigned int pieces){
+    struct mesh_game_piece piece;
+    unsigned int slot;
+
+    while (hash_ring.count < MESH_HASH_RING_BUFFERS && *next_piece < pieces) {
+        slot = (hash_ring.head + hash_ring.count) % MESH_HASH_RING_BUFFERS;
+        mesh_game_piece(game_name, layout, MESH_HASH_RING_CHUNK, *next_piece, &piece);
+
+        hash_ring.length[slot] = piece.length;
+        hash_ring.stored_length[slot] = piece.stored_length;
+        if (mesh_read_ext4_submit(piece.fname, mesh_hash_ring_data(slot), piece.file_offset,
+                                  piece.stored_length, &hash_ring.read[slot]))
+            return 1;
+
+        memcpy(hash_ring.iv[slot], piece.iv, AES_BLOCKLEN);
+        hash_ring.count++;
+        (*next_piece)++;
+    }
+
+    return 0;
+}
 
 /*
-Skeleton for now
+    This function starts decrypting a hash ring buffer once it has been read.
+    It returns 0 on success.
 */
-int mesh_decrypt_game(char *game_name, char *outputBuffer){
-    struct AES_ctx ctx;
+static int mesh_hash_ring_decrypt(unsigned int slot){
+    if (mesh_read_ext4_wait(&hash_ring.read[slot]) != hash_ring.stored_length[slot])
+        return 1;
+
+    mesh_aes_ctr_init(&decrypt_job.ctx, hash_ring.iv[slot], 0);
+    mesh_decrypt_submit((uint8_t *) mesh_hash_ring_data(slot), hash_ring.stored_length[slot]);
+
+    return 0;
+}
+
+/*
+    This function waits for every read still running into the hash ring, so
+    none is left queued on the SD card after an error.
+*/
+static void mesh_hash_ring_drain(void){
+    for (int i = 0; i < MESH_HASH_RING_BUFFERS; ++i)
+        mesh_read_ext4_wait(&hash_ring.read[i]);
+}
+
+/*
+    This function computes the SHA256 of the decrypted game without loading
+    all of it. The game is read a piece of up to MESH_HASH_RING_CHUNK bytes at
+    a time into the hash ring, which is kept full ahead of the piece being
+    decrypted and hashed, so the memory used is the same for any size of
+    game. The buffer after the oldest one is decrypted (on CPU1 with
+    CONFIG_ZYNQ_CPU1_WORKER) while the oldest is decompressed, if it needs to
+    be, and hashed and the SD card fills the rest. It returns the size of the
+    game or -1 on error.
+*/
+loff_t mesh_hash_game(char *game_name, unsigned char hash[32]){
+    sha256_context sha_ctx;
+    struct mesh_game_layout layout;
+    unsigned int pieces;
+    unsigned int next_piece = 0;
+    unsigned int slot;
     loff_t game_size;
-    uint8_t* nonce = calloc(16,sizeof(uint8_t));
-    char * key;
 
-    // get the size of the game
-    game_size = mesh_size_ext4(game_name);
+    if (mesh_hash_ring_init())
+        return -1;
+
+    if (mesh_game_open(game_name, &layout))
+        return -1;
+    pieces = mesh_game_pieces(&layout, MESH_HASH_RING_CHUNK);
+
+    sha256_starts(&sha_ctx);
+    hash_ring.head = 0;
+    hash_ring.count = 0;
+
+    if (mesh_hash_ring_fill(game_name, &layout, &next_piece, pieces))
+        goto fail;
+    if (hash_ring.count && mesh_hash_ring_decrypt(0))
+        goto fail;
+
+    while (hash_ring.count) {
+        // the oldest buffer is decrypted once the decrypt is done with it,
+        // so start on the next one and hash the oldest meanwhile
+        slot = hash_ring.head;
+        mesh_decrypt_wait();
+        if (hash_ring.count > 1 &&
+            mesh_hash_ring_decrypt((slot + 1) % MESH_HASH_RING_BUFFERS))
+            goto fail;
+        if (hash_ring.stored_length[slot] != hash_ring.length[slot] &&
+            mesh_inflate(mesh_hash_ring_data(slot), hash_ring.stored_length[slot],
+                         hash_ring.buf[slot], hash_ring.length[slot]))
+            goto fail;
+        sha256_update(&sha_ctx, (uint8_t *) hash_ring.buf[slot], hash_ring.length[slot]);
+
+        hash_ring.head = (slot + 1) % MESH_HASH_RING_BUFFERS;
+        hash_ring.count--;
+
+        // refill the buffer that was just hashed
+        if (mesh_hash_ring_fill(game_name, &layout, &next_piece, pieces))
+            goto fail;
+    }
+
+    sha256_finish(&sha_ctx, hash);
+    game_size = layout.size;
+    mesh_game_close(&layout);
+
+    return game_size;
+
+fail:
+    mesh_decrypt_wait();
+    mesh_hash_ring_drain();
+    mesh_game_close(&layout);
+    return -1;
+}
 
-    //game_buffer = (uint8_t*)malloc((size_t) (game_size + 1));
-    mesh_read_ext4(game_name, outputBuffer, game_size);
+#ifdef CONFIG_MESH_GAME_BENCH
+/*
+    This function returns bytes / us in KiB/s, or 0 if no time was taken.
+*/
+static unsigned long mesh_kib_per_s(loff_t bytes, unsigned long us){
+    return us ? (unsigned long) lldiv((u64) bytes * 1000000 / 1024, us) : 0;
+}
+
+/*
+    This is a development utility that compares loading a game with just
+    reading it off the SD card. It first reads the files the game is stored
+    in into the game memory as they are, then loads the game the way play
+    does: read, decrypt, decompress and hash. The block cache is dropped
+    before each so every block comes from the card. For a compressed game it
+    also works out how long reading the game uncompressed would take at the
+    raw read rate, to compare the load against.
+
+    Usage: gamebench <game>
+*/
+int mesh_game_bench(char **args)
+{
+    struct mesh_game_layout layout;
+    struct mesh_game_piece piece;
+    struct blk_desc *desc;
+    unsigned char hash[32];
+    unsigned int pieces;
+    unsigned long start, read_us, load_us;
+    char *game_mem;
+    loff_t stored = 0;
+    loff_t pos = 0;
+    loff_t offset;
+    loff_t size;
 
-    // Key and Nonce can be accessed via keys.KEY and keys.Nonce
-    strncat(nonce, NONCE, 8);
-    key = KEY;
+    if (mesh_get_argv(args) < 2) {
+        printf("Usage: gamebench <game>\n");
+        return 0;
+    }
+    if (mesh_ext4_mount() || mesh_game_open(args[1], &layout)) {
+        printf("Failed to open %s\n", args[1]);
+        return 0;
+    }
+    desc = ext4_session.dev_desc;
+    game_mem = map_sysmem(MESH_GAME_MEM_BASE, MESH_GAME_MEM_SIZE);
+
+    // each file is read to a cache line so none goes through a bounce buffer
+    blkcache_invalidate(desc->if_type, desc->devnum);
+    start = timer_get_us();
+    pieces = mesh_game_pieces(&layout, MESH_STREAM_CHUNK);
+    for (unsigned int i = 0; i < pieces; ++i) {
+        mesh_game_piece(args[1], &layout, MESH_STREAM_CHUNK, i, &piece);
+        if (pos + piece.stored_length > MESH_GAME_MEM_SIZE)
+            pos = 0;
+        if (mesh_read_ext4_offset(piece.fname, game_mem + pos, piece.file_offset,
+                                  piece.stored_length) != piece.stored_length) {
+            printf("Failed to read %s\n", piece.fname);
+            mesh_game_close(&layout);
+            unmap_sysmem(game_mem);
+            return 0;
+        }
+        stored += piece.stored_length;
+        pos = ALIGN(pos + piece.stored_length, ARCH_DMA_MINALIGN);
+    }
+    read_us = timer_get_us() - start;
+    mesh_game_close(&layout);
+
+    blkcache_invalidate(desc->if_type, desc->devnum);
+    start = timer_get_us();
+    size = mesh_stream_game(args[1], game_mem, &offset, hash);
+    load_us = timer_get_us() - start;
+    unmap_sysmem(game_mem);
+    if (size < 0) {
+        printf("Failed to load %s\n", args[1]);
+        return 0;
+    }
 
-    // Decrypt the game
-    // What is the counter?
-    AES_init_ctx_iv(&ctx, (uint8_t*) key, (uint8_t *) nonce);
-    AES_CTR_xcrypt_buffer(&ctx, (uint8_t *) outputBuffer, game_size);
+    printf("%s: %lld bytes stored, %lld bytes loaded\n", args[1], stored, size);
+    printf("  read:  %lu us (%lu KiB/s)\n", read_us, mesh_kib_per_s(stored, read_us));
+    printf("  load:  %lu us (%lu KiB/s of game)\n", load_us, mesh_kib_per_s(size, load_us));
+    if (stored && stored < size)
+        printf("  read uncompressed: about %lu us\n",
+               (unsigned long) lldiv((u64) read_us * size, stored));
 
-    // Memcpy the buffer to a returnable pointer.
-    //memcpy(outputBuffer, outputBuffer, game_size);
     return 0;
 }
+#endif
 
 /*
-    This function reads a hash from a hash file and stores it in the
-    games_tbl_row struct.
+    This function reads the reference hash of a game into outputBuffer. When
+    the game is in the game index, the index hash is used and the .SHA256 file
+    is never read, since only the index is covered by an HMAC.
 */
-int mesh_read_hash(char *game_name, char * outputBuffer){
+int mesh_read_hash(char *game_name, char outputBuffer[SHA256_DIGEST_LENGTH + 1]){
+    struct mesh_index_entry *entry;
     loff_t hash_size;
 
+    entry = mesh_index_find(game_name);
+    if (entry) {
+        memcpy(outputBuffer, entry->hash, SHA256_DIGEST_LENGTH);
+        outputBuffer[SHA256_DIGEST_LENGTH] = '\0';
+        return 0;
+    }
+
     char* hash_fn = (char*) malloc(snprintf(NULL, 0, "%s.SHA256", game_name) + 1);
     sprintf(hash_fn, "%s.SHA256", game_name);
 
     // get file size of hash file
     hash_size = mesh_size_ext4(hash_fn);
 
-    if (hash_size < 64) {
+    if (hash_size < SHA256_DIGEST_LENGTH) {
+        free(hash_fn);
         printf("Failed to read hash properly\n");
         return 1;
     }
 
-    // read the game into a buffer
-    char hash_buffer[64];
-    mesh_read_ext4(hash_fn, hash_buffer, 64);
-    hash_buffer[64] = '\0';
+    // read the hash into a buffer
+    char hash_buffer[SHA256_DIGEST_LENGTH + 1];
+    if (mesh_read_ext4(hash_fn, hash_buffer, SHA256_DIGEST_LENGTH) != SHA256_DIGEST_LENGTH) {
+        free(hash_fn);
+        printf("Failed to read hash properly\n");
+        return 1;
+    }
+    free(hash_fn);
+    hash_buffer[SHA256_DIGEST_LENGTH] = '\0';
 
-    memcpy(outputBuffer, hash_buffer, 64);
+    memcpy(outputBuffer, hash_buffer, SHA256_DIGEST_LENGTH + 1);
 
     printf("Read hash successfully\n");
     return 0;
@@ -943,111 +2664,55 @@ int mesh_read_hash(char *game_name, char * outputBuffer){
     This function generates a SHA256 hash of the game.
  */
 int mesh_sha256_file(char *game_name, unsigned char outputBuffer[32]){
-    loff_t game_size;
-    int i = 0;
-    char * game_buffer;
-
-    // get the size of the game
-    game_size = mesh_size_ext4(game_name);
-    // read the game into a buffer
-    game_buffer = (uint8_t*)malloc((size_t) (game_size + 1));
-    //
-    mesh_decrypt_game(game_name, (char *) game_buffer);
-    //mesh_read_ext4(game_name, (char *) game_buffer, game_size);
-
-    // hash the buffer
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    sha256_context ctx;
-    sha256_starts(&ctx);
-    sha256_update(&ctx, game_buffer, (uint32_t) game_size);
-    sha256_finish(&ctx, hash);
-
-    hash[SHA256_DIGEST_LENGTH] = '\0';
-
-    memcpy(outputBuffer, hash, SHA256_DIGEST_LENGTH);
-
-    //outputBuffer[SHA256_DIGEST_LENGTH] = '\0';
-
-    free(game_buffer);
-
-    return 0;
+    return mesh_hash_game(game_name, outputBuffer) < 0;
 }
 
 /*
-    This function compares the SHA256 hash of the game to the pre-generated hash
-    file on the SD card. It returns 0 if it matches and 1 if it doesn't.
+    This function compares gen_hash, the SHA256 hash of the game as generated
+    by mesh_stream_game or mesh_hash_game, to the hash the game was
+    provisioned with (from the game index, or the hash file on the SD card).
+    If the game is installed for the user, it must also match the hash
+    recorded in the install table when it was installed. It returns 0 if
+    everything matches and 1 if anything doesn't or a hash is missing.
 */
-int mesh_check_hash(char *game_name){
-    char read_hash[65];
-    unsigned char gen_hash[32];
-    char ascii_gen_hash[SHA256_DIGEST_LENGTH];
-    struct games_tbl_row row;
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
-    int i = 0;
+int mesh_check_hash(char *game_name, unsigned char gen_hash[32]){
+    char read_hash[SHA256_DIGEST_LENGTH + 1];
+    char full_name[MESH_FULL_NAME_LENGTH];
+    struct games_tbl_row *row;
+    int index;
 
     if(mesh_read_hash(game_name, read_hash)) {
         printf("Failed to read hash from hash file!\n");
-        return 0;
+        return 1;
     }
 
-    mesh_sha256_file(game_name, gen_hash);
-
-    for(i = 0; i < 32; i++)
-    {
-        sprintf(&ascii_gen_hash[i*2],"%02x", gen_hash[i]);
-    }
-    ascii_gen_hash[SHA256_DIGEST_LENGTH] = '\0';
-
-    memcpy(read_hash, ascii_gen_hash, 1);
-    read_hash[64] = '\0';
-    ascii_gen_hash[64]= '\0';
-
-    if(mesh_game_installed(game_name)) {
-        for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
-            row.install_flag != MESH_TABLE_END;
-            mesh_flash_read(&row, offset, sizeof(struct games_tbl_row))) {
-            // the most space that we could need to store the full game name
-            char* full_name = (char*) malloc(snprintf(NULL, 0, "%s-v%d.%d", row.game_name, row.major_version, row.minor_version) + 1);
-            full_name_from_short_name(full_name, &row);
-
-            // check for game and specific user
-            if (strcmp(game_name, full_name) == 0 &&
-                strcmp(user.name, row.user_name) == 0) {
-                int number_correct = 0;
-                for(int i=0; i < 64; i++){
-                    if(memcmp(ascii_gen_hash[i], row.hash[i], 1) == 0){
-                        number_correct = number_correct + 1;
-                    }
-                }
-                if(number_correct != 63) {
-                    free(full_name);
-                    printf("Game hash has been changed.");
-                    return 0;
-                }
-                else {
-                    printf("\nHashes Matched!\n");
-                    return 0;
-                }
-            }
-            free(full_name);
-            offset += sizeof(struct games_tbl_row);
-        }
-
+    if (mesh_hash_differs(read_hash, gen_hash)) {
+        printf("Hashes did not match.\n");
+        return 1;
     }
 
-    int number_correct = 0;
-    for(int i=0; i < 64; i++){
-        if(memcmp(ascii_gen_hash[i], row.hash[i], 1) == 0){
-            number_correct = number_correct + 1;
-        }
-        if(number_correct == 63){
-            printf("Hashes match!");
+    if (!mesh_game_installed(game_name))
+        return 0;
+
+    for(index = mesh_cache_find(user.name, game_name, MESH_TABLE_CACHE_NONE);
+        index != MESH_TABLE_CACHE_NONE;
+        index = mesh_cache_find(user.name, game_name, index)) {
+        row = &table_cache.rows[index];
+        full_name_from_short_name(full_name, row);
+
+        // check for game and specific user
+        if (row->install_flag == MESH_TABLE_INSTALLED &&
+            strcmp(game_name, full_name) == 0) {
+            if (mesh_hash_differs((char *) row->hash, gen_hash)) {
+                printf("Game hash has been changed.\n");
+                return 1;
+            }
             return 0;
         }
     }
 
-    printf("\nHashes did not match.\n");
-    return 0;
+    printf("No install record for %s.\n", game_name);
+    return 1;
 }
 
 /*
@@ -1063,27 +2728,23 @@ void full_name_from_short_name(char* full_name, struct games_tbl_row* row)
     user. It return 1 if it is installed and 0 if it isnt.
 */
 int mesh_game_installed(char *game_name){
-    struct games_tbl_row row;
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
-
-    // loop through install table until table end is found
-    for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
-        row.install_flag != MESH_TABLE_END;
-        mesh_flash_read(&row, offset, sizeof(struct games_tbl_row)))
+    struct games_tbl_row *row;
+    char full_name[MESH_FULL_NAME_LENGTH];
+    int index;
+
+    // only look at the cached rows for this user and game
+    for(index = mesh_cache_find(user.name, game_name, MESH_TABLE_CACHE_NONE);
+        index != MESH_TABLE_CACHE_NONE;
+        index = mesh_cache_find(user.name, game_name, index))
     {
-        // the most space that we could need to store the full game name
-        char* full_name = (char*) malloc(snprintf(NULL, 0, "%s-v%d.%d", row.game_name, row.major_version, row.minor_version) + 1);
-        full_name_from_short_name(full_name, &row);
-        // check if game is installed and if it is for the specified user.
+        row = &table_cache.rows[index];
+        full_name_from_short_name(full_name, row);
+        // check if game is installed
         if (strcmp(game_name, full_name) == 0 &&
-            strcmp(user.name, row.user_name) == 0 &&
-            row.install_flag == MESH_TABLE_INSTALLED)
+            row->install_flag == MESH_TABLE_INSTALLED)
         {
-            free(full_name);
             return 1;
         }
-        free(full_name);
-        offset += sizeof(struct games_tbl_row);
     }
 
     return 0;
@@ -1119,11 +2780,7 @@ int mesh_play_validate_args(char **args){
         return 0;
     }
 
-    // assert game hash matches
-    if (mesh_check_hash(args[1])){
-        printf("Error installing %s, integrity check failed.\n", args[1]);
-        return 0;
-    }
+    // the game hash is checked by mesh_play as the game is loaded
 
     return 1;
 }
@@ -1135,6 +2792,9 @@ int mesh_play_validate_args(char **args){
 */
 int mesh_game_exists(char *game_name)
 {
+    if (game_index.entries)
+        return mesh_index_find(game_name) != NULL;
+
     /* List all games available to download */
     return mesh_query_ext4("/", game_name) == 1;
 }
@@ -1159,44 +2819,33 @@ int mesh_check_user(Game *game)
 */
 int mesh_check_downgrade(char *game_name, unsigned int major_version, unsigned int minor_version)
 {
-    struct games_tbl_row row;
-    unsigned int offset = MESH_INSTALL_GAME_OFFSET;
+    struct games_tbl_row *row;
     int return_value = 0;
+    int index;
 
-    for(mesh_flash_read(&row, offset, sizeof(struct games_tbl_row));
-        row.install_flag != MESH_TABLE_END;
-        mesh_flash_read(&row, offset, sizeof(struct games_tbl_row)))
+    // the cache only hands back rows for the current user and this game
+    for(index = mesh_cache_find(user.name, game_name, MESH_TABLE_CACHE_NONE);
+        index != MESH_TABLE_CACHE_NONE;
+        index = mesh_cache_find(user.name, game_name, index))
     {
-        offset += sizeof(struct games_tbl_row);
-
-        // Ignore anyone that isn't the current user
-        if (strcmp(user.name, row.user_name) != 0)
-            continue;
-
-        // ignore it if it doesn't have the same game name
-        // must make a copy, otherwise, it modified game_name, which under the covers is args[1]
-        char short_game_name[MAX_GAME_LENGTH + 1] = "";
-        strncpy(short_game_name, game_name, MAX_GAME_LENGTH);
-        strtok(short_game_name, "-");
-        if (strcmp(short_game_name, row.game_name) != 0)
-            continue;
+        row = &table_cache.rows[index];
 
         // Fail if the major version of the new game is less than the currently
         // installed game
-        if (major_version < row.major_version)
+        if (major_version < row->major_version)
         {
             return_value = 1;
         }
             // Fail if the major version of the new game is the same and the minor
             // version is less or the same
-        else if (major_version == row.major_version && minor_version < row.minor_version)
+        else if (major_version == row->major_version && minor_version < row->minor_version)
         {
             return_value = 1;
         }
             // prevent a reinstall of the same version without an uninstall
-        else if (major_version == row.major_version &&
-                 minor_version == row.minor_version &&
-                 row.install_flag == MESH_TABLE_INSTALLED)
+        else if (major_version == row->major_version &&
+                 minor_version == row->minor_version &&
+                 row->install_flag == MESH_TABLE_INSTALLED)
         {
             return_value = return_value == 1 ? return_value : 2;
         }
@@ -1208,17 +2857,60 @@ int mesh_check_downgrade(char *game_name, unsigned int major_version, unsigned i
     This function extract the game info from the header of a game file.
 */
 void mesh_get_game_header(Game *game, char *game_name){
+    struct mesh_index_entry *entry;
     loff_t game_size;
+    loff_t header_size = MESH_GAME_HEADER_READ;
+    loff_t read;
+    char* game_buffer = NULL;
     int i = 0;
     int j = 0;
 
+    // the index already has the parsed header
+    entry = mesh_index_find(game_name);
+    if (entry) {
+        strncpy(game->name, entry->name, MAX_GAME_LENGTH + 1);
+        game->major_version = entry->major_version;
+        game->minor_version = entry->minor_version;
+        game->num_users = entry->num_users;
+        memcpy(game->users, entry->users, sizeof(game->users));
+        return;
+    }
+
     // get the size of the game
-    game_size = mesh_size_ext4(game_name);
+    game_size = mesh_game_size(game_name);
+
+    // Only read and decrypt the start of the game. If the three header lines
+    // don't fit, double the read until they do, the whole game is read or
+    // MESH_GAME_HEADER_MAX is reached.
+    for (;;) {
+        if (header_size > game_size)
+            header_size = game_size;
+        if (header_size > MESH_GAME_HEADER_MAX)
+            header_size = MESH_GAME_HEADER_MAX;
+
+        char* buffer = (char*) realloc(game_buffer, header_size + 1);
+        if (!buffer)
+            break;
+        game_buffer = buffer;
+
+        read = mesh_decrypt_game_range(game_name, game_buffer, 0, header_size);
+        game_buffer[read > 0 ? read : 0] = '\0';
+
+        for (i = 0, j = 0; game_buffer[i] != '\0'; i++){
+            if (game_buffer[i] == '\n')
+                j++;
+        }
+        if (j >= 3 || header_size >= game_size || header_size >= MESH_GAME_HEADER_MAX)
+            break;
 
-    // read the game into a buffer
-    char* game_buffer = (char*) malloc(game_size + 1);
-    mesh_decrypt_game(game_name, game_buffer);
-    //mesh_read_ext4(game_name, game_buffer, game_size);
+        header_size *= 2;
+    }
+    if (!game_buffer) {
+        memset(game, 0, sizeof(Game));
+        return;
+    }
+    i = 0;
+    j = 0;
 
     // get the version, located on the first line. will always be major.minor
 
@@ -1281,8 +2973,11 @@ void mesh_get_game_header(Game *game, char *game_name){
             3 - Error, downgrade not allowed
             4 - Error, game is already installed
             5 - Error, game integrity failed
+
+    The SHA256 hash of the game is stored in gen_hash once it passes the
+    integrity check.
 */
-int mesh_valid_install(char *game_name){
+int mesh_valid_install(char *game_name, unsigned char gen_hash[32]){
     if (!mesh_game_exists(game_name)){
         printf("Game doesnt exist\n");
         return 1;
@@ -1300,7 +2995,7 @@ int mesh_valid_install(char *game_name){
     if (mesh_check_downgrade(game_name, game.major_version, game.minor_version)){
         return 3;
     }
-    if (mesh_check_hash(game_name)){
+    if (mesh_sha256_file(game_name, gen_hash) || mesh_check_hash(game_name, gen_hash)){
         return 5;
     }
 
@@ -1309,11 +3004,11 @@ int mesh_valid_install(char *game_name){
 
 /*
     This function validates the arguments for mesh_install. If the arguments are
-    valid it returns 0.
+    valid it returns 0 and gen_hash holds the SHA256 hash of the game.
 
     It implements the mesh shell install function.
 */
-int mesh_install_validate_args(char **args){
+int mesh_install_validate_args(char **args, unsigned char gen_hash[32]){
     // ensure a game name is listed
     int errno = 0;
 
@@ -1337,7 +3032,7 @@ int mesh_install_validate_args(char **args){
     char *game_name = args[1];
 
     // assert game exists in filesystem
-    errno = mesh_valid_install(game_name);
+    errno = mesh_valid_install(game_name, gen_hash);
     switch (errno) {
         case 0 :
             break;
@@ -1405,36 +3100,27 @@ void ptr_to_string(void* ptr, char* buf)
 }
 
 /*
-    This function determines if the sentinel is written to flash addres
-    MESH_SENTINEL_LOCATION yet. If it is then it returns 1, otherwise, it returns
-    0.
+    This function determines if either install table sector holds a valid
+    table header yet. If neither does, it returns 1, otherwise, it returns 0.
 */
 int mesh_is_first_table_write(void)
 {
-    /* Initialize the table where games will be installed */
-    char* sentinel = (char*) malloc(sizeof(char) * MESH_SENTINEL_LENGTH);
-    int ret = 0;
+    struct mesh_table_header header;
 
-    mesh_flash_read(sentinel, MESH_SENTINEL_LOCATION, MESH_SENTINEL_LENGTH);
-
-    if (*((unsigned int*) sentinel) != MESH_SENTINEL_VALUE)
-    {
-        ret = 1;
-    }
-    free(sentinel);
-    return ret;
+    return !mesh_table_read_header(MESH_TABLE_SECTOR_A, &header) &&
+           !mesh_table_read_header(MESH_TABLE_SECTOR_B, &header);
 }
 
 /*
     This function determines if the specified user and pin is listed in the
-    mesh_users array. If it is then the user is logged in and the function
+    provisioning data. If it is then the user is logged in and the function
     returns 1. Otherwise, it returns 0.
 */
 int mesh_validate_user(User *user)
 {
     /* Validates that the username and pin match a combination
      * provisioned with the board. This is read from the
-     * mesh_users.h header file.
+     * provisioning data by mesh_data_init.
      * Retruns 0 on success and 1 on failure. */
     uint8_t* buff;
 
@@ -1444,15 +3130,15 @@ int mesh_validate_user(User *user)
     sha256_context ctx;
     sha256_starts(&ctx);
 
-    for (int i = 0; i < NUM_MESH_USERS; ++i)
+    for (int i = 0; i < mesh_data.num_users; ++i)
     {
-        if (strcmp(mesh_users[i].username, user->name) == 0)
+        if (strcmp(mesh_data.users[i].username, user->name) == 0)
         {
             // copy over the data into a character array
-            buff = malloc(strlen(user->pin)+strlen(mesh_users[i].salt)+1);
+            buff = malloc(strlen(user->pin)+strlen(mesh_data.users[i].salt)+1);
             buff[0] = '\0';
             strcat(buff,user->pin);
-            strcat(buff,mesh_users[i].salt);
+            strcat(buff,mesh_data.users[i].salt);
             // update the hash
             sha256_update(&ctx,(uint8_t *) buff, (uint32_t) strlen(buff));
             sha256_finish(&ctx, hash);
@@ -1462,7 +3148,7 @@ int mesh_validate_user(User *user)
                 sprintf(&ascii_hash[y*2],"%02x", hash[y]);
             }
             // compare the calculated hash against the stored hash
-            if (strcmp(mesh_users[i].pin, ascii_hash) == 0)
+            if (strcmp(mesh_data.users[i].pin, ascii_hash) == 0)
             {
                 free(buff);
                 return 0;
@@ -386,6 +386,134 @@ int blk_get_device(int if_type, int devnum, struct udevice **devp)
 	return -ENODEV;
 }
 
+static void blk_req_advance(struct blk_req *req, lbaint_t blkcnt)
+{
+	req->start += blkcnt;
+	req->blkcnt -= blkcnt;
+	req->buffer += blkcnt * req->desc->blksz;
+	req->done += blkcnt;
+}
+
+/*
+ * Start the next transfer of a request, or finish it off with a synchronous
+ * read if the driver can't do it in the background.
+ */
+static void blk_req_start(struct blk_req *req)
+{
+	struct udevice *dev = req->desc->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+	long n;
+
+	while (req->blkcnt) {
+		n = -EOPNOTSUPP;
+		if (ops->read_start && ops->read_poll)
+			n = ops->read_start(dev, req->start, req->blkcnt,
+					    req->buffer);
+		if (n > 0) {
+			req->inflight = n;
+			return;
+		}
+		if (n == -EOPNOTSUPP) {
+			n = ops->read(dev, req->start, req->blkcnt,
+				      req->buffer);
+			if (n == req->blkcnt) {
+				blk_req_advance(req, n);
+				continue;
+			}
+			n = -EIO;
+		}
+		req->status = n;
+		return;
+	}
+	req->status = 0;
+}
+
+/*
+ * Move the read queue of a device on as far as it goes without waiting:
+ * finish the transfer in flight if it is done and start the next one.
+ */
+static void blk_queue_run(struct blk_desc *block_dev)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+	struct blk_req *req;
+	int ret;
+
+	while ((req = block_dev->req_queue)) {
+		if (req->inflight) {
+			ret = ops->read_poll(dev);
+			if (ret == -EINPROGRESS)
+				return;
+			if (ret)
+				req->status = ret;
+			else
+				blk_req_advance(req, req->inflight);
+			req->inflight = 0;
+		}
+		if (req->status == -EINPROGRESS) {
+			blk_req_start(req);
+			if (req->inflight)
+				return;
+		}
+		block_dev->req_queue = req->next;
+	}
+}
+
+static void blk_queue_drain(struct blk_desc *block_dev)
+{
+	while (block_dev->req_queue)
+		blk_queue_run(block_dev);
+}
+
+void blk_dread_submit(struct blk_desc *block_dev, struct blk_req *req,
+		      lbaint_t start, lbaint_t blkcnt, void *buffer)
+{
+	struct blk_req **tail;
+
+	req->desc = block_dev;
+	req->start = start;
+	req->blkcnt = blkcnt;
+	req->buffer = buffer;
+	req->done = 0;
+	req->inflight = 0;
+	req->status = -EINPROGRESS;
+	req->next = NULL;
+
+	if (!blk_get_ops(block_dev->bdev)->read) {
+		req->status = -ENOSYS;
+		return;
+	}
+
+	if (blkcache_read(block_dev->if_type, block_dev->devnum,
+			  start, blkcnt, block_dev->blksz, buffer)) {
+		req->done = blkcnt;
+		req->blkcnt = 0;
+		req->status = 0;
+		return;
+	}
+
+	for (tail = &block_dev->req_queue; *tail; tail = &(*tail)->next)
+		;
+	*tail = req;
+	blk_queue_run(block_dev);
+}
+
+int blk_req_poll(struct blk_req *req)
+{
+	if (req->status == -EINPROGRESS)
+		blk_queue_run(req->desc);
+
+	return req->status;
+}
+
+int blk_req_wait(struct blk_req *req)
+{
+	while (blk_req_poll(req) == -EINPROGRESS)
+		;
+
+	return req->status;
+}
+
 unsigned long blk_dread(struct blk_desc *block_dev, lbaint_t start,
 			lbaint_t blkcnt, void *buffer)
 {
@@ -399,6 +527,7 @@ unsigned long blk_dread(struct blk_desc *block_dev, lbaint_t start,
 	if (blkcache_read(block_dev->if_type, block_dev->devnum,
 			  start, blkcnt, block_dev->blksz, buffer))
 		return blkcnt;
+	blk_queue_drain(block_dev);
 	blks_read = ops->read(dev, start, blkcnt, buffer);
 	if (blks_read == blkcnt)
 		blkcache_fill(block_dev->if_type, block_dev->devnum,
@@ -416,6 +545,7 @@ unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 	if (!ops->write)
 		return -ENOSYS;
 
+	blk_queue_drain(block_dev);
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
 	return ops->write(dev, start, blkcnt, buffer);
 }
@@ -429,6 +559,7 @@ unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
 	if (!ops->erase)
 		return -ENOSYS;
 
+	blk_queue_drain(block_dev);
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
 	return ops->erase(dev, start, blkcnt);
 }
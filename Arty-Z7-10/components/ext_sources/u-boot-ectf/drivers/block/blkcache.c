@@ -22,32 +22,80 @@ struct block_cache_node {
 	char *cache;
 };
 
-static LIST_HEAD(block_cache);
+struct block_cache_pool {
+	struct list_head lru;	/* most recently used first */
+	struct block_cache_stats stats;
+};
+
+static struct block_cache_pool pools[BLKCACHE_POOLS] = {
+	[BLKCACHE_DATA] = {
+		.lru = LIST_HEAD_INIT(pools[BLKCACHE_DATA].lru),
+		.stats = {
+			.max_blocks_per_entry = 2,
+			.max_entries = CONFIG_BLOCK_CACHE_DATA_ENTRIES,
+		},
+	},
+	[BLKCACHE_INODE] = {
+		.lru = LIST_HEAD_INIT(pools[BLKCACHE_INODE].lru),
+		.stats = {
+			.max_blocks_per_entry = CONFIG_BLOCK_CACHE_META_BLOCKS,
+			.max_entries = CONFIG_BLOCK_CACHE_META_ENTRIES,
+		},
+	},
+	[BLKCACHE_DIR] = {
+		.lru = LIST_HEAD_INIT(pools[BLKCACHE_DIR].lru),
+		.stats = {
+			.max_blocks_per_entry = CONFIG_BLOCK_CACHE_META_BLOCKS,
+			.max_entries = CONFIG_BLOCK_CACHE_META_ENTRIES,
+		},
+	},
+	[BLKCACHE_INDEX] = {
+		.lru = LIST_HEAD_INIT(pools[BLKCACHE_INDEX].lru),
+		.stats = {
+			.max_blocks_per_entry = CONFIG_BLOCK_CACHE_META_BLOCKS,
+			.max_entries = CONFIG_BLOCK_CACHE_META_ENTRIES,
+		},
+	},
+};
 
-static struct block_cache_stats _stats = {
-	.max_blocks_per_entry = 2,
-	.max_entries = 32
+static const char *const pool_names[BLKCACHE_POOLS] = {
+	[BLKCACHE_DATA] = "data",
+	[BLKCACHE_INODE] = "inode",
+	[BLKCACHE_DIR] = "dir",
+	[BLKCACHE_INDEX] = "index",
 };
 
+/* pool that reads are currently being cached in */
+static int cur_pool = BLKCACHE_DATA;
+
+/*
+ * Blocks are looked for in every pool, since what one read treats as
+ * metadata another may read as plain data (e.g. ext4load of a directory).
+ */
 static struct block_cache_node *cache_find(int iftype, int devnum,
 					   lbaint_t start, lbaint_t blkcnt,
 					   unsigned long blksz)
 {
 	struct block_cache_node *node;
+	int i;
+
+	for (i = 0; i < BLKCACHE_POOLS; i++) {
+		struct list_head *lru = &pools[i].lru;
 
-	list_for_each_entry(node, &block_cache, lh)
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum) &&
-		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
+		list_for_each_entry(node, lru, lh)
+			if ((node->iftype == iftype) &&
+			    (node->devnum == devnum) &&
+			    (node->blksz == blksz) &&
+			    (node->start <= start) &&
+			    (node->start + node->blkcnt >= start + blkcnt)) {
+				if (lru->next != &node->lh) {
+					/* maintain MRU ordering */
+					list_del(&node->lh);
+					list_add(&node->lh, lru);
+				}
+				return node;
 			}
-			return node;
-		}
+	}
 	return 0;
 }
 
@@ -55,20 +103,28 @@ int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
+	struct block_cache_stats *stats = &pools[cur_pool].stats;
+	struct block_cache_node *node;
+
+	/* big reads are streaming data, don't bother looking */
+	if (blkcnt > stats->max_blocks_per_entry) {
+		++stats->bypassed;
+		return 0;
+	}
+
+	node = cache_find(iftype, devnum, start, blkcnt, blksz);
 	if (node) {
 		const char *src = node->cache + (start - node->start) * blksz;
 		memcpy(buffer, src, blksz * blkcnt);
 		debug("hit: start " LBAF ", count " LBAFU "\n",
 		      start, blkcnt);
-		++_stats.hits;
+		++stats->hits;
 		return 1;
 	}
 
 	debug("miss: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
-	++_stats.misses;
+	++stats->misses;
 	return 0;
 }
 
@@ -76,22 +132,23 @@ void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
+	struct block_cache_pool *pool = &pools[cur_pool];
 	lbaint_t bytes;
 	struct block_cache_node *node;
 
 	/* don't cache big stuff */
-	if (blkcnt > _stats.max_blocks_per_entry)
+	if (blkcnt > pool->stats.max_blocks_per_entry)
 		return;
 
-	if (_stats.max_entries == 0)
+	if (pool->stats.max_entries == 0)
 		return;
 
 	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
+	if (pool->stats.max_entries <= pool->stats.entries) {
 		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
+		node = (struct block_cache_node *)pool->lru.prev;
 		list_del(&node->lh);
-		_stats.entries--;
+		pool->stats.entries--;
 		debug("drop: start " LBAF ", count " LBAFU "\n",
 		      node->start, node->blkcnt);
 		if (node->blkcnt * node->blksz < bytes) {
@@ -113,8 +170,8 @@ void blkcache_fill(int iftype, int devnum,
 		}
 	}
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+	debug("fill %s: start " LBAF ", count " LBAFU "\n",
+	      pool_names[cur_pool], start, blkcnt);
 
 	node->iftype = iftype;
 	node->devnum = devnum;
@@ -122,52 +179,83 @@ void blkcache_fill(int iftype, int devnum,
 	node->blkcnt = blkcnt;
 	node->blksz = blksz;
 	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+	list_add(&node->lh, &pool->lru);
+	pool->stats.entries++;
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
 	struct list_head *entry, *n;
 	struct block_cache_node *node;
+	int i;
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
-			--_stats.entries;
+	for (i = 0; i < BLKCACHE_POOLS; i++) {
+		list_for_each_safe(entry, n, &pools[i].lru) {
+			node = (struct block_cache_node *)entry;
+			if ((node->iftype == iftype) &&
+			    (node->devnum == devnum)) {
+				list_del(entry);
+				free(node->cache);
+				free(node);
+				--pools[i].stats.entries;
+			}
 		}
 	}
 }
 
-void blkcache_configure(unsigned blocks, unsigned entries)
+void blkcache_configure_pool(int pool, unsigned blocks, unsigned entries)
 {
+	struct block_cache_stats *stats = &pools[pool].stats;
 	struct block_cache_node *node;
-	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries)) {
+
+	if ((blocks != stats->max_blocks_per_entry) ||
+	    (entries != stats->max_entries)) {
 		/* invalidate cache */
-		while (!list_empty(&block_cache)) {
-			node = (struct block_cache_node *)block_cache.next;
+		while (!list_empty(&pools[pool].lru)) {
+			node = (struct block_cache_node *)pools[pool].lru.next;
 			list_del(&node->lh);
 			free(node->cache);
 			free(node);
 		}
-		_stats.entries = 0;
+		stats->entries = 0;
 	}
 
-	_stats.max_blocks_per_entry = blocks;
-	_stats.max_entries = entries;
+	stats->max_blocks_per_entry = blocks;
+	stats->max_entries = entries;
 
-	_stats.hits = 0;
-	_stats.misses = 0;
+	stats->hits = 0;
+	stats->misses = 0;
+	stats->bypassed = 0;
+}
+
+void blkcache_configure(unsigned blocks, unsigned entries)
+{
+	blkcache_configure_pool(BLKCACHE_DATA, blocks, entries);
+}
+
+int blkcache_set_pool(int pool)
+{
+	int prev = cur_pool;
+
+	cur_pool = pool;
+
+	return prev;
+}
+
+void blkcache_pool_stats(int pool, struct block_cache_stats *stats)
+{
+	memcpy(stats, &pools[pool].stats, sizeof(*stats));
+	pools[pool].stats.hits = 0;
+	pools[pool].stats.misses = 0;
+	pools[pool].stats.bypassed = 0;
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
 {
-	memcpy(stats, &_stats, sizeof(*stats));
-	_stats.hits = 0;
-	_stats.misses = 0;
+	blkcache_pool_stats(BLKCACHE_DATA, stats);
+}
+
+const char *blkcache_pool_name(int pool)
+{
+	return pool_names[pool];
 }
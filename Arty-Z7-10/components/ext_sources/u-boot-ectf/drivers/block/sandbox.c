@@ -107,6 +107,8 @@ int host_dev_bind(int devnum, char *filename)
 	} else if (ret != -ENODEV) {
 		return ret;
 	}
+	/* Blocks cached from the old file don't belong to the new one */
+	blkcache_invalidate(IF_TYPE_HOST, devnum);
 
 	if (!filename)
 		return 0;
@@ -218,9 +220,39 @@ int host_get_dev_err(int devnum, struct blk_desc **blk_devp)
 }
 
 #ifdef CONFIG_BLK
+/*
+ * The host file can't be read in the background, so this only notes the
+ * read and host_block_read_poll() does it. That is enough to send
+ * blk_dread_submit() through the same queue as on a real device.
+ */
+static long host_block_read_start(struct udevice *dev, lbaint_t start,
+				  lbaint_t blkcnt, void *buffer)
+{
+	struct host_block_dev *host_dev = dev_get_priv(dev);
+
+	host_dev->start = start;
+	host_dev->blkcnt = blkcnt;
+	host_dev->buffer = buffer;
+
+	return blkcnt;
+}
+
+static int host_block_read_poll(struct udevice *dev)
+{
+	struct host_block_dev *host_dev = dev_get_priv(dev);
+
+	if (host_block_read(dev, host_dev->start, host_dev->blkcnt,
+			    host_dev->buffer) != host_dev->blkcnt)
+		return -EIO;
+
+	return 0;
+}
+
 static const struct blk_ops sandbox_host_blk_ops = {
-	.read	= host_block_read,
-	.write	= host_block_write,
+	.read		= host_block_read,
+	.write		= host_block_write,
+	.read_start	= host_block_read_start,
+	.read_poll	= host_block_read_poll,
 };
 
 U_BOOT_DRIVER(sandbox_host_blk) = {
@@ -129,6 +129,38 @@ int mmc_execute_tuning(struct mmc *mmc)
 {
 	return dm_mmc_execute_tuning(mmc->dev);
 }
+
+int dm_mmc_send_cmd_start(struct udevice *dev, struct mmc_cmd *cmd,
+			  struct mmc_data *data)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->send_cmd_start || !ops->data_poll)
+		return -EOPNOTSUPP;
+
+	return ops->send_cmd_start(dev, cmd, data);
+}
+
+int mmc_send_cmd_start(struct mmc *mmc, struct mmc_cmd *cmd,
+		       struct mmc_data *data)
+{
+	return dm_mmc_send_cmd_start(mmc->dev, cmd, data);
+}
+
+int dm_mmc_data_poll(struct udevice *dev)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->data_poll)
+		return -ENOSYS;
+
+	return ops->data_poll(dev);
+}
+
+int mmc_data_poll(struct mmc *mmc)
+{
+	return dm_mmc_data_poll(mmc->dev);
+}
 #endif
 
 struct mmc *mmc_get_mmc_dev(struct udevice *dev)
@@ -301,6 +333,10 @@ static int mmc_select_hwpart(struct udevice *bdev, int hwpart)
 
 static const struct blk_ops mmc_blk_ops = {
 	.read	= mmc_bread,
+#ifdef CONFIG_DM_MMC_OPS
+	.read_start = mmc_bread_start,
+	.read_poll = mmc_bread_poll,
+#endif
 #ifndef CONFIG_SPL_BUILD
 	.write	= mmc_bwrite,
 	.erase	= mmc_berase,
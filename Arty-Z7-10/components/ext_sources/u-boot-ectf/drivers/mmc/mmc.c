@@ -220,31 +220,31 @@ int mmc_set_blocklen(struct mmc *mmc, int len)
 	return mmc_send_cmd(mmc, &cmd, NULL);
 }
 
-static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
-			   lbaint_t blkcnt)
+static void mmc_read_blocks_cmd(struct mmc *mmc, struct mmc_cmd *cmd,
+				struct mmc_data *data, void *dst,
+				lbaint_t start, lbaint_t blkcnt)
 {
-	struct mmc_cmd cmd;
-	struct mmc_data data;
-
 	if (blkcnt > 1)
-		cmd.cmdidx = MMC_CMD_READ_MULTIPLE_BLOCK;
+		cmd->cmdidx = MMC_CMD_READ_MULTIPLE_BLOCK;
 	else
-		cmd.cmdidx = MMC_CMD_READ_SINGLE_BLOCK;
+		cmd->cmdidx = MMC_CMD_READ_SINGLE_BLOCK;
 
 	if (mmc->high_capacity)
-		cmd.cmdarg = start;
+		cmd->cmdarg = start;
 	else
-		cmd.cmdarg = start * mmc->read_bl_len;
+		cmd->cmdarg = start * mmc->read_bl_len;
 
-	cmd.resp_type = MMC_RSP_R1;
+	cmd->resp_type = MMC_RSP_R1;
 
-	data.dest = dst;
-	data.blocks = blkcnt;
-	data.blocksize = mmc->read_bl_len;
-	data.flags = MMC_DATA_READ;
+	data->dest = dst;
+	data->blocks = blkcnt;
+	data->blocksize = mmc->read_bl_len;
+	data->flags = MMC_DATA_READ;
+}
 
-	if (mmc_send_cmd(mmc, &cmd, &data))
-		return 0;
+static int mmc_read_blocks_stop(struct mmc *mmc, lbaint_t blkcnt)
+{
+	struct mmc_cmd cmd;
 
 	if (blkcnt > 1) {
 		cmd.cmdidx = MMC_CMD_STOP_TRANSMISSION;
@@ -254,10 +254,27 @@ static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
 #if !defined(CONFIG_SPL_BUILD) || defined(CONFIG_SPL_LIBCOMMON_SUPPORT)
 			printf("mmc fail to send stop cmd\n");
 #endif
-			return 0;
+			return -EIO;
 		}
 	}
 
+	return 0;
+}
+
+static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
+			   lbaint_t blkcnt)
+{
+	struct mmc_cmd cmd;
+	struct mmc_data data;
+
+	mmc_read_blocks_cmd(mmc, &cmd, &data, dst, start, blkcnt);
+
+	if (mmc_send_cmd(mmc, &cmd, &data))
+		return 0;
+
+	if (mmc_read_blocks_stop(mmc, blkcnt))
+		return 0;
+
 	return blkcnt;
 }
 
@@ -318,6 +335,61 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 	return blkcnt;
 }
 
+#if defined(CONFIG_BLK) && defined(CONFIG_DM_MMC_OPS)
+/*
+ * Start reading up to blkcnt blocks without waiting for the data, for
+ * blk_dread_submit(). At most b_max blocks are read at a time; the return
+ * value says how many were started.
+ */
+long mmc_bread_start(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+		     void *dst)
+{
+	struct blk_desc *block_dev = dev_get_uclass_platdata(dev);
+	struct mmc *mmc = find_mmc_device(block_dev->devnum);
+	struct mmc_cmd cmd;
+	int err;
+
+	if (!mmc)
+		return -ENODEV;
+
+	err = blk_dselect_hwpart(block_dev, block_dev->hwpart);
+	if (err < 0)
+		return err;
+
+	if ((start + blkcnt) > block_dev->lba)
+		return -EINVAL;
+
+	if (mmc_set_blocklen(mmc, mmc->read_bl_len))
+		return -EIO;
+
+	if (blkcnt > mmc->cfg->b_max)
+		blkcnt = mmc->cfg->b_max;
+
+	mmc_read_blocks_cmd(mmc, &cmd, &mmc->async_data, dst, start, blkcnt);
+	err = mmc_send_cmd_start(mmc, &cmd, &mmc->async_data);
+	if (err)
+		return err;
+
+	return blkcnt;
+}
+
+int mmc_bread_poll(struct udevice *dev)
+{
+	struct blk_desc *block_dev = dev_get_uclass_platdata(dev);
+	struct mmc *mmc = find_mmc_device(block_dev->devnum);
+	int err;
+
+	if (!mmc)
+		return -ENODEV;
+
+	err = mmc_data_poll(mmc);
+	if (err)
+		return err;
+
+	return mmc_read_blocks_stop(mmc, mmc->async_data.blocks);
+}
+#endif
+
 static int mmc_go_idle(struct mmc *mmc)
 {
 	struct mmc_cmd cmd;
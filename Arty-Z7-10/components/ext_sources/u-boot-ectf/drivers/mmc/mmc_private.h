@@ -28,6 +28,12 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 		void *dst);
 #endif
 
+#if defined(CONFIG_BLK) && defined(CONFIG_DM_MMC_OPS)
+long mmc_bread_start(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+		     void *dst);
+int mmc_bread_poll(struct udevice *dev);
+#endif
+
 #if !(defined(CONFIG_SPL_BUILD) && !defined(CONFIG_SPL_SAVEENV))
 
 #ifdef CONFIG_BLK
@@ -69,6 +69,111 @@ static void sdhci_transfer_pio(struct sdhci_host *host, struct mmc_data *data)
 	}
 }
 
+#ifdef CONFIG_MMC_SDHCI_ADMA
+/*
+ * Describe the data buffer with an ADMA2 descriptor table and point the
+ * controller at it. Returns 1 if the transfer will be done by DMA and 0 if
+ * it has to fall back to PIO, which is the case for buffers that are not
+ * cache line aligned as their cache lines can't be safely invalidated.
+ */
+static int sdhci_adma_prepare(struct sdhci_host *host, struct mmc_data *data)
+{
+	struct sdhci_adma_desc *desc = host->adma_desc;
+	unsigned long addr, len, size;
+	u8 ctrl;
+
+	if (!desc)
+		return 0;
+
+	if (data->flags == MMC_DATA_READ)
+		addr = (unsigned long)data->dest;
+	else
+		addr = (unsigned long)data->src;
+	len = data->blocks * data->blocksize;
+	if (!IS_ALIGNED(addr, ARCH_DMA_MINALIGN) ||
+	    !IS_ALIGNED(len, ARCH_DMA_MINALIGN) ||
+	    len > SDHCI_ADMA_DESC_COUNT * SDHCI_ADMA_MAX_LEN)
+		return 0;
+
+	/*
+	 * Clean and invalidate the buffer so that no dirty line can be
+	 * evicted over the data the controller writes into it.
+	 */
+	flush_dcache_range(addr, addr + len);
+
+	do {
+		size = min(len, (unsigned long)SDHCI_ADMA_MAX_LEN);
+		desc->attr = SDHCI_ADMA_VALID | SDHCI_ADMA_ACT_TRAN;
+		desc->len = size & 0xffff;
+		desc->addr = addr;
+		addr += size;
+		len -= size;
+		if (!len)
+			desc->attr |= SDHCI_ADMA_END;
+		desc++;
+	} while (len);
+
+	flush_dcache_range((unsigned long)host->adma_desc,
+			   ALIGN((unsigned long)desc, ARCH_DMA_MINALIGN));
+
+	sdhci_writel(host, (unsigned long)host->adma_desc, SDHCI_ADMA_ADDRESS);
+	ctrl = sdhci_readb(host, SDHCI_HOST_CONTROL);
+	ctrl &= ~SDHCI_CTRL_DMA_MASK;
+	ctrl |= SDHCI_CTRL_ADMA32;
+	sdhci_writeb(host, ctrl, SDHCI_HOST_CONTROL);
+
+	return 1;
+}
+
+/*
+ * Check on an ADMA2 transfer. The controller raises transfer complete once
+ * the last descriptor is done, so only the interrupt status register needs
+ * to be read. Returns -EINPROGRESS until the transfer is over.
+ */
+static int sdhci_adma_check(struct sdhci_host *host, struct mmc_data *data)
+{
+	unsigned int stat;
+
+	stat = sdhci_readl(host, SDHCI_INT_STATUS);
+	if (stat & SDHCI_INT_ERROR) {
+		printf("%s: Error detected in status(0x%X), ADMA error 0x%X!\n",
+		       __func__, stat, sdhci_readl(host, SDHCI_ADMA_ERROR));
+		return -EIO;
+	}
+	if (!(stat & SDHCI_INT_DATA_END))
+		return -EINPROGRESS;
+
+	if (data->flags == MMC_DATA_READ)
+		invalidate_dcache_range((unsigned long)data->dest,
+					(unsigned long)data->dest +
+					data->blocks * data->blocksize);
+
+	return 0;
+}
+
+/* Time allowed for an ADMA2 transfer in ms, enough for a 1 MB/s card */
+static ulong sdhci_adma_timeout(struct mmc_data *data)
+{
+	return 1000 + data->blocks * data->blocksize / 1024;
+}
+
+static int sdhci_adma_transfer_data(struct sdhci_host *host,
+				    struct mmc_data *data)
+{
+	ulong start = get_timer(0);
+	int ret;
+
+	while ((ret = sdhci_adma_check(host, data)) == -EINPROGRESS) {
+		if (get_timer(start) > sdhci_adma_timeout(data)) {
+			printf("%s: Transfer data timeout\n", __func__);
+			return -ETIMEDOUT;
+		}
+	}
+
+	return ret;
+}
+#endif
+
 static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data,
 				unsigned int start_addr)
 {
@@ -128,21 +233,22 @@ static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data,
 #define SDHCI_CMD_DEFAULT_TIMEOUT		100
 #define SDHCI_READ_STATUS_TIMEOUT		1000
 
-#ifdef CONFIG_DM_MMC_OPS
-static int sdhci_send_command(struct udevice *dev, struct mmc_cmd *cmd,
-			      struct mmc_data *data)
-{
-	struct mmc *mmc = mmc_get_mmc_dev(dev);
-
-#else
-static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
-			      struct mmc_data *data)
+/*
+ * Send a command and transfer its data. With nowait the function returns as
+ * soon as the command has been answered and leaves an ADMA2 transfer
+ * running for sdhci_data_poll(), or returns -EOPNOTSUPP without sending
+ * anything if the data can't be moved by ADMA2.
+ */
+static int sdhci_do_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
+				 struct mmc_data *data, bool nowait)
 {
-#endif
 	struct sdhci_host *host = mmc->priv;
 	unsigned int stat = 0;
 	int ret = 0;
 	int trans_bytes = 0, is_aligned = 1;
+#ifdef CONFIG_MMC_SDHCI_ADMA
+	int use_adma = 0;
+#endif
 	u32 mask, flags, mode;
 	unsigned int time = 0, start_addr = 0;
 	int mmc_dev = mmc_get_blk_desc(mmc)->devnum;
@@ -253,6 +359,16 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 
 		sdhci_writel(host, start_addr, SDHCI_DMA_ADDRESS);
 		mode |= SDHCI_TRNS_DMA;
+#endif
+#ifdef CONFIG_MMC_SDHCI_ADMA
+		/* Tuning blocks are only there to be sampled, not stored */
+		if (cmd->cmdidx != MMC_CMD_SEND_TUNING_BLOCK &&
+		    cmd->cmdidx != MMC_CMD_SEND_TUNING_BLOCK_HS200)
+			use_adma = sdhci_adma_prepare(host, data);
+		if (use_adma)
+			mode |= SDHCI_TRNS_DMA;
+		else if (nowait)
+			return -EOPNOTSUPP;
 #endif
 		sdhci_writew(host, SDHCI_MAKE_BLKSZ(SDHCI_DEFAULT_BOUNDARY_ARG,
 				data->blocksize),
@@ -292,6 +408,16 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 	} else
 		ret = -1;
 
+#ifdef CONFIG_MMC_SDHCI_ADMA
+	if (!ret && nowait) {
+		host->adma_data = data;
+		host->adma_start = get_timer(0);
+		return 0;
+	}
+	if (!ret && data && use_adma)
+		ret = sdhci_adma_transfer_data(host, data);
+	else
+#endif
 	if (!ret && data)
 		ret = sdhci_transfer_data(host, data, start_addr);
 
@@ -314,6 +440,62 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 	else
 		return -ECOMM;
 }
+
+#ifdef CONFIG_DM_MMC_OPS
+static int sdhci_send_command(struct udevice *dev, struct mmc_cmd *cmd,
+			      struct mmc_data *data)
+{
+	return sdhci_do_send_command(mmc_get_mmc_dev(dev), cmd, data, false);
+}
+
+#ifdef CONFIG_MMC_SDHCI_ADMA
+static int sdhci_send_cmd_start(struct udevice *dev, struct mmc_cmd *cmd,
+				struct mmc_data *data)
+{
+	if (!data)
+		return -EOPNOTSUPP;
+
+	return sdhci_do_send_command(mmc_get_mmc_dev(dev), cmd, data, true);
+}
+
+static int sdhci_data_poll(struct udevice *dev)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+	struct mmc_data *data = host->adma_data;
+	int ret;
+
+	if (!data)
+		return -EINVAL;
+
+	ret = sdhci_adma_check(host, data);
+	if (ret == -EINPROGRESS) {
+		if (get_timer(host->adma_start) <= sdhci_adma_timeout(data))
+			return ret;
+		printf("%s: Transfer data timeout\n", __func__);
+		ret = -ETIMEDOUT;
+	}
+	host->adma_data = NULL;
+
+	if (host->quirks & SDHCI_QUIRK_WAIT_SEND_CMD)
+		udelay(1000);
+
+	sdhci_writel(host, SDHCI_INT_ALL_MASK, SDHCI_INT_STATUS);
+	if (ret) {
+		sdhci_reset(host, SDHCI_RESET_CMD);
+		sdhci_reset(host, SDHCI_RESET_DATA);
+	}
+
+	return ret;
+}
+#endif
+#else
+static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
+			      struct mmc_data *data)
+{
+	return sdhci_do_send_command(mmc, cmd, data, false);
+}
+#endif
 #ifdef CONFIG_DM_MMC_OPS
 static int sdhci_execute_tuning(struct udevice *dev, u8 opcode)
 {
@@ -656,6 +838,19 @@ static int sdhci_init(struct mmc *mmc)
 		}
 	}
 
+#ifdef CONFIG_MMC_SDHCI_ADMA
+	if (!host->adma_desc &&
+	    (sdhci_readl(host, SDHCI_CAPABILITIES) & SDHCI_CAN_DO_ADMA2)) {
+		host->adma_desc = memalign(ARCH_DMA_MINALIGN,
+				ALIGN(SDHCI_ADMA_DESC_COUNT *
+				      sizeof(struct sdhci_adma_desc),
+				      ARCH_DMA_MINALIGN));
+		if (!host->adma_desc)
+			printf("%s: ADMA descriptor alloc failed, using PIO\n",
+			       __func__);
+	}
+#endif
+
 	sdhci_set_power(host, fls(mmc->cfg->voltages) - 1);
 
 	if (host->quirks & SDHCI_QUIRK_NO_CD) {
@@ -701,6 +896,10 @@ const struct dm_mmc_ops sdhci_ops = {
 	.set_voltage	= sdhci_set_voltage,
 	.set_uhs	= sdhci_set_uhs,
 	.execute_tuning	= sdhci_execute_tuning,
+#ifdef CONFIG_MMC_SDHCI_ADMA
+	.send_cmd_start	= sdhci_send_cmd_start,
+	.data_poll	= sdhci_data_poll,
+#endif
 };
 #else
 static const struct mmc_ops sdhci_ops = {
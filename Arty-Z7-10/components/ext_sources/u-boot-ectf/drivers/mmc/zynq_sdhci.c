@@ -13,6 +13,9 @@
 #include <malloc.h>
 #include <sdhci.h>
 #include <mmc.h>
+#if defined(CONFIG_ARCH_ZYNQ)
+#include <asm/arch/clk.h>
+#endif
 #include <asm/arch/hardware.h>
 #include <asm/arch/sys_proto.h>
 #include <asm/io.h>
@@ -170,6 +173,31 @@ static void arasan_sdhci_set_tapdelay(struct sdhci_host *host)
 }
 #endif
 
+#if defined(CONFIG_ARCH_ZYNQ)
+/*
+ * sdhci_setup_cfg() treats max_clk as the controller's base clock and
+ * derives every divider from it, so it must be the SDIO reference clock
+ * rather than the fastest bus clock we would like. With the 50 MHz
+ * reference clock and a 52 MHz max_clk, high speed ended up at 25 MHz.
+ */
+static u32 arasan_sdhci_get_max_clk(struct sdhci_host *host)
+{
+	unsigned long rate;
+
+	if ((unsigned long)host->ioaddr == ZYNQ_SDHCI_BASEADDR1)
+		rate = zynq_clk_get_rate(sdio1_clk);
+	else
+		rate = zynq_clk_get_rate(sdio0_clk);
+
+	return rate ? rate : CONFIG_ZYNQ_SDHCI_MAX_FREQ;
+}
+#else
+static u32 arasan_sdhci_get_max_clk(struct sdhci_host *host)
+{
+	return CONFIG_ZYNQ_SDHCI_MAX_FREQ;
+}
+#endif
+
 static int arasan_sdhci_probe(struct udevice *dev)
 {
 	struct arasan_sdhci_plat *plat = dev_get_platdata(dev);
@@ -191,7 +219,7 @@ static int arasan_sdhci_probe(struct udevice *dev)
 	if (priv->no_1p8)
 		host->quirks |= SDHCI_QUIRK_NO_1_8_V;
 
-	ret = sdhci_setup_cfg(&plat->cfg, host, CONFIG_ZYNQ_SDHCI_MAX_FREQ,
+	ret = sdhci_setup_cfg(&plat->cfg, host, arasan_sdhci_get_max_clk(host),
 			      CONFIG_ZYNQ_SDHCI_MIN_FREQ);
 	host->mmc = &plat->mmc;
 	if (ret)
@@ -36,6 +36,9 @@ lbaint_t part_offset;
 static struct blk_desc *ext4fs_blk_desc;
 static disk_partition_t *part_info;
 
+/* Number of blk_dread calls made by ext4fs_devread */
+ulong ext4fs_dev_reads;
+
 void ext4fs_set_blk_dev(struct blk_desc *rbdd, disk_partition_t *info)
 {
 	assert(rbdd->blksz == (1 << rbdd->log2blksz));
@@ -47,6 +50,39 @@ void ext4fs_set_blk_dev(struct blk_desc *rbdd, disk_partition_t *info)
 		get_fs()->dev_desc->log2blksz;
 }
 
+static ulong ext4fs_blk_dread(lbaint_t start, lbaint_t blkcnt, void *buffer)
+{
+	ext4fs_dev_reads++;
+
+	return blk_dread(ext4fs_blk_desc, part_info->start + start, blkcnt,
+			 buffer);
+}
+
+/*
+ * Queue a read of blkcnt whole device blocks without waiting for it, see
+ * blk_dread_submit(). Returns 0 if the read was queued.
+ */
+int ext4fs_devread_submit(struct blk_req *req, lbaint_t sector,
+			  lbaint_t blkcnt, char *buf)
+{
+	if (ext4fs_blk_desc == NULL) {
+		printf("** Invalid Block Device Descriptor (NULL)\n");
+		return -ENODEV;
+	}
+
+	if (sector + blkcnt > part_info->size) {
+		printf("%s read outside partition " LBAFU "\n", __func__,
+		       sector);
+		return -EINVAL;
+	}
+
+	ext4fs_dev_reads++;
+	blk_dread_submit(ext4fs_blk_desc, req, part_info->start + sector,
+			 blkcnt, buf);
+
+	return 0;
+}
+
 int ext4fs_devread(lbaint_t sector, int byte_offset, int byte_len, char *buf)
 {
 	unsigned block_len;
@@ -77,8 +113,7 @@ int ext4fs_devread(lbaint_t sector, int byte_offset, int byte_len, char *buf)
 	if (byte_offset != 0) {
 		int readlen;
 		/* read first part which isn't aligned with start of sector */
-		if (blk_dread(ext4fs_blk_desc, part_info->start + sector, 1,
-			      (void *)sec_buf) != 1) {
+		if (ext4fs_blk_dread(sector, 1, (void *)sec_buf) != 1) {
 			printf(" ** ext2fs_devread() read error **\n");
 			return 0;
 		}
@@ -100,14 +135,12 @@ int ext4fs_devread(lbaint_t sector, int byte_offset, int byte_len, char *buf)
 		ALLOC_CACHE_ALIGN_BUFFER(u8, p, ext4fs_blk_desc->blksz);
 
 		block_len = ext4fs_blk_desc->blksz;
-		blk_dread(ext4fs_blk_desc, part_info->start + sector, 1,
-			  (void *)p);
+		ext4fs_blk_dread(sector, 1, (void *)p);
 		memcpy(buf, p, byte_len);
 		return 1;
 	}
 
-	if (blk_dread(ext4fs_blk_desc, part_info->start + sector,
-		      block_len >> log2blksz, (void *)buf) !=
+	if (ext4fs_blk_dread(sector, block_len >> log2blksz, (void *)buf) !=
 			block_len >> log2blksz) {
 		printf(" ** %s read error - block\n", __func__);
 		return 0;
@@ -119,8 +152,7 @@ int ext4fs_devread(lbaint_t sector, int byte_offset, int byte_len, char *buf)
 
 	if (byte_len != 0) {
 		/* read rest of data which are not in whole sector */
-		if (blk_dread(ext4fs_blk_desc, part_info->start + sector, 1,
-			      (void *)sec_buf) != 1) {
+		if (ext4fs_blk_dread(sector, 1, (void *)sec_buf) != 1) {
 			printf("* %s read error - last part\n", __func__);
 			return 0;
 		}
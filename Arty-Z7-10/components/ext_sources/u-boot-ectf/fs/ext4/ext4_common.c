@@ -46,6 +46,22 @@ int ext4fs_indir3_blkno = -1;
 struct ext2_inode *g_parent_inode;
 static int symlinknest;
 
+/*
+ * Extent map of the last extent based inode read_allocated_block was asked
+ * about: every leaf extent of the file in file order, so that looking up a
+ * block is a search of this array instead of a walk of the extent tree. It
+ * is keyed on the root of the tree, which lives in the inode, and is reset
+ * when a file is written or the filesystem is closed.
+ */
+static struct {
+	struct datablocks root;
+	struct ext4_extent_map_entry *entries;
+	int num_entries;
+	int max_entries;
+	int last;		/* entry of the last lookup */
+	int valid;
+} ext4fs_extent_map;
+
 #if defined(CONFIG_EXT4_WRITE)
 struct ext2_block_group *ext4fs_get_group_descriptor
 	(const struct ext_filesystem *fs, uint32_t bg_idx)
@@ -1509,45 +1525,6 @@ void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 
 #endif
 
-static struct ext4_extent_header *ext4fs_get_extent_block
-	(struct ext2_data *data, char *buf,
-		struct ext4_extent_header *ext_block,
-		uint32_t fileblock, int log2_blksz)
-{
-	struct ext4_extent_idx *index;
-	unsigned long long block;
-	int blksz = EXT2_BLOCK_SIZE(data);
-	int i;
-
-	while (1) {
-		index = (struct ext4_extent_idx *)(ext_block + 1);
-
-		if (le16_to_cpu(ext_block->eh_magic) != EXT4_EXT_MAGIC)
-			return NULL;
-
-		if (ext_block->eh_depth == 0)
-			return ext_block;
-		i = -1;
-		do {
-			i++;
-			if (i >= le16_to_cpu(ext_block->eh_entries))
-				break;
-		} while (fileblock >= le32_to_cpu(index[i].ei_block));
-
-		if (--i < 0)
-			return NULL;
-
-		block = le16_to_cpu(index[i].ei_leaf_hi);
-		block = (block << 32) + le32_to_cpu(index[i].ei_leaf_lo);
-
-		if (ext4fs_devread((lbaint_t)block << log2_blksz, 0, blksz,
-				   buf))
-			ext_block = (struct ext4_extent_header *)buf;
-		else
-			return NULL;
-	}
-}
-
 static int ext4fs_blockgroup
 	(struct ext2_data *data, int group, struct ext2_block_group *blkgrp)
 {
@@ -1579,13 +1556,14 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 	int inodes_per_block, status;
 	long int blkno;
 	unsigned int blkoff;
+	int pool = blkcache_set_pool(BLKCACHE_INODE);
 
 	/* It is easier to calculate if the first inode is 0. */
 	ino--;
 	status = ext4fs_blockgroup(data, ino / le32_to_cpu
 				   (sblock->inodes_per_group), &blkgrp);
 	if (status == 0)
-		return 0;
+		goto out;
 
 	inodes_per_block = EXT2_BLOCK_SIZE(data) / fs->inodesz;
 	blkno = ext4fs_bg_get_inode_table_id(&blkgrp, fs) +
@@ -1595,10 +1573,198 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 	status = ext4fs_devread((lbaint_t)blkno << (LOG2_BLOCK_SIZE(data) -
 				log2blksz), blkoff,
 				sizeof(struct ext2_inode), (char *)inode);
-	if (status == 0)
+	if (status)
+		status = 1;
+
+out:
+	blkcache_set_pool(pool);
+
+	return status;
+}
+
+void ext4fs_extent_map_reset(void)
+{
+	free(ext4fs_extent_map.entries);
+	memset(&ext4fs_extent_map, 0, sizeof(ext4fs_extent_map));
+}
+
+static int ext4fs_extent_map_add(struct ext4_extent *extent)
+{
+	struct ext4_extent_map_entry *entry;
+
+	if (ext4fs_extent_map.num_entries == ext4fs_extent_map.max_entries) {
+		int max = ext4fs_extent_map.max_entries ?
+			ext4fs_extent_map.max_entries * 2 : 16;
+
+		entry = realloc(ext4fs_extent_map.entries,
+				max * sizeof(*entry));
+		if (!entry)
+			return -ENOMEM;
+		ext4fs_extent_map.entries = entry;
+		ext4fs_extent_map.max_entries = max;
+	}
+
+	entry = &ext4fs_extent_map.entries[ext4fs_extent_map.num_entries++];
+	entry->block = le32_to_cpu(extent->ee_block);
+	entry->len = le16_to_cpu(extent->ee_len);
+	entry->start = le16_to_cpu(extent->ee_start_hi);
+	entry->start = (entry->start << 32) + le32_to_cpu(extent->ee_start_lo);
+
+	return 0;
+}
+
+/*
+ * Add the leaf extents under ext_block to the extent map, in order. buf has
+ * room for one filesystem block per level of the tree below ext_block.
+ */
+static int ext4fs_extent_map_walk(struct ext4_extent_header *ext_block,
+				  char *buf, int depth_left, int log2_blksz)
+{
+	struct ext4_extent_idx *index;
+	unsigned long long block;
+	int blksz = EXT2_BLOCK_SIZE(ext4fs_root);
+	int i, ret, pool;
+
+	if (le16_to_cpu(ext_block->eh_magic) != EXT4_EXT_MAGIC)
+		return -EINVAL;
+
+	if (ext_block->eh_depth == 0) {
+		struct ext4_extent *extent =
+			(struct ext4_extent *)(ext_block + 1);
+
+		for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
+			ret = ext4fs_extent_map_add(&extent[i]);
+			if (ret)
+				return ret;
+		}
 		return 0;
+	}
 
-	return 1;
+	if (depth_left == 0)
+		return -EINVAL;
+
+	index = (struct ext4_extent_idx *)(ext_block + 1);
+	for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
+		block = le16_to_cpu(index[i].ei_leaf_hi);
+		block = (block << 32) + le32_to_cpu(index[i].ei_leaf_lo);
+
+		pool = blkcache_set_pool(BLKCACHE_INDEX);
+		ret = ext4fs_devread((lbaint_t)block << log2_blksz, 0, blksz,
+				     buf);
+		blkcache_set_pool(pool);
+		if (!ret)
+			return -EIO;
+
+		ret = ext4fs_extent_map_walk((struct ext4_extent_header *)buf,
+					     buf + blksz, depth_left - 1,
+					     log2_blksz);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int ext4fs_extent_map_load(struct ext2_inode *inode, int log2_blksz)
+{
+	struct ext4_extent_header *root =
+		(struct ext4_extent_header *)inode->b.blocks.dir_blocks;
+	int depth = le16_to_cpu(root->eh_depth);
+	char *buf;
+	int ret;
+
+	if (ext4fs_extent_map.valid &&
+	    !memcmp(&ext4fs_extent_map.root, &inode->b.blocks,
+		    sizeof(ext4fs_extent_map.root)))
+		return 0;
+
+	ext4fs_extent_map.valid = 0;
+	ext4fs_extent_map.num_entries = 0;
+	ext4fs_extent_map.last = 0;
+
+	/* ext4 trees are at most 5 levels deep */
+	if (depth > 5)
+		return -EINVAL;
+
+	buf = malloc(depth * EXT2_BLOCK_SIZE(ext4fs_root) + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = ext4fs_extent_map_walk(root, buf, depth, log2_blksz);
+	free(buf);
+	if (ret)
+		return ret;
+
+	memcpy(&ext4fs_extent_map.root, &inode->b.blocks,
+	       sizeof(ext4fs_extent_map.root));
+	ext4fs_extent_map.valid = 1;
+
+	return 0;
+}
+
+/*
+ * Point entries at the extent map of inode, which must be extent based, and
+ * return the number of extents in it or a negative error. The map stays
+ * valid until the next call for another inode.
+ */
+int ext4fs_get_extent_map(struct ext2_inode *inode,
+			  struct ext4_extent_map_entry **entries)
+{
+	int log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root)
+		- get_fs()->dev_desc->log2blksz;
+	int ret;
+
+	ret = ext4fs_extent_map_load(inode, log2_blksz);
+	if (ret) {
+		printf("invalid extent block\n");
+		return ret;
+	}
+
+	*entries = ext4fs_extent_map.entries;
+
+	return ext4fs_extent_map.num_entries;
+}
+
+/*
+ * Look fileblock up in the extent map. Reads usually go through a file in
+ * order, so the extent of the last lookup and the one after it are tried
+ * before searching.
+ */
+static long int ext4fs_extent_map_find(long int fileblock)
+{
+	struct ext4_extent_map_entry *entries = ext4fs_extent_map.entries;
+	int num = ext4fs_extent_map.num_entries;
+	int i = ext4fs_extent_map.last;
+	int lo, hi;
+
+	if (i >= num || fileblock < entries[i].block)
+		i = 0;
+	if (i + 1 < num && fileblock >= entries[i + 1].block)
+		i++;
+
+	if (i + 1 < num && fileblock >= entries[i + 1].block) {
+		/* last entry that starts at or before fileblock */
+		lo = 0;
+		hi = num - 1;
+		while (lo < hi) {
+			int mid = (lo + hi + 1) / 2;
+
+			if (entries[mid].block <= fileblock)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		i = lo;
+	}
+
+	ext4fs_extent_map.last = i;
+
+	/* Sparse file */
+	if (!num || fileblock < entries[i].block ||
+	    fileblock >= entries[i].block + entries[i].len)
+		return 0;
+
+	return (fileblock - entries[i].block) + entries[i].start;
 }
 
 long int read_allocated_block(struct ext2_inode *inode, int fileblock)
@@ -1610,53 +1776,19 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock)
 	long int rblock;
 	long int perblock_parent;
 	long int perblock_child;
-	unsigned long long start;
 	/* get the blocksize of the filesystem */
 	blksz = EXT2_BLOCK_SIZE(ext4fs_root);
 	log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root)
 		- get_fs()->dev_desc->log2blksz;
 
 	if (le32_to_cpu(inode->flags) & EXT4_EXTENTS_FL) {
-		long int startblock, endblock;
-		char *buf = zalloc(blksz);
-		if (!buf)
-			return -ENOMEM;
-		struct ext4_extent_header *ext_block;
-		struct ext4_extent *extent;
-		int i;
-		ext_block =
-			ext4fs_get_extent_block(ext4fs_root, buf,
-						(struct ext4_extent_header *)
-						inode->b.blocks.dir_blocks,
-						fileblock, log2_blksz);
-		if (!ext_block) {
-			printf("invalid extent block\n");
-			free(buf);
-			return -EINVAL;
-		}
-
-		extent = (struct ext4_extent *)(ext_block + 1);
+		struct ext4_extent_map_entry *entries;
+		int ret = ext4fs_get_extent_map(inode, &entries);
 
-		for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
-			startblock = le32_to_cpu(extent[i].ee_block);
-			endblock = startblock + le16_to_cpu(extent[i].ee_len);
+		if (ret < 0)
+			return ret;
 
-			if (startblock > fileblock) {
-				/* Sparse file */
-				free(buf);
-				return 0;
-
-			} else if (fileblock < endblock) {
-				start = le16_to_cpu(extent[i].ee_start_hi);
-				start = (start << 32) +
-					le32_to_cpu(extent[i].ee_start_lo);
-				free(buf);
-				return (fileblock - startblock) + start;
-			}
-		}
-
-		free(buf);
-		return 0;
+		return ext4fs_extent_map_find(fileblock);
 	}
 
 	/* Direct blocks. */
@@ -1958,6 +2090,7 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock)
  */
 void ext4fs_reinit_global(void)
 {
+	ext4fs_extent_map_reset();
 	if (ext4fs_indir1_block != NULL) {
 		free(ext4fs_indir1_block);
 		ext4fs_indir1_block = NULL;
@@ -48,8 +48,17 @@ static inline void *zalloc(size_t size)
 	return p;
 }
 
+/* One leaf extent of a file, see ext4fs_get_extent_map() */
+struct ext4_extent_map_entry {
+	uint32_t block;		/* first file block */
+	uint32_t len;
+	unsigned long long start; /* first filesystem block */
+};
+
 int ext4fs_read_inode(struct ext2_data *data, int ino,
 		      struct ext2_inode *inode);
+int ext4fs_get_extent_map(struct ext2_inode *inode,
+			  struct ext4_extent_map_entry **entries);
 int ext4fs_read_file(struct ext2fs_node *node, loff_t pos, loff_t len,
 		     char *buf, loff_t *actread);
 int ext4fs_find_file(const char *path, struct ext2fs_node *rootnode,
@@ -861,6 +861,9 @@ int ext4fs_write(const char *fname, unsigned char *buffer,
 	if (!g_parent_inode)
 		goto fail;
 
+	/* the extent trees read_allocated_block has cached may change */
+	ext4fs_extent_map_reset();
+
 	if (ext4fs_init() != 0) {
 		printf("error in File System init\n");
 		return -1;
@@ -26,10 +26,14 @@
 #include <ext4fs.h>
 #include "ext4_common.h"
 #include <div64.h>
+#include <linux/sizes.h>
 
 int ext4fs_symlinknest;
 struct ext_filesystem ext_fs;
 
+/* Number of device reads the last ext4fs_read_file took */
+ulong ext4fs_file_dev_reads;
+
 struct ext_filesystem *get_fs(void)
 {
 	return &ext_fs;
@@ -46,7 +50,7 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
  * Optimized read file API : collects and defers contiguous sector
  * reads into one potentially more efficient larger sequential read action
  */
-int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
+static int ext4fs_read_file_blocks(struct ext2fs_node *node, loff_t pos,
 		loff_t len, char *buf, loff_t *actread)
 {
 	struct ext_filesystem *fs = get_fs();
@@ -155,6 +159,96 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 	return 0;
 }
 
+/*
+ * Read an extent based file one extent at a time. Each extent is a single
+ * ext4fs_devread straight into buf, which turns into one blk_dread unless
+ * the read starts or ends part way through a sector; the block device
+ * splits it up further if it is more than the controller can transfer at
+ * once. Holes read as zeros.
+ */
+static int ext4fs_read_file_extents(struct ext2fs_node *node, loff_t pos,
+		loff_t len, char *buf, loff_t *actread)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext4_extent_map_entry *entries;
+	int log2blksz = fs->dev_desc->log2blksz;
+	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) - log2blksz;
+	int blocksize = (1 << (log2_fs_blocksize + log2blksz));
+	unsigned int filesize = le32_to_cpu(node->inode.size);
+	loff_t done, end;
+	int num, i;
+
+	/* Adjust len so it we can't read past the end of the file. */
+	if (len + pos > filesize)
+		len = (filesize - pos);
+	end = pos + len;
+
+	num = ext4fs_get_extent_map(&node->inode, &entries);
+	if (num < 0)
+		return -1;
+
+	done = pos;
+	for (i = 0; i < num && done < end; i++) {
+		loff_t ext_start = (loff_t)entries[i].block * blocksize;
+		loff_t ext_end = ext_start + (loff_t)entries[i].len * blocksize;
+		loff_t from, to;
+
+		if (ext_end <= done)
+			continue;
+		if (ext_start >= end)
+			break;
+
+		from = max(ext_start, done);
+		to = min(ext_end, end);
+		if (from > done)
+			memset(buf + (done - pos), 0, from - done);
+
+		while (from < to) {
+			/* ext4fs_devread takes an int length */
+			int chunk = min_t(loff_t, to - from, SZ_1G);
+			loff_t off = from - ext_start;
+			lbaint_t sector = (entries[i].start << log2_fs_blocksize)
+				+ (off >> log2blksz);
+
+			if (!ext4fs_devread(sector, off & (fs->dev_desc->blksz - 1),
+					    chunk, buf + (from - pos)))
+				return -1;
+			from += chunk;
+		}
+		done = to;
+	}
+	if (done < end)
+		memset(buf + (done - pos), 0, end - done);
+
+	*actread = len;
+	return 0;
+}
+
+int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
+		loff_t len, char *buf, loff_t *actread)
+{
+	ulong dev_reads = ext4fs_dev_reads;
+	int pool = BLKCACHE_DATA;
+	int ret;
+
+	if ((le16_to_cpu(node->inode.mode) & FILETYPE_INO_MASK) ==
+	    FILETYPE_INO_DIRECTORY)
+		pool = BLKCACHE_DIR;
+	pool = blkcache_set_pool(pool);
+
+	if (le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL)
+		ret = ext4fs_read_file_extents(node, pos, len, buf, actread);
+	else
+		ret = ext4fs_read_file_blocks(node, pos, len, buf, actread);
+
+	blkcache_set_pool(pool);
+
+	ext4fs_file_dev_reads = ext4fs_dev_reads - dev_reads;
+	debug("%s: %lu device reads\n", __func__, ext4fs_file_dev_reads);
+
+	return ret;
+}
+
 int ext4fs_ls(const char *dirname)
 {
 	struct ext2fs_node *dirnode;
@@ -198,6 +292,146 @@ int ext4fs_read(char *buf, loff_t offset, loff_t len, loff_t *actread)
 	return ext4fs_read_file(ext4fs_file, offset, len, buf, actread);
 }
 
+/*
+ * Start reading len bytes at offset of the open file into buf and return
+ * without waiting for the bulk of the data, so the caller can work on the
+ * previous buffer meanwhile. The first EXT4_READ_REQS whole-sector runs of
+ * the range are queued on the block device; partial sectors, holes, runs
+ * past that limit and files without extents are read before returning,
+ * ahead of the queued runs so they don't have to wait for them. The read
+ * has to be finished with ext4fs_read_wait(), even if this fails.
+ */
+int ext4fs_read_submit(struct ext4fs_read_req *rr, char *buf, loff_t offset,
+		       loff_t len)
+{
+	struct ext2fs_node *node = ext4fs_file;
+	struct ext_filesystem *fs = get_fs();
+	struct ext4_extent_map_entry *entries;
+	lbaint_t run_sector[EXT4_READ_REQS], run_count[EXT4_READ_REQS];
+	char *run_buf[EXT4_READ_REQS];
+	int log2blksz, log2_fs_blocksize, blocksize, num, runs = 0, i, pool;
+	loff_t done, end, actread;
+	ulong dev_reads = ext4fs_dev_reads;
+	int ret = -1;
+
+	rr->num = 0;
+	rr->len = 0;
+
+	if (ext4fs_root == NULL || node == NULL)
+		return -1;
+
+	if (offset + len > le32_to_cpu(node->inode.size))
+		len = le32_to_cpu(node->inode.size) - offset;
+	if (len <= 0)
+		return len < 0 ? -1 : 0;
+
+	if (!(le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL)) {
+		ret = ext4fs_read_file(node, offset, len, buf, &actread);
+		rr->len = actread;
+		return ret;
+	}
+
+	log2blksz = fs->dev_desc->log2blksz;
+	log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) - log2blksz;
+	blocksize = 1 << (log2_fs_blocksize + log2blksz);
+	end = offset + len;
+
+	num = ext4fs_get_extent_map(&node->inode, &entries);
+	if (num < 0)
+		return -1;
+
+	pool = blkcache_set_pool(BLKCACHE_DATA);
+
+	done = offset;
+	for (i = 0; i < num && done < end; i++) {
+		loff_t ext_start = (loff_t)entries[i].block * blocksize;
+		loff_t ext_end = ext_start + (loff_t)entries[i].len * blocksize;
+		lbaint_t ext_sector = entries[i].start << log2_fs_blocksize;
+		loff_t from, to, head, tail;
+
+		if (ext_end <= done)
+			continue;
+		if (ext_start >= end)
+			break;
+
+		from = max(ext_start, done);
+		to = min(ext_end, end);
+		if (from > done)
+			memset(buf + (done - offset), 0, from - done);
+		done = to;
+
+		/* extents start on a sector, so file and disk alignment agree */
+		head = ALIGN(from, fs->dev_desc->blksz);
+		tail = to & ~(loff_t)(fs->dev_desc->blksz - 1);
+		if (runs == EXT4_READ_REQS || head >= tail) {
+			head = to;
+			tail = to;
+		}
+
+		while (from < head) {
+			int chunk = min_t(loff_t, head - from, SZ_1G);
+			loff_t off = from - ext_start;
+
+			if (!ext4fs_devread(ext_sector + (off >> log2blksz),
+					    off & (fs->dev_desc->blksz - 1),
+					    chunk, buf + (from - offset)))
+				goto out;
+			from += chunk;
+		}
+		if (tail < to &&
+		    !ext4fs_devread(ext_sector + ((tail - ext_start) >> log2blksz),
+				    0, to - tail, buf + (tail - offset)))
+			goto out;
+
+		if (head < tail) {
+			run_sector[runs] = ext_sector +
+				((head - ext_start) >> log2blksz);
+			run_count[runs] = (tail - head) >> log2blksz;
+			run_buf[runs] = buf + (head - offset);
+			runs++;
+		}
+	}
+	if (done < end)
+		memset(buf + (done - offset), 0, end - done);
+
+	for (i = 0; i < runs; i++) {
+		if (ext4fs_devread_submit(&rr->blk[i], run_sector[i],
+					  run_count[i], run_buf[i]))
+			goto out;
+		rr->num++;
+	}
+
+	rr->len = len;
+	ret = 0;
+out:
+	blkcache_set_pool(pool);
+	ext4fs_file_dev_reads = ext4fs_dev_reads - dev_reads;
+
+	return ret;
+}
+
+/*
+ * Wait for a read started by ext4fs_read_submit() and return how many
+ * bytes it read in actread.
+ */
+int ext4fs_read_wait(struct ext4fs_read_req *rr, loff_t *actread)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < rr->num; i++) {
+		if (blk_req_wait(&rr->blk[i])) {
+			printf("** %s read error **\n", __func__);
+			ret = -1;
+		}
+	}
+	rr->num = 0;
+
+	*actread = ret ? 0 : rr->len;
+
+	return ret;
+}
+
 int ext4fs_probe(struct blk_desc *fs_dev_desc,
 		 disk_partition_t *fs_partition)
 {
@@ -21,6 +21,14 @@
   #define CTR 1
 #endif
 
+// AES_NEON makes CTR mode encrypt eight counter blocks at a time with a
+// bitsliced (constant time) cipher written with GCC vector extensions, which
+// build to NEON on ARM. It is off by default; build with -DAES_NEON=1 (and
+// -mfpu=neon on ARM) to use it. The T-table cipher is used otherwise.
+#ifndef AES_NEON
+  #define AES_NEON 0
+#endif
+
 
 //#define AES128 1
 //#define AES192 1
@@ -42,6 +50,10 @@
 struct AES_ctx
 {
   uint8_t RoundKey[AES_keyExpSize];
+  uint32_t RoundKeyW[AES_keyExpSize / 4]; // RoundKey as big endian words, for the T-table rounds
+#if defined(AES_NEON) && (AES_NEON == 1)
+  uint8_t RoundKeyBS[AES_keyExpSize * 8];  // RoundKey bitsliced, for the AES_NEON rounds
+#endif
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
   uint8_t Iv[AES_BLOCKLEN];
 #endif
@@ -83,6 +95,12 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 //        no IV should ever be reused with the same key
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 
+// Generates the keystream for the next nblocks counter values into out
+// (nblocks * AES_BLOCKLEN bytes) and advances the IV past them. XORing data
+// with it is the same as AES_CTR_xcrypt_buffer, but callers can generate the
+// keystream ahead of time or apply it to data as it arrives.
+void AES_CTR_keystream(struct AES_ctx* ctx, uint8_t* out, uint32_t nblocks);
+
 #endif // #if defined(CTR) && (CTR == 1)
 
 
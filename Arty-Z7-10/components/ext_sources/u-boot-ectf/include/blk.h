@@ -69,6 +69,7 @@ struct blk_desc {
 	 * device. Once these functions are removed we can drop this field.
 	 */
 	struct udevice *bdev;
+	struct blk_req	*req_queue;	/* reads from blk_dread_submit() */
 #else
 	unsigned long	(*block_read)(struct blk_desc *block_dev,
 				      lbaint_t start,
@@ -85,10 +86,43 @@ struct blk_desc {
 #endif
 };
 
+/**
+ * struct blk_req - an asynchronous block read
+ *
+ * See blk_dread_submit(). The block layer owns the request until
+ * blk_req_poll() stops returning -EINPROGRESS, so it must not be freed or
+ * reused before then.
+ */
+struct blk_req {
+	struct blk_desc *desc;
+	lbaint_t start;		/* next block to read */
+	lbaint_t blkcnt;	/* blocks left to read */
+	void *buffer;		/* where the next block goes */
+	lbaint_t done;		/* blocks read so far */
+	lbaint_t inflight;	/* blocks the driver is reading now */
+	int status;		/* -EINPROGRESS, 0 when done, or -ve error */
+	struct blk_req *next;	/* next request queued on desc */
+};
+
 #define BLOCK_CNT(size, blk_desc) (PAD_COUNT(size, blk_desc->blksz))
 #define PAD_TO_BLOCKSIZE(size, blk_desc) \
 	(PAD_SIZE(size, blk_desc->blksz))
 
+/*
+ * The block cache keeps a separate LRU pool for each kind of filesystem
+ * metadata, so that streaming through file data can't push out the inode
+ * tables, directories and extent index blocks that are read over and over.
+ * Filesystems say what they are reading with blkcache_set_pool(); anything
+ * else goes to the data pool.
+ */
+enum blkcache_pool {
+	BLKCACHE_DATA,		/* file data and anything unclassified */
+	BLKCACHE_INODE,		/* inode tables and group descriptors */
+	BLKCACHE_DIR,		/* directory blocks */
+	BLKCACHE_INDEX,		/* extent index and leaf blocks */
+	BLKCACHE_POOLS,
+};
+
 #ifdef CONFIG_BLOCK_CACHE
 /**
  * blkcache_read() - attempt to read a set of blocks from cache
@@ -132,31 +166,64 @@ void blkcache_fill(int iftype, int dev,
 void blkcache_invalidate(int iftype, int dev);
 
 /**
- * blkcache_configure() - configure block cache
+ * blkcache_configure() - configure the data pool of the block cache
  *
  * @param blocks - maximum blocks per entry
  * @param entries - maximum entries in cache
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
+/**
+ * blkcache_configure_pool() - configure one pool of the block cache
+ *
+ * @param pool - BLKCACHE_x pool
+ * @param blocks - maximum blocks per entry, larger reads bypass the pool
+ * @param entries - maximum entries in the pool
+ */
+void blkcache_configure_pool(int pool, unsigned blocks, unsigned entries);
+
+/**
+ * blkcache_set_pool() - select the pool following reads are cached in
+ *
+ * @param pool - BLKCACHE_x pool
+ * @return - the pool that was selected before, to restore afterwards
+ */
+int blkcache_set_pool(int pool);
+
 /*
  * statistics of the block cache
  */
 struct block_cache_stats {
 	unsigned hits;
 	unsigned misses;
+	unsigned bypassed; /* reads too large for the pool */
 	unsigned entries; /* current entry count */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
 };
 
 /**
- * get_blkcache_stats() - return statistics and reset
+ * get_blkcache_stats() - return statistics of the data pool and reset
  *
  * @param stats - statistics are copied here
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_pool_stats() - return statistics of one pool and reset
+ *
+ * @param pool - BLKCACHE_x pool
+ * @param stats - statistics are copied here
+ */
+void blkcache_pool_stats(int pool, struct block_cache_stats *stats);
+
+/**
+ * blkcache_pool_name() - name of a pool, for messages and commands
+ *
+ * @param pool - BLKCACHE_x pool
+ */
+const char *blkcache_pool_name(int pool);
+
 #else
 
 static inline int blkcache_read(int iftype, int dev,
@@ -172,6 +239,11 @@ static inline void blkcache_fill(int iftype, int dev,
 
 static inline void blkcache_invalidate(int iftype, int dev) {}
 
+static inline int blkcache_set_pool(int pool)
+{
+	return BLKCACHE_DATA;
+}
+
 #endif
 
 #ifdef CONFIG_BLK
@@ -235,6 +307,33 @@ struct blk_ops {
 	 * @return 0 if OK, -ve on error
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
+
+	/**
+	 * read_start() - start reading without waiting for the data
+	 *
+	 * Optional, used by blk_dread_submit(). Only one read can be in
+	 * progress on a device and nothing else may be done with it until
+	 * read_poll() has reported that the read is over.
+	 *
+	 * @dev:	Device to read from
+	 * @start:	Start block number to read (0=first)
+	 * @blkcnt:	Number of blocks wanted
+	 * @buffer:	Destination buffer for data read
+	 * @return number of blocks being read, which may be fewer than
+	 * @blkcnt, -EOPNOTSUPP if this read has to be done with read(), or
+	 * other -ve error number
+	 */
+	long (*read_start)(struct udevice *dev, lbaint_t start,
+			   lbaint_t blkcnt, void *buffer);
+
+	/**
+	 * read_poll() - check on the read started by read_start()
+	 *
+	 * @dev:	Device the read was started on
+	 * @return 0 once it has completed, -EINPROGRESS while it is still
+	 * running, other -ve error number on failure
+	 */
+	int (*read_poll)(struct udevice *dev);
 };
 
 #define blk_get_ops(dev)	((struct blk_ops *)(dev)->driver->ops)
@@ -252,6 +351,44 @@ unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
 			 lbaint_t blkcnt);
 
+/**
+ * blk_dread_submit() - queue a read without waiting for it
+ *
+ * The read is started straight away if the device is idle, otherwise it
+ * is queued behind the reads submitted before it, and it moves on each time
+ * blk_req_poll() is called on any request of the device. This lets a caller
+ * work on data it has already read while the device fetches the next
+ * buffer. Devices whose driver has no read_start() operation, and buffers
+ * the driver can't transfer into in the background, are read synchronously
+ * here instead. A blk_dread(), blk_dwrite() or blk_derase() that has to go
+ * to the device waits for every queued read first.
+ *
+ * @block_dev:	Block device to read from
+ * @req:	Request to fill in, owned by the block layer until done
+ * @start:	Start block number to read (0=first)
+ * @blkcnt:	Number of blocks to read
+ * @buffer:	Destination buffer for data read
+ */
+void blk_dread_submit(struct blk_desc *block_dev, struct blk_req *req,
+		      lbaint_t start, lbaint_t blkcnt, void *buffer);
+
+/**
+ * blk_req_poll() - move the device's read queue on and check a request
+ *
+ * @req:	Request submitted with blk_dread_submit()
+ * @return -EINPROGRESS while the read is not over, 0 once all its blocks
+ * have been read, or -ve error number
+ */
+int blk_req_poll(struct blk_req *req);
+
+/**
+ * blk_req_wait() - wait for a request to complete
+ *
+ * @req:	Request submitted with blk_dread_submit()
+ * @return 0 once all its blocks have been read, or -ve error number
+ */
+int blk_req_wait(struct blk_req *req);
+
 /**
  * blk_get_device() - Find and probe a block device ready for use
  *
@@ -407,6 +544,26 @@ static inline ulong blk_derase(struct blk_desc *block_dev, lbaint_t start,
 	return block_dev->block_erase(block_dev, start, blkcnt);
 }
 
+/* Without driver model every read is done synchronously when submitted */
+static inline void blk_dread_submit(struct blk_desc *block_dev,
+				    struct blk_req *req, lbaint_t start,
+				    lbaint_t blkcnt, void *buffer)
+{
+	req->desc = block_dev;
+	req->done = blk_dread(block_dev, start, blkcnt, buffer);
+	req->status = req->done == blkcnt ? 0 : -EIO;
+}
+
+static inline int blk_req_poll(struct blk_req *req)
+{
+	return req->status;
+}
+
+static inline int blk_req_wait(struct blk_req *req)
+{
+	return req->status;
+}
+
 /**
  * struct blk_driver - Driver for block interface types
  *
@@ -118,6 +118,18 @@ struct ext_filesystem {
 
 extern struct ext2_data *ext4fs_root;
 extern struct ext2fs_node *ext4fs_file;
+extern ulong ext4fs_dev_reads;
+extern ulong ext4fs_file_dev_reads;
+
+/* Device reads one ext4fs_read_submit() can leave in flight */
+#define EXT4_READ_REQS		4
+
+/* A read of the open file left running by ext4fs_read_submit() */
+struct ext4fs_read_req {
+	struct blk_req blk[EXT4_READ_REQS];
+	int num;		/* entries of blk in use */
+	loff_t len;		/* bytes the read returns */
+};
 
 #if defined(CONFIG_EXT4_WRITE)
 extern struct ext2_inode *g_parent_inode;
@@ -136,14 +148,20 @@ int ext4_write_file(const char *filename, void *buf, loff_t offset, loff_t len,
 struct ext_filesystem *get_fs(void);
 int ext4fs_open(const char *filename, loff_t *len);
 int ext4fs_read(char *buf, loff_t offset, loff_t len, loff_t *actread);
+int ext4fs_read_submit(struct ext4fs_read_req *rr, char *buf, loff_t offset,
+		       loff_t len);
+int ext4fs_read_wait(struct ext4fs_read_req *rr, loff_t *actread);
 int ext4fs_mount(unsigned part_length);
 void ext4fs_close(void);
 void ext4fs_reinit_global(void);
+void ext4fs_extent_map_reset(void);
 int ext4fs_ls(const char *dirname);
 int ext4fs_exists(const char *filename);
 int ext4fs_size(const char *filename, loff_t *size);
 void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot);
 int ext4fs_devread(lbaint_t sector, int byte_offset, int byte_len, char *buf);
+int ext4fs_devread_submit(struct blk_req *req, lbaint_t sector,
+			  lbaint_t blkcnt, char *buf);
 void ext4fs_set_blk_dev(struct blk_desc *rbdd, disk_partition_t *info);
 long int read_allocated_block(struct ext2_inode *inode, int fileblock);
 int ext4fs_probe(struct blk_desc *fs_dev_desc,
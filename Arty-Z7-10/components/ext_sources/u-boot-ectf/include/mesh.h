@@ -8,7 +8,11 @@
 #define MAX_PIN_LENGTH 8
 #define MAX_GAME_LENGTH 31
 #define MAX_NUM_USERS 5
+// room for "name-vmajor.minor" with both versions as 32 bit numbers
+#define MESH_FULL_NAME_LENGTH (MAX_GAME_LENGTH + 24)
 
+// Location of the original (pre log) install table. It is only read to
+// migrate boards that were set up with it.
 #define MESH_SENTINEL_LOCATION 0x00000040
 #define MESH_SENTINEL_VALUE 0x12345678
 #define MESH_SENTINEL_LENGTH 4
@@ -20,10 +24,108 @@
 
 #define SHA256_DIGEST_LENGTH 64
 
-// To erase (or call update) on flash, it needs to be done
-// on boundaries of size 64K
+// Number of bytes read from the start of a game to parse its header. This is
+// enough for the version, name and users lines of any normal game; more is
+// read if they don't fit, up to MESH_GAME_HEADER_MAX.
+#define MESH_GAME_HEADER_READ 256
+#define MESH_GAME_HEADER_MAX 4096
+
+// Reserved DDR region (see system-user.dtsi) that games are loaded into for
+// the game loader. The first word holds the size of the game, the second
+// MESH_GAME_DECRYPTED when the game has already been decrypted and the third
+// how far into the region the game starts. That is MESH_GAME_OFFSET, or up to
+// a cache line more for a deduplicated game so its chunks land on cache lines.
+#define MESH_GAME_MEM_BASE 0x1fc00000
+#define MESH_GAME_MEM_SIZE 0x00400000
+#define MESH_GAME_OFFSET 0x40
+#define MESH_GAME_MAX_SIZE (MESH_GAME_MEM_SIZE - MESH_GAME_OFFSET)
+#define MESH_GAME_DECRYPTED 0x52434544 // "DECR"
+
+// Provisioning data written by provisionSystem.py as MES.data, which the FSBL
+// loads here from its own partition of MES.bin (see SystemImage.bif). It holds
+// everything that changes from one provisioning to the next, so u-boot and
+// image.ub don't have to be rebuilt for a new set of users. The blob is a
+// mesh_data_header, num_users mesh_user structs and num_default_games names
+// of MAX_STR_LEN bytes each. crc is the crc32 of everything after the header.
+// mesh_data_init copies it out and clears it from memory before anything else.
+#define MESH_DATA_ADDR 0x0ff00000
+#define MESH_DATA_MAX_SIZE 0x00100000
+#define MESH_DATA_MAGIC 0x5441444d // "MDAT"
+#define MESH_DATA_VERSION 1
+#define MESH_KEY_LENGTH 32
+#define MESH_NONCE_LENGTH 8
+
+struct mesh_data_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int size; // of the whole blob, header included
+    unsigned int crc;
+    unsigned int num_users;
+    unsigned int num_default_games;
+    char key[48];      // MESH_KEY_LENGTH characters, NUL padded
+    char nonce[16];    // MESH_NONCE_LENGTH characters, NUL padded
+};
+
+struct mesh_user {
+    char username[MAX_USERNAME_LENGTH + 1];
+    char pin[64 + 1];  // sha256 of the pin and salt in hex
+    char salt[16 + 1];
+};
+
+/*
+    The provisioning data, once mesh_data_init has checked it. users and
+    default_games point into data.
+*/
+struct mesh_data {
+    char *data;
+    char key[MESH_KEY_LENGTH + 1];
+    char nonce[MESH_NONCE_LENGTH + 1];
+    struct mesh_user *users;
+    unsigned int num_users;
+    char (*default_games)[MAX_STR_LEN];
+    unsigned int num_default_games;
+};
+
+// Number of bytes read from the SD card per step when a game is streamed into
+// memory. Each chunk is decrypted and hashed while it is still in the cache.
+#define MESH_STREAM_CHUNK 0x00040000
+
+// Ring of buffers mesh_hash_game streams a game through, so hashing a game
+// takes the same memory whatever its size. Reads run up to
+// MESH_HASH_RING_BUFFERS chunks ahead of the decrypt and hash, and carry on
+// in the background while they are decrypted and hashed. A compressed chunk
+// is read into the end of its buffer and decompressed in place, which needs
+// MESH_LZ4_MARGIN bytes past the end of the chunk: LZ4's (size / 256) + 32,
+// and a cache line for starting the read on one.
+#define MESH_HASH_RING_BUFFERS 4
+#define MESH_HASH_RING_CHUNK 0x00010000
+#define MESH_LZ4_MARGIN ((MESH_HASH_RING_CHUNK >> 8) + 32 + 64)
+#define MESH_HASH_RING_BUF_SIZE (MESH_HASH_RING_CHUNK + MESH_LZ4_MARGIN)
+
+struct mesh_hash_ring {
+    char *buf[MESH_HASH_RING_BUFFERS];     // cache aligned, MESH_HASH_RING_BUF_SIZE bytes each
+    loff_t length[MESH_HASH_RING_BUFFERS]; // bytes of the game in each buffer
+    loff_t stored_length[MESH_HASH_RING_BUFFERS]; // bytes read into each buffer
+    unsigned char iv[MESH_HASH_RING_BUFFERS][16]; // counter each buffer is decrypted from
+    struct ext4fs_read_req read[MESH_HASH_RING_BUFFERS]; // read of each buffer
+    unsigned int head;  // oldest buffer, the next one to hash
+    unsigned int count; // buffers read but not hashed yet
+};
+
+// Size of a flash block. The flash itself erases in 4K sub-sectors
+// (CONFIG_SPI_FLASH_USE_4K_SECTORS), but each install table sector is one block
 #define FLASH_PAGE_SIZE 65536
 
+// The install table is an append only log that lives in one of two flash
+// sectors. Each sector starts with a mesh_table_header; the active sector is
+// the one with a valid header and the highest generation. When the active
+// sector fills up, the live rows are compacted into the other one.
+#define MESH_TABLE_SECTOR_A 0x00000000
+#define MESH_TABLE_SECTOR_B 0x00010000
+#define MESH_TABLE_SECTOR_SIZE FLASH_PAGE_SIZE
+#define MESH_TABLE_MAGIC 0x4853454d // "MESH"
+#define MESH_TABLE_VERSION 1
+
 typedef struct {
     char name[MAX_USERNAME_LENGTH + 1];
     char pin[MAX_PIN_LENGTH + 1];
@@ -46,16 +148,173 @@ struct games_tbl_row {
     unsigned char hash[SHA256_DIGEST_LENGTH+1]; // sha256 is 32 bytes, one for '\0'
 };
 
+struct mesh_table_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int generation;
+    unsigned int row_size; // sizeof(struct games_tbl_row) when written
+};
+
+#define MESH_TABLE_MAX_ROWS ((MESH_TABLE_SECTOR_SIZE - sizeof(struct mesh_table_header)) / sizeof(struct games_tbl_row))
+
+// Number of hash buckets in the install table cache, and the number of rows
+// pulled from flash per read when the cache is loaded
+#define MESH_TABLE_CACHE_BUCKETS 64
+#define MESH_TABLE_CACHE_READ_ROWS 32
+#define MESH_TABLE_CACHE_NONE -1
+
+/*
+    RAM copy of the install table. rows[] is kept in the same order as the
+    rows in flash and slot[] holds where each one lives in the active sector.
+    Rows are also chained by (user name, game short name) through next[] so
+    that lookups only touch rows for the same user and game.
+*/
+struct mesh_table_cache {
+    struct games_tbl_row *rows;
+    unsigned int *slot;
+    int *next;
+    int head[MESH_TABLE_CACHE_BUCKETS];
+    int tail[MESH_TABLE_CACHE_BUCKETS];
+    unsigned int num_rows;
+    unsigned int capacity;
+    unsigned int sector;     // flash address of the active sector
+    unsigned int generation; // generation of the active sector
+    unsigned int num_slots;  // slots used in the active sector, torn ones too
+};
+
+// Game index written by provisionGames.py next to the games. It holds the
+// header, size and hash of every game so they can be looked up without
+// touching the games themselves, and the hash of each manifest so manifests
+// are authenticated along with it. The file is a mesh_index_header, num_games
+// mesh_index_entry structs and an HMAC-SHA256 (keyed with the game key) over
+// both.
+#define MESH_INDEX_FILE "mesh.index"
+#define MESH_INDEX_MAGIC 0x5844494d // "MIDX"
+#define MESH_INDEX_VERSION 2
+#define MESH_INDEX_MAC_LENGTH 32
+#define MESH_INDEX_BUCKETS 64
+
+struct mesh_index_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int num_games;
+    unsigned int entry_size;
+};
+
+struct mesh_index_entry {
+    char file_name[MAX_GAME_LENGTH + 1]; // name-vmajor.minor
+    char name[MAX_GAME_LENGTH + 1];
+    unsigned int major_version;
+    unsigned int minor_version;
+    unsigned int num_users;
+    char users[MAX_NUM_USERS][MAX_USERNAME_LENGTH + 1];
+    unsigned int size;        // size of the game once loaded
+    unsigned int header_size; // offset of the game binary in the file
+    char hash[SHA256_DIGEST_LENGTH]; // same as the game's .SHA256 file
+    unsigned char manifest_hash[32]; // sha256 of the game file if it is a manifest, else 0
+};
+
+/*
+    The loaded game index, with entries chained by file name through next[].
+    entries is NULL if there is no valid index on the games partition.
+*/
+struct mesh_game_index {
+    char *data;
+    loff_t size; // of data
+    struct mesh_index_entry *entries;
+    unsigned int num_games;
+    int *next;
+    int head[MESH_INDEX_BUCKETS];
+};
+
+// A game can be provisioned as a manifest instead of one encrypted file, so
+// versions of a game that share their binary share its chunks on the games
+// partition. The game file then holds a mesh_manifest_header, num_chunks
+// mesh_manifest_chunk structs and the game header, encrypted the same way as
+// the start of a plain game. Each chunk of the game binary is a file in
+// MESH_CHUNK_DIR named by its id in hex, and is encrypted from its own
+// counter. Every chunk but the last is chunk_size bytes once loaded. A chunk
+// whose stored_length is less than its length is an LZ4 frame (see
+// lib/lz4_wrapper.c), which is decompressed after it is decrypted.
+#define MESH_CHUNK_DIR "chunks"
+#define MESH_MANIFEST_MAGIC 0x4e414d4d // "MMAN"
+#define MESH_MANIFEST_VERSION 2
+#define MESH_MANIFEST_MAX_CHUNKS 4096
+
+struct mesh_manifest_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int size;        // size of the game once loaded
+    unsigned int header_size; // game header, stored after the chunks
+    unsigned int chunk_size;
+    unsigned int num_chunks;
+};
+
+struct mesh_manifest_chunk {
+    unsigned char id[16];
+    unsigned char iv[16];
+    unsigned int length;        // once loaded
+    unsigned int stored_length; // in the chunk file
+};
+
+/*
+    Where a game is on the games partition. manifest is NULL for a plain
+    game, which is one file encrypted from the start of the counter.
+*/
+struct mesh_game_layout {
+    char *manifest;
+    struct mesh_manifest_chunk *chunks;
+    unsigned int num_chunks;
+    loff_t chunk_size;
+    loff_t header_offset; // of the game header in the manifest
+    loff_t header_size;
+    loff_t size;
+};
+
+/*
+    A piece of a game that is read from one file and decrypted from one
+    counter, see mesh_game_piece.
+*/
+struct mesh_game_piece {
+    char *fname;
+    char chunk_name[sizeof(MESH_CHUNK_DIR) + 33];
+    loff_t file_offset;
+    loff_t offset; // in the game
+    loff_t length;
+    loff_t stored_length; // less than length if the piece is compressed
+    unsigned char iv[16];
+};
+
+// Partition holding the games, as passed to fs_set_blk_dev
+#define MESH_GAMES_IFNAME "mmc"
+#define MESH_GAMES_PART "0:2"
+
+/*
+    The games partition stays mounted for the life of the shell rather than
+    being mounted and closed around every file access. root is the
+    ext4fs_root the mount produced, so a mount or close by anything else
+    shows up as ext4fs_root changing. cid identifies the card that was
+    mounted, to notice it being swapped.
+*/
+struct mesh_ext4_session {
+    struct blk_desc *dev_desc;
+    disk_partition_t info;
+    struct ext2_data *root;
+    unsigned int cid[4];
+};
+
 /*
     Helper functions
 */
+int mesh_data_init(void);
+void mesh_data_wipe(void);
 int mesh_game_installed(char *game_name);
 int mesh_play_validate_args(char **args);
 int mesh_game_exists(char *game_name);
 int mesh_check_downgrade(char *game_name, unsigned int major_version, unsigned int minor_version);
 int mesh_check_user(Game *game);
 void mesh_get_game_header(Game *game, char *game_name);
-int mesh_install_validate_args(char **args);
+int mesh_install_validate_args(char **args, unsigned char gen_hash[32]);
 int mesh_execute(char **args);
 int mesh_is_first_table_write(void);
 int mesh_validate_user(User *user);
@@ -65,21 +324,33 @@ int mesh_get_argv(char **args);
 char **mesh_split_line(char *line) ;
 char* mesh_input(char* prompt);
 char* mesh_input_creds(char* prompt, int mode);
-int mesh_valid_install(char *game_name);
+int mesh_valid_install(char *game_name, unsigned char gen_hash[32]);
 void ptr_to_string(void* ptr, char* buf);
 void full_name_from_short_name(char* full_name, struct games_tbl_row* row);
-int mesh_read_hash(char *game_name, char outputBuffer[SHA256_DIGEST_LENGTH]);
+int mesh_read_hash(char *game_name, char outputBuffer[SHA256_DIGEST_LENGTH + 1]);
 int mesh_sha256_file(char *game_name, unsigned char outputBuffer[32]);
-int mesh_check_hash(char *game_name);
+int mesh_check_hash(char *game_name, unsigned char gen_hash[32]);
+int mesh_game_open(char *game_name, struct mesh_game_layout *layout);
+void mesh_game_close(struct mesh_game_layout *layout);
+loff_t mesh_decrypt_game_range(char *game_name, char *outputBuffer, loff_t offset, loff_t length);
+int mesh_decrypt_game(char *game_name, char *outputBuffer);
+loff_t mesh_stream_game(char *game_name, char *game_mem, loff_t *game_offset, unsigned char hash[32]);
+loff_t mesh_hash_game(char *game_name, unsigned char hash[32]);
 
 /*
     Ext 4 functions
 */
+int mesh_ext4_mount(void);
+void mesh_ext4_unmount(void);
 int mesh_ls_ext4(const char *dirname, char *filename);
 int mesh_ls_iterate_dir(struct ext2fs_node *dir, char *fname);
 int mesh_query_ext4(const char *dirname, char *filename);
 loff_t mesh_size_ext4(char *fname);
 loff_t mesh_read_ext4(char *fname, char*buf, loff_t size);
+loff_t mesh_read_ext4_offset(char *fname, char *buf, loff_t offset, loff_t size);
+int mesh_read_ext4_submit(char *fname, char *buf, loff_t offset, loff_t size,
+                          struct ext4fs_read_req *req);
+loff_t mesh_read_ext4_wait(struct ext4fs_read_req *req);
 
 /*
     Function Declarations for builtin shell commands:
@@ -95,6 +366,8 @@ int mesh_install(char **args);
 int mesh_uninstall(char **args);
 int mesh_dump_flash(char **args);
 int mesh_reset_flash(char **args);
+int mesh_flash_bench(char **args);
+int mesh_game_bench(char **args);
 int mesh_login(User *user) ;
 void mesh_loop(void);
 
@@ -102,8 +375,25 @@ void mesh_loop(void);
  * Mesh flash commands
  */
 int mesh_flash_init(void);
-int mesh_flash_write(void* data, unsigned int flash_location, unsigned int flash_length);
 int mesh_flash_read(void* data, unsigned int flash_location, unsigned int flash_length);
+int mesh_flash_program(void* data, unsigned int flash_location, unsigned int flash_length);
+int mesh_flash_erase(unsigned int flash_location, unsigned int flash_length);
 int mesh_is_first_table_write(void);
+int mesh_init_table(void);
+
+/*
+ * Install table cache
+ */
+int mesh_cache_load(void);
+int mesh_cache_find(char *user_name, char *game_name, int prev);
+int mesh_cache_append(struct games_tbl_row *row);
+int mesh_cache_set_flag(int index, char install_flag);
+
+/*
+ * Game index
+ */
+int mesh_index_load(void);
+struct mesh_index_entry *mesh_index_find(char *game_name);
+loff_t mesh_game_size(char *game_name);
 
 #endif
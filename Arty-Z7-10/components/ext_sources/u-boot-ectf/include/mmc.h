@@ -421,6 +421,32 @@ struct dm_mmc_ops {
 	* @return 0 on success otherwise error value
 	*/
 	int (*execute_tuning)(struct udevice *dev, u8 opcode);
+
+	/**
+	 * send_cmd_start() - Send a data command without waiting for the data
+	 *
+	 * Like send_cmd() but returns as soon as the card has answered the
+	 * command, leaving the transfer to run in the background until
+	 * data_poll() reports that it is done. @data must stay valid until
+	 * then and no other command may be sent meanwhile.
+	 *
+	 * @dev:	Device to receive the command
+	 * @cmd:	Command to send
+	 * @data:	Data to receive
+	 * @return 0 if the transfer was started, -EOPNOTSUPP if it has to
+	 * go through send_cmd() instead, other -ve on error
+	 */
+	int (*send_cmd_start)(struct udevice *dev, struct mmc_cmd *cmd,
+			      struct mmc_data *data);
+
+	/**
+	 * data_poll() - Check on the transfer started by send_cmd_start()
+	 *
+	 * @dev:	Device the transfer was started on
+	 * @return 0 once the transfer is complete, -EINPROGRESS while it is
+	 * still running, other -ve on error
+	 */
+	int (*data_poll)(struct udevice *dev);
 };
 
 #define mmc_get_ops(dev)        ((struct dm_mmc_ops *)(dev)->driver->ops)
@@ -433,6 +459,9 @@ int dm_mmc_get_wp(struct udevice *dev);
 int dm_mmc_set_voltage(struct udevice *dev);
 int dm_mmc_set_uhs(struct udevice *dev);
 int dm_mmc_execute_tuning(struct udevice *dev);
+int dm_mmc_send_cmd_start(struct udevice *dev, struct mmc_cmd *cmd,
+			  struct mmc_data *data);
+int dm_mmc_data_poll(struct udevice *dev);
 
 /* Transition functions for compatibility */
 int mmc_set_ios(struct mmc *mmc);
@@ -441,6 +470,9 @@ int mmc_getwp(struct mmc *mmc);
 int mmc_set_voltage(struct mmc *mmc);
 int mmc_switch_uhs(struct mmc *mmc);
 int mmc_execute_tuning(struct mmc *mmc);
+int mmc_send_cmd_start(struct mmc *mmc, struct mmc_cmd *cmd,
+		       struct mmc_data *data);
+int mmc_data_poll(struct mmc *mmc);
 #else
 struct mmc_ops {
 	int (*send_cmd)(struct mmc *mmc,
@@ -529,6 +561,7 @@ struct mmc {
 	u8 is_uhs;
 	u8 uhsmode;
 	u8 forcehs;
+	struct mmc_data async_data;	/* read started by mmc_bread_start() */
 };
 
 struct mmc_hwpart_conf {
@@ -13,6 +13,12 @@ struct host_block_dev {
 #endif
 	char *filename;
 	int fd;
+#ifdef CONFIG_BLK
+	/* read noted by read_start(), done by read_poll() */
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+#endif
 };
 
 int host_dev_bind(int dev, char *filename);
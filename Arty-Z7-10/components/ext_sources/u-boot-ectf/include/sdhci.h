@@ -197,6 +197,27 @@
 
 #define SDHCI_ADMA_ADDRESS	0x58
 
+/*
+ * 32-bit ADMA2 descriptor. A length of 0 means 64 KiB, so one descriptor
+ * moves at most SDHCI_ADMA_MAX_LEN bytes.
+ */
+struct sdhci_adma_desc {
+	u16 attr;
+	u16 len;
+	u32 addr;
+} __packed;
+
+#define  SDHCI_ADMA_VALID	0x0001
+#define  SDHCI_ADMA_END		0x0002
+#define  SDHCI_ADMA_INT		0x0004
+#define  SDHCI_ADMA_ACT_NOP	0x0000
+#define  SDHCI_ADMA_ACT_TRAN	0x0020
+#define  SDHCI_ADMA_ACT_LINK	0x0030
+
+#define SDHCI_ADMA_MAX_LEN	(64 * 1024)
+#define SDHCI_ADMA_DESC_COUNT	\
+	DIV_ROUND_UP(CONFIG_SYS_MMC_MAX_BLK_COUNT * 512, SDHCI_ADMA_MAX_LEN)
+
 /* 60-FB reserved */
 
 #define SDHCI_SLOT_INT_STATUS	0xFC
@@ -277,6 +298,11 @@ struct sdhci_host {
 
 	struct mmc_config cfg;
 	unsigned int last_cmd;
+#ifdef CONFIG_MMC_SDHCI_ADMA
+	struct sdhci_adma_desc *adma_desc;	/* NULL if ADMA2 is unusable */
+	struct mmc_data *adma_data;	/* transfer left running by send_cmd_start */
+	ulong adma_start;		/* get_timer() when it was started */
+#endif
 };
 
 #ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
@@ -18,6 +18,10 @@ typedef struct {
 void sha256_starts(sha256_context * ctx);
 void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length);
 void sha256_finish(sha256_context * ctx, uint8_t digest[SHA256_SUM_LEN]);
+#ifdef CONFIG_SHA256_NEON
+void sha256_update_scalar(sha256_context *ctx, const uint8_t *input,
+			  uint32_t length);
+#endif
 
 void sha256_csum_wd(const unsigned char *input, unsigned int ilen,
 		unsigned char *output, unsigned int chunk_sz);
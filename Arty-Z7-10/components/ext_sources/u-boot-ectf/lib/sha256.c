@@ -187,7 +187,113 @@ static void sha256_process(sha256_context *ctx, const uint8_t data[64])
 	ctx->state[7] += H;
 }
 
-void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length)
+#ifdef CONFIG_SHA256_NEON
+/*
+ * 128-bit vector of four message schedule words. GCC turns the vector
+ * operations into NEON instructions on ARM (SSE on sandbox).
+ */
+typedef uint32_t sha256_vec __attribute__ ((vector_size (16)));
+
+static const sha256_vec sha256_k[16] = {
+	{ 0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5 },
+	{ 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5 },
+	{ 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3 },
+	{ 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174 },
+	{ 0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC },
+	{ 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA },
+	{ 0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7 },
+	{ 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967 },
+	{ 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13 },
+	{ 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85 },
+	{ 0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3 },
+	{ 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070 },
+	{ 0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5 },
+	{ 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3 },
+	{ 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208 },
+	{ 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2 },
+};
+
+#define VSHR(x,n) ((x) >> n)
+#define VROTR(x,n) (VSHR(x,n) | ((x) << (32 - n)))
+
+#define VS0(x) (VROTR(x, 7) ^ VROTR(x,18) ^ VSHR(x, 3))
+#define VS1(x) (VROTR(x,17) ^ VROTR(x,19) ^ VSHR(x,10))
+
+/*
+ * Same as sha256_process(), but the message schedule is computed four words
+ * at a time in vector registers and the round constants are added to it in
+ * the same pass, so each round only adds one precomputed word.
+ */
+static void sha256_process_neon(sha256_context *ctx, const uint8_t data[64])
+{
+	union {
+		uint32_t w[64];
+		sha256_vec v[16];
+	} W, WK;
+	/* shuffle masks: index 0-3 is the first vector, 4-7 the second */
+	const sha256_vec next1 = { 1, 2, 3, 4 };
+	const sha256_vec high2 = { 2, 3, 4, 4 };
+	const sha256_vec low2 = { 0, 0, 4, 5 };
+	const sha256_vec zero = { 0, 0, 0, 0 };
+	sha256_vec x;
+	uint32_t temp1, temp2;
+	uint32_t A, B, C, D, E, F, G, H;
+	int t;
+
+	for (t = 0; t < 16; t++)
+		GET_UINT32_BE(W.w[t], data, t * 4);
+
+	for (t = 0; t < 4; t++)
+		WK.v[t] = W.v[t] + sha256_k[t];
+
+	/* W[i..i+3] from the four vectors before it, see R() above */
+	for (t = 4; t < 16; t++) {
+		x = W.v[t - 4] +
+		    VS0(__builtin_shuffle(W.v[t - 4], W.v[t - 3], next1)) +
+		    __builtin_shuffle(W.v[t - 2], W.v[t - 1], next1);
+		/* W[i] and W[i+1] use W[i-2] and W[i-1] */
+		x += VS1(__builtin_shuffle(W.v[t - 1], zero, high2));
+		/* W[i+2] and W[i+3] use W[i] and W[i+1], computed just above */
+		x += VS1(__builtin_shuffle(zero, x, low2));
+
+		W.v[t] = x;
+		WK.v[t] = x + sha256_k[t];
+	}
+
+	A = ctx->state[0];
+	B = ctx->state[1];
+	C = ctx->state[2];
+	D = ctx->state[3];
+	E = ctx->state[4];
+	F = ctx->state[5];
+	G = ctx->state[6];
+	H = ctx->state[7];
+
+	for (t = 0; t < 64; t += 8) {
+		P(A, B, C, D, E, F, G, H, WK.w[t + 0], 0);
+		P(H, A, B, C, D, E, F, G, WK.w[t + 1], 0);
+		P(G, H, A, B, C, D, E, F, WK.w[t + 2], 0);
+		P(F, G, H, A, B, C, D, E, WK.w[t + 3], 0);
+		P(E, F, G, H, A, B, C, D, WK.w[t + 4], 0);
+		P(D, E, F, G, H, A, B, C, WK.w[t + 5], 0);
+		P(C, D, E, F, G, H, A, B, WK.w[t + 6], 0);
+		P(B, C, D, E, F, G, H, A, WK.w[t + 7], 0);
+	}
+
+	ctx->state[0] += A;
+	ctx->state[1] += B;
+	ctx->state[2] += C;
+	ctx->state[3] += D;
+	ctx->state[4] += E;
+	ctx->state[5] += F;
+	ctx->state[6] += G;
+	ctx->state[7] += H;
+}
+#endif
+
+static void __sha256_update(sha256_context *ctx, const uint8_t *input,
+			    uint32_t length,
+			    void (*process)(sha256_context *, const uint8_t *))
 {
 	uint32_t left, fill;
 
@@ -205,14 +311,14 @@ void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length)
 
 	if (left && length >= fill) {
 		memcpy((void *) (ctx->buffer + left), (void *) input, fill);
-		sha256_process(ctx, ctx->buffer);
+		process(ctx, ctx->buffer);
 		length -= fill;
 		input += fill;
 		left = 0;
 	}
 
 	while (length >= 64) {
-		sha256_process(ctx, input);
+		process(ctx, input);
 		length -= 64;
 		input += 64;
 	}
@@ -221,6 +327,24 @@ void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length)
 		memcpy((void *) (ctx->buffer + left), (void *) input, length);
 }
 
+void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length)
+{
+#ifdef CONFIG_SHA256_NEON
+	__sha256_update(ctx, input, length, sha256_process_neon);
+#else
+	__sha256_update(ctx, input, length, sha256_process);
+#endif
+}
+
+#ifdef CONFIG_SHA256_NEON
+/* sha256_update() with the scalar code, to check the NEON code against */
+void sha256_update_scalar(sha256_context *ctx, const uint8_t *input,
+			  uint32_t length)
+{
+	__sha256_update(ctx, input, length, sha256_process);
+}
+#endif
+
 static uint8_t sha256_padding[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
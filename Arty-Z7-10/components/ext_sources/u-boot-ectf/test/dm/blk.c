@@ -5,9 +5,11 @@
  */
 
 #include <common.h>
+#include <blk.h>
 #include <dm.h>
 #include <usb.h>
 #include <asm/state.h>
+#include <dm/device-internal.h>
 #include <dm/test.h>
 #include <test/ut.h>
 
@@ -94,3 +96,271 @@ static int dm_test_blk_usb(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_usb, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* RAM disk behind the block devices that test the read queue */
+#define TEST_BLKSZ		512
+#define TEST_BLKS		64
+#define TEST_DEVNUM		9
+/* Most blocks blk_test_async transfers at once */
+#define TEST_MAX_XFER		4
+/* Polls a transfer of blk_test_async takes to complete */
+#define TEST_XFER_POLLS		3
+#define TEST_LOG_SIZE		16
+
+/*
+ * State of the test block drivers. Only one of their devices exists at a
+ * time, so it is kept here where the tests can look at it.
+ */
+static struct {
+	u8 disk[TEST_BLKS * TEST_BLKSZ];
+	lbaint_t start;		/* transfer in flight */
+	lbaint_t blkcnt;
+	void *buffer;
+	int polls;		/* polls left until it completes */
+	lbaint_t log[TEST_LOG_SIZE];	/* first block of each device access */
+	int count;
+} blk_test;
+
+static void blk_test_log(lbaint_t start)
+{
+	if (blk_test.count < TEST_LOG_SIZE)
+		blk_test.log[blk_test.count] = start;
+	blk_test.count++;
+}
+
+static unsigned long blk_test_read(struct udevice *dev, lbaint_t start,
+				   lbaint_t blkcnt, void *buffer)
+{
+	blk_test_log(start);
+	memcpy(buffer, blk_test.disk + start * TEST_BLKSZ, blkcnt * TEST_BLKSZ);
+
+	return blkcnt;
+}
+
+static long blk_test_read_start(struct udevice *dev, lbaint_t start,
+				lbaint_t blkcnt, void *buffer)
+{
+	/* Like a DMA engine that can only transfer whole words */
+	if ((ulong)buffer & 3)
+		return -EOPNOTSUPP;
+
+	blk_test_log(start);
+	blk_test.start = start;
+	blk_test.blkcnt = min_t(lbaint_t, blkcnt, TEST_MAX_XFER);
+	blk_test.buffer = buffer;
+	blk_test.polls = TEST_XFER_POLLS;
+
+	return blk_test.blkcnt;
+}
+
+static int blk_test_read_poll(struct udevice *dev)
+{
+	if (--blk_test.polls)
+		return -EINPROGRESS;
+	memcpy(blk_test.buffer, blk_test.disk + blk_test.start * TEST_BLKSZ,
+	       blk_test.blkcnt * TEST_BLKSZ);
+
+	return 0;
+}
+
+static const struct blk_ops blk_test_async_ops = {
+	.read		= blk_test_read,
+	.read_start	= blk_test_read_start,
+	.read_poll	= blk_test_read_poll,
+};
+
+U_BOOT_DRIVER(blk_test_async) = {
+	.name	= "blk_test_async",
+	.id	= UCLASS_BLK,
+	.ops	= &blk_test_async_ops,
+};
+
+static const struct blk_ops blk_test_sync_ops = {
+	.read	= blk_test_read,
+};
+
+U_BOOT_DRIVER(blk_test_sync) = {
+	.name	= "blk_test_sync",
+	.id	= UCLASS_BLK,
+	.ops	= &blk_test_sync_ops,
+};
+
+/* Create a test block device over a freshly filled RAM disk */
+static int blk_test_setup(struct unit_test_state *uts, const char *drv_name,
+			  struct blk_desc **descp)
+{
+	struct udevice *dev;
+	int i;
+
+	for (i = 0; i < sizeof(blk_test.disk); i++)
+		blk_test.disk[i] = i / TEST_BLKSZ * 7 + i;
+	blk_test.polls = 0;
+	blk_test.count = 0;
+	blkcache_invalidate(IF_TYPE_HOST, TEST_DEVNUM);
+
+	ut_assertok(blk_create_device(gd->dm_root, drv_name, "test",
+				      IF_TYPE_HOST, TEST_DEVNUM, TEST_BLKSZ,
+				      sizeof(blk_test.disk), &dev));
+	ut_assertok(device_probe(dev));
+	*descp = dev_get_uclass_platdata(dev);
+
+	return 0;
+}
+
+/* Check that buf holds blkcnt blocks of the RAM disk from start */
+static int blk_test_check(struct unit_test_state *uts, const void *buf,
+			  lbaint_t start, lbaint_t blkcnt)
+{
+	ut_assertok(memcmp(buf, blk_test.disk + start * TEST_BLKSZ,
+			   blkcnt * TEST_BLKSZ));
+
+	return 0;
+}
+
+/* Test that a read can be submitted and waited for */
+static int dm_test_blk_submit(struct unit_test_state *uts)
+{
+	u32 buf[10 * TEST_BLKSZ / 4 + 1];
+	struct blk_desc *desc;
+	struct blk_req req;
+
+	ut_assertok(blk_test_setup(uts, "blk_test_async", &desc));
+
+	/* The first transfer is started and left running */
+	blk_dread_submit(desc, &req, 5, 10, buf);
+	ut_asserteq(-EINPROGRESS, req.status);
+	ut_asserteq(1, blk_test.count);
+	ut_asserteq(-EINPROGRESS, blk_req_poll(&req));
+	ut_asserteq(0, req.done);
+
+	/* It takes three transfers of at most TEST_MAX_XFER blocks */
+	ut_assertok(blk_req_wait(&req));
+	ut_asserteq(10, req.done);
+	ut_asserteq(3, blk_test.count);
+	ut_asserteq(5, blk_test.log[0]);
+	ut_asserteq(9, blk_test.log[1]);
+	ut_asserteq(13, blk_test.log[2]);
+	ut_assertok(blk_test_check(uts, buf, 5, 10));
+	ut_assertok(blk_req_poll(&req));
+
+	/* A buffer the driver can't transfer into is read there and then */
+	blk_test.count = 0;
+	blk_dread_submit(desc, &req, 20, 10, (u8 *)buf + 1);
+	ut_assertok(req.status);
+	ut_asserteq(10, req.done);
+	ut_asserteq(1, blk_test.count);
+	ut_assertok(blk_test_check(uts, (u8 *)buf + 1, 20, 10));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that queued reads are done in the order they were submitted */
+static int dm_test_blk_submit_queue(struct unit_test_state *uts)
+{
+	u32 buf[3][2 * TEST_BLKSZ / 4];
+	struct blk_desc *desc;
+	struct blk_req req[3];
+
+	ut_assertok(blk_test_setup(uts, "blk_test_async", &desc));
+
+	blk_dread_submit(desc, &req[0], 20, 2, buf[0]);
+	blk_dread_submit(desc, &req[1], 2, 2, buf[1]);
+	blk_dread_submit(desc, &req[2], 40, 2, buf[2]);
+
+	/* Only the first is on the device, the others wait behind it */
+	ut_asserteq(1, blk_test.count);
+	ut_asserteq(-EINPROGRESS, req[0].status);
+	ut_asserteq(-EINPROGRESS, req[1].status);
+	ut_asserteq(-EINPROGRESS, req[2].status);
+
+	/* Waiting for the last one runs the whole queue in order */
+	ut_assertok(blk_req_wait(&req[2]));
+	ut_assertok(req[0].status);
+	ut_assertok(req[1].status);
+	ut_asserteq(3, blk_test.count);
+	ut_asserteq(20, blk_test.log[0]);
+	ut_asserteq(2, blk_test.log[1]);
+	ut_asserteq(40, blk_test.log[2]);
+	ut_assertok(blk_test_check(uts, buf[0], 20, 2));
+	ut_assertok(blk_test_check(uts, buf[1], 2, 2));
+	ut_assertok(blk_test_check(uts, buf[2], 40, 2));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_queue, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that a synchronous read waits for the queued ones */
+static int dm_test_blk_submit_drain(struct unit_test_state *uts)
+{
+	u32 buf[3][6 * TEST_BLKSZ / 4];
+	struct blk_desc *desc;
+	struct blk_req req[2];
+
+	ut_assertok(blk_test_setup(uts, "blk_test_async", &desc));
+
+	blk_dread_submit(desc, &req[0], 8, 6, buf[0]);
+	blk_dread_submit(desc, &req[1], 30, 1, buf[1]);
+	ut_asserteq(1, blk_test.count);
+
+	ut_asserteq(3, blk_dread(desc, 50, 3, buf[2]));
+	ut_assertok(req[0].status);
+	ut_assertok(req[1].status);
+	ut_asserteq(4, blk_test.count);
+	ut_asserteq(8, blk_test.log[0]);
+	ut_asserteq(12, blk_test.log[1]);
+	ut_asserteq(30, blk_test.log[2]);
+	ut_asserteq(50, blk_test.log[3]);
+	ut_assertok(blk_test_check(uts, buf[0], 8, 6));
+	ut_assertok(blk_test_check(uts, buf[1], 30, 1));
+	ut_assertok(blk_test_check(uts, buf[2], 50, 3));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_drain, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+#ifdef CONFIG_BLOCK_CACHE
+/* Test that a read the block cache holds completes when it is submitted */
+static int dm_test_blk_submit_cached(struct unit_test_state *uts)
+{
+	u32 buf[2 * TEST_BLKSZ / 4];
+	struct blk_desc *desc;
+	struct blk_req req;
+
+	ut_assertok(blk_test_setup(uts, "blk_test_async", &desc));
+
+	ut_asserteq(2, blk_dread(desc, 10, 2, buf));
+	ut_asserteq(1, blk_test.count);
+
+	memset(buf, '\0', sizeof(buf));
+	blk_dread_submit(desc, &req, 10, 2, buf);
+	ut_assertok(req.status);
+	ut_asserteq(2, req.done);
+	ut_asserteq(1, blk_test.count);
+	ut_assertok(blk_test_check(uts, buf, 10, 2));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_cached, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+#endif
+
+/* Test that a driver without read_start() reads submitted requests at once */
+static int dm_test_blk_submit_sync(struct unit_test_state *uts)
+{
+	u32 buf[10 * TEST_BLKSZ / 4];
+	struct blk_desc *desc;
+	struct blk_req req;
+
+	ut_assertok(blk_test_setup(uts, "blk_test_sync", &desc));
+
+	blk_dread_submit(desc, &req, 3, 10, buf);
+	ut_assertok(req.status);
+	ut_asserteq(10, req.done);
+	ut_asserteq(1, blk_test.count);
+	ut_asserteq(3, blk_test.log[0]);
+	ut_assertok(blk_test_check(uts, buf, 3, 10));
+	ut_assertok(blk_req_wait(&req));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_sync, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
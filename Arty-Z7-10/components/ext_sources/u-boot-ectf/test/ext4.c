@@ -0,0 +1,69 @@
+/*
+ * Test command for ext4fs_read_submit() in fs/ext4/ext4fs.c
+ *
+ * SPDX-License-Identifier:	GPL-2.0+
+ */
+
+#include <common.h>
+#include <command.h>
+#include <ext4fs.h>
+#include <fs.h>
+#include <mapmem.h>
+
+/*
+ * Load a file in chunks with ext4fs_read_submit(), submitting each chunk
+ * before waiting for the one before it like mesh_stream_game() does, so the
+ * reads of neighbouring chunks are on the device queue together.
+ * test/fs/ext4-extent-bench.sh compares what it loads with the file.
+ */
+static int do_ut_ext4_submit(cmd_tbl_t *cmdtp, int flag, int argc,
+			     char *const argv[])
+{
+	struct ext4fs_read_req req[2];
+	loff_t size, chunk, offset, actread, total = 0;
+	int ret = CMD_RET_SUCCESS;
+	int i = 0;
+	char *buf;
+
+	if (argc != 6)
+		return CMD_RET_USAGE;
+
+	chunk = simple_strtoul(argv[5], NULL, 16);
+	if (!chunk)
+		return CMD_RET_USAGE;
+
+	if (fs_set_blk_dev(argv[1], argv[2], FS_TYPE_EXT))
+		return CMD_RET_FAILURE;
+
+	if (ext4fs_open(argv[4], &size) < 0) {
+		printf("** File not found %s **\n", argv[4]);
+		ext4fs_close();
+		return CMD_RET_FAILURE;
+	}
+
+	buf = map_sysmem(simple_strtoul(argv[3], NULL, 16), size);
+	for (offset = 0; offset < size + chunk; offset += chunk) {
+		if (offset < size &&
+		    ext4fs_read_submit(&req[i], buf + offset, offset, chunk))
+			ret = CMD_RET_FAILURE;
+		if (offset) {
+			if (ext4fs_read_wait(&req[!i], &actread))
+				ret = CMD_RET_FAILURE;
+			total += actread;
+		}
+		i = !i;
+	}
+	unmap_sysmem(buf);
+	ext4fs_close();
+
+	printf("%llu bytes read in chunks of %llu\n", total, chunk);
+	setenv_hex("filesize", total);
+
+	return ret;
+}
+
+U_BOOT_CMD(
+	ut_ext4_submit,	6,	0,	do_ut_ext4_submit,
+	"Load a file in chunks with ext4fs_read_submit()",
+	"<interface> <dev[:part]> <addr> <filename> <chunk size>"
+);
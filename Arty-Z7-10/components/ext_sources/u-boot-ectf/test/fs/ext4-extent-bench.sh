@@ -0,0 +1,142 @@
+#!/bin/bash
+
+# SPDX-License-Identifier:	GPL-2.0+
+
+# This script times U-Boot's ext4 code reading a badly fragmented file.
+#
+# read_allocated_block used to walk a file's extent tree, with a block sized
+# malloc, for every block of the file. It now resolves the extent list once
+# and looks blocks up in it, which matters most for files with many extents.
+# This script builds an ext4 image holding such a file, the same way
+# fat-noncontig-test.sh does for FAT, and has U-Boot sandbox load it several
+# times and check its CRC. Run it from the U-Boot source root directory:
+#
+#    cd u-boot
+#    ./test/fs/ext4-extent-bench.sh [loads]
+#
+# The interesting lines are the "bytes read in ... ms" ones, the number of
+# device reads each load took (ext4load leaves it in $ext4devreads) and the
+# final PASS or FAILURE. Running it on a tree without the extent map gives the
+# numbers to compare against.
+#
+# The loaded file is also saved back to the host and compared byte for byte
+# with what debugfs reads, along with a few partial loads that start inside a
+# block and cross extent boundaries, so a block looked up in the wrong extent
+# shows up as a FAILURE even where the CRC alone would not say where.
+#
+# Last, ut_ext4_submit loads the file again through ext4fs_read_submit(),
+# the path mesh_stream_game() uses, in chunks whose reads overlap on the
+# device queue, and each of those loads is compared byte for byte as well.
+#
+# The image is made with debugfs so no root access is needed. All temporary
+# files are created in ./sandbox, like test/fs/fs-test.sh.
+
+odir=sandbox
+img=${odir}/ext4-extent.img
+fill=/dev/urandom
+testfn=fragmented.bin
+tmpdir=${odir}/ext4-extent
+crcaddr=0
+loadaddr=1000
+loads=${1:-5}
+# partial loads as "offset length" in hex, like ext4load takes them. They
+# start inside a block, cross the first extent boundary and the first leaf
+# boundary of the extent tree, and end at the end of the file
+parts="0 1 1ff 1001 ffe 4 51bff 23456 7cfc01 3ff"
+# chunk sizes in hex for ut_ext4_submit: the whole file, whole blocks, and
+# sizes that start chunks inside a sector and inside an extent
+chunks="7d0000 1000 1ff 23456"
+
+for prereq in mkfs.ext4 debugfs dd crc32 cmp; do
+    if [ ! -x "`which $prereq`" ]; then
+        echo "Missing $prereq binary. Exiting!"
+        exit 1
+    fi
+done
+
+make O=${odir} -s sandbox_defconfig && make O=${odir} -s -j8
+
+mkdir -p ${tmpdir}
+if [ ! -f ${img} ]; then
+    dd if=/dev/zero of=${img} bs=1024 count=$((64 * 1024)) >/dev/null 2>&1
+    mkfs.ext4 -q -F -b 1024 ${img}
+    if [ $? -ne 0 ]; then
+        echo Could not create ext4 filesystem
+        exit $?
+    fi
+
+    # Fill the filesystem with small files and delete every other one, so
+    # the test file has to be spread over the holes one extent at a time.
+    dd if=${fill} of=${tmpdir}/small bs=1024 count=4 >/dev/null 2>&1
+    rm -f ${tmpdir}/cmds
+    for ((i = 0; i < 4096; i++)); do
+        echo "write ${tmpdir}/small fill-${i}" >> ${tmpdir}/cmds
+    done
+    for ((i = 0; i < 4096; i += 2)); do
+        echo "rm fill-${i}" >> ${tmpdir}/cmds
+    done
+    dd if=${fill} of=${tmpdir}/${testfn} bs=1024 count=8000 >/dev/null 2>&1
+    echo "write ${tmpdir}/${testfn} ${testfn}" >> ${tmpdir}/cmds
+
+    debugfs -w -f ${tmpdir}/cmds ${img} >/dev/null 2>&1
+    if [ $? -ne 0 ]; then
+        echo Could not populate test filesystem
+        exit $?
+    fi
+    debugfs -R "ex ${testfn}" ${img} 2>/dev/null | tail -n 1
+fi
+
+rm -f ${tmpdir}/${testfn} ${tmpdir}/loaded.bin ${tmpdir}/part-*.bin \
+    ${tmpdir}/submit-*.bin
+debugfs -R "dump ${testfn} ${tmpdir}/${testfn}" ${img} >/dev/null 2>&1
+crc=0x`crc32 ${tmpdir}/${testfn}`
+
+crc=`printf %02x%02x%02x%02x \
+    $((${crc} & 0xff)) \
+    $(((${crc} >> 8) & 0xff)) \
+    $(((${crc} >> 16) & 0xff)) \
+    $((${crc} >> 24))`
+
+(
+    echo "host bind 0 ${img}"
+    for ((i = 0; i < loads; i++)); do
+        echo "ext4load host 0 ${loadaddr} ${testfn}"
+    done
+    echo "echo device reads per load: \${ext4devreads}"
+    echo "crc32 ${loadaddr} \$filesize ${crcaddr}"
+    echo "if itest.l *${crcaddr} != ${crc}; then echo FAILURE; else echo PASS; fi"
+    echo "save hostfs - ${loadaddr} ${tmpdir}/loaded.bin \$filesize"
+    set -- ${parts}
+    while [ $# -gt 0 ]; do
+        echo "ext4load host 0 ${loadaddr} ${testfn} $2 $1"
+        echo "save hostfs - ${loadaddr} ${tmpdir}/part-$1.bin $2"
+        shift 2
+    done
+    for chunk in ${chunks}; do
+        echo "ut_ext4_submit host 0 ${loadaddr} ${testfn} ${chunk}"
+        echo "save hostfs - ${loadaddr} ${tmpdir}/submit-${chunk}.bin" \
+            "\$filesize"
+    done
+    echo "reset"
+) | ./sandbox/u-boot
+if [ $? -ne 0 ]; then
+    echo U-Boot exit status indicates an error
+    exit $?
+fi
+
+result=PASS
+cmp ${tmpdir}/${testfn} ${tmpdir}/loaded.bin || result=FAILURE
+set -- ${parts}
+while [ $# -gt 0 ]; do
+    dd if=${tmpdir}/${testfn} of=${tmpdir}/expect-$1.bin bs=1 \
+        skip=$((0x$1)) count=$((0x$2)) >/dev/null 2>&1
+    cmp ${tmpdir}/expect-$1.bin ${tmpdir}/part-$1.bin || result=FAILURE
+    shift 2
+done
+for chunk in ${chunks}; do
+    cmp ${tmpdir}/${testfn} ${tmpdir}/submit-${chunk}.bin || result=FAILURE
+done
+echo "Byte for byte compare: ${result}"
+if [ ${result} != PASS ]; then
+    exit 1
+fi
@@ -0,0 +1,113 @@
+# SPDX-License-Identifier: GPL-2.0
+
+# Test that the block cache keeps filesystem metadata apart from file data.
+# The ext4 image holds a directory of small files and a file written into
+# the 4 KiB holes left by deleting every other one of them. Each extent of
+# that file is read in one go, which is more than a data pool entry holds,
+# so loading it must count its reads as bypassed and must leave the inode,
+# dir and index pools alone.
+
+import os
+import pytest
+import re
+import u_boot_utils
+
+# 4 KiB holes the large file is written into, so it has at least this many
+# extents and a two level extent tree
+holes = 32
+
+def blkcache_show(u_boot_console):
+    """Run 'blkcache show', which also resets the hit, miss and bypass
+    counters, and return the statistics of each pool as a dictionary."""
+
+    keys = ('hits', 'misses', 'bypassed', 'entries', 'max_entries', 'blocks')
+    response = u_boot_console.run_command('blkcache show')
+    pools = {}
+    for line in response.splitlines():
+        m = re.match(r'(\w+)\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)/(\d+)\s+(\d+)$',
+                     line.strip())
+        if m:
+            pools[m.group(1)] = dict(zip(keys, map(int, m.groups()[1:])))
+    assert(sorted(pools.keys()) == ['data', 'dir', 'index', 'inode'])
+    return pools
+
+def make_image(u_boot_console):
+    """Build the ext4 image with debugfs, so no root access is needed."""
+
+    path = u_boot_console.config.persistent_data_dir
+    image = os.path.join(path, 'blkcache.img')
+    small = os.path.join(path, 'blkcache-small.bin')
+    large = os.path.join(path, 'blkcache-large.bin')
+    cmds = os.path.join(path, 'blkcache.cmds')
+
+    with open(image, 'wb') as fh:
+        fh.truncate(4 * 1024 * 1024)
+    with open(small, 'wb') as fh:
+        fh.write(os.urandom(4096))
+    with open(large, 'wb') as fh:
+        fh.write(os.urandom(256 * 1024))
+    with open(cmds, 'w') as fh:
+        fh.write('mkdir dir\n')
+        for i in range(2 * holes):
+            fh.write('write %s dir/f%d\n' % (small, i))
+        for i in range(0, 2 * holes, 2):
+            fh.write('rm dir/f%d\n' % i)
+        fh.write('write %s large.bin\n' % large)
+
+    u_boot_utils.run_and_log(u_boot_console,
+                             'mkfs.ext4 -q -F -b 1024 %s' % image)
+    u_boot_utils.run_and_log(u_boot_console,
+                             ['debugfs', '-w', '-f', cmds, image])
+    return image
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_block_cache')
+@pytest.mark.buildconfigspec('cmd_ext4')
+def test_blkcache_pools(u_boot_console):
+    """Test that large data reads bypass the cache without evicting the
+    metadata pools, and that 'blkcache configure' resizes only the pool it
+    is given."""
+
+    cons = u_boot_console
+    image = make_image(cons)
+    addr = u_boot_utils.find_ram_base(cons) + 0x100000
+    load = 'ext4load host 0 %x large.bin' % addr
+
+    cons.run_command('host bind 0 %s' % image)
+    blkcache_show(cons)
+
+    # The first pass fills the metadata pools
+    cons.run_command('ext4ls host 0 /dir')
+    response = cons.run_command(load)
+    assert('262144 bytes read' in response)
+    first = blkcache_show(cons)
+    assert(first['data']['bypassed'] >= holes)
+    for pool in ('inode', 'dir', 'index'):
+        assert(first[pool]['entries'] > 0)
+
+    # Loading the file again reads its data from the device and finds all
+    # the metadata still in the cache
+    for i in range(3):
+        cons.run_command(load)
+    cons.run_command('ext4ls host 0 /dir')
+    again = blkcache_show(cons)
+    assert(again['data']['bypassed'] >= 3 * holes)
+    for pool in ('inode', 'dir', 'index'):
+        assert(again[pool]['hits'] > 0)
+        assert(again[pool]['misses'] == 0)
+        assert(again[pool]['entries'] == first[pool]['entries'])
+
+    # Resizing the dir pool empties it and leaves the others as they were
+    response = cons.run_command('blkcache configure 4 16 dir')
+    assert('changed dir pool to max of 16 entries of 4 blocks each'
+           in response)
+    resized = blkcache_show(cons)
+    assert(resized['dir']['max_entries'] == 16)
+    assert(resized['dir']['blocks'] == 4)
+    assert(resized['dir']['entries'] == 0)
+    for pool in ('data', 'inode', 'index'):
+        for key in ('entries', 'max_entries', 'blocks'):
+            assert(resized[pool][key] == again[pool][key])
+
+    cons.run_command('blkcache configure %d %d dir' %
+                     (again['dir']['blocks'], again['dir']['max_entries']))
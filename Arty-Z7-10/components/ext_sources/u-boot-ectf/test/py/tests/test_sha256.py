@@ -0,0 +1,11 @@
+# SPDX-License-Identifier: GPL-2.0
+
+import pytest
+
+@pytest.mark.boardspec('sandbox')
+def test_sha256(u_boot_console):
+    """Test SHA256 against the FIPS 180-2 vectors and, when CONFIG_SHA256_NEON
+    is enabled, the NEON message schedule against the scalar code."""
+
+    response = u_boot_console.run_command('ut_sha256')
+    assert('ut_sha256 ok' in response)
@@ -0,0 +1,127 @@
+/*
+ * Tests for the SHA256 code in lib/sha256.c
+ *
+ * SPDX-License-Identifier:	GPL-2.0+
+ */
+
+#include <common.h>
+#include <command.h>
+#include <malloc.h>
+#include <u-boot/sha256.h>
+
+/* FIPS 180-2 appendix B test vectors */
+static const struct {
+	const char *input;
+	int repeat;
+	uint8_t digest[SHA256_SUM_LEN];
+} sha256_vectors[] = {
+	{
+		"abc", 1,
+		{ 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+		  0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		  0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+		  0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad },
+	},
+	{
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+		{ 0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+		  0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+		  0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67,
+		  0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1 },
+	},
+	{
+		"aaaaaaaaaa", 100000,
+		{ 0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+		  0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+		  0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+		  0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0 },
+	},
+};
+
+static int sha256_test_vectors(void)
+{
+	uint8_t digest[SHA256_SUM_LEN];
+	sha256_context ctx;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sha256_vectors); i++) {
+		sha256_starts(&ctx);
+		for (j = 0; j < sha256_vectors[i].repeat; j++)
+			sha256_update(&ctx,
+				      (const uint8_t *)sha256_vectors[i].input,
+				      strlen(sha256_vectors[i].input));
+		sha256_finish(&ctx, digest);
+
+		if (memcmp(digest, sha256_vectors[i].digest, SHA256_SUM_LEN)) {
+			printf(" vector %d: FAILED\n", i);
+			return 1;
+		}
+	}
+	printf(" vectors: ok\n");
+
+	return 0;
+}
+
+#ifdef CONFIG_SHA256_NEON
+/*
+ * Hash pseudo-random buffers of different lengths with both the NEON and the
+ * scalar block functions and check that they end up in the same state.
+ */
+static int sha256_test_cross_check(void)
+{
+	const int max_blocks = 64;
+	sha256_context neon, scalar;
+	uint8_t *buf;
+	uint32_t seed = 1;
+	int ret = 0;
+	int i, len;
+
+	buf = malloc(max_blocks * 64);
+	if (!buf)
+		return 1;
+
+	for (i = 0; i < max_blocks * 64; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (len = 0; len <= max_blocks * 64; len += 61) {
+		sha256_starts(&neon);
+		sha256_starts(&scalar);
+		sha256_update(&neon, buf, len);
+		sha256_update_scalar(&scalar, buf, len);
+
+		if (memcmp(neon.state, scalar.state, sizeof(neon.state))) {
+			printf(" cross check, length %d: FAILED\n", len);
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret)
+		printf(" cross check against scalar: ok\n");
+
+	free(buf);
+
+	return ret;
+}
+#endif
+
+static int do_ut_sha256(cmd_tbl_t *cmdtp, int flag, int argc,
+			char *const argv[])
+{
+	int err = 0;
+
+	err += sha256_test_vectors();
+#ifdef CONFIG_SHA256_NEON
+	err += sha256_test_cross_check();
+#endif
+
+	printf("ut_sha256 %s\n", err == 0 ? "ok" : "FAILED");
+
+	return err;
+}
+
+U_BOOT_CMD(
+	ut_sha256,	5,	1,	do_ut_sha256,
+	"Test SHA256 against FIPS vectors and the scalar code", ""
+);
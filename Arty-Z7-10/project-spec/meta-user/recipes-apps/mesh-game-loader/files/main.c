@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -8,47 +9,117 @@
 #include <stdbool.h>
 #include <fcntl.h>
 #include <sys/mman.h>
-#include "./aes.c"
-#include "./mesh_users.h"
+#include <sys/syscall.h>
+#include <time.h>
 
-// this is the path where the game will be written to
+// this is the path where the game will be written to when the kernel can't
+// hold it in a memfd
 #define GAMEPATH "/usr/bin/game"
 
-// this is the linux device representing the Zynq ram
-#define MEMPATH "/dev/mem"
+// the number of header lines uboot leaves in front of the game binary
+#define HEADER_LINES 3
 
-// the reserved address in ram where uboot writes the game to
-#define BASE_ADDR 0x1fc00000
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+// this is the device the mesh-game-mem driver gives the reserved memory uboot
+// writes the game to (0x1fc00000) as
+#define MEMPATH "/dev/mesh_game"
 
 // the size of the reserved memory in ram where uboot writes the game to
 #define MAPSIZE 0x400000
 
-// this funciton advances the
-unsigned char *skip_line(unsigned char *buf){
-    int i=0;
+// the game is written out this many bytes at a time
+#define CHUNK_SIZE 0x40000
+
+// uboot puts this in the word after the game size once it has decrypted the
+// game while loading it (MESH_GAME_DECRYPTED in mesh.h). The loader doesn't
+// have the game key, so anything else is refused.
+#define GAME_DECRYPTED 0x52434544
+
+// the third word says where the game starts in the reserved memory, which is
+// up to a cache line past GAME_OFFSET (MESH_GAME_OFFSET in mesh.h)
+#define GAME_OFFSET 0x40
+#define GAME_OFFSET_MAX 0x80
+
+// this function skips the header lines still left at the start of a chunk
+// of the game and returns how many bytes of the chunk they take up. lines
+// counts down as they are found, so a header can run over into the next chunk
+int skip_header(unsigned char *buf, int len, int *lines){
+    unsigned char *p = buf;
+    unsigned char *nl;
+
+    while (*lines > 0) {
+        nl = memchr(p, '\n', len - (p - buf));
+        if (nl == NULL)
+            return len;
+        p = nl + 1;
+        (*lines)--;
+    }
+
+    return p - buf;
+}
 
-    while (buf[i++] != '\n'){
-        continue;
+// this function opens the file the game is written to. The game is kept in
+// an anonymous memfd when the kernel has them, so it never touches the rootfs
+// and is run straight from the page cache. in_memory says which one it got.
+int open_game_file(bool *in_memory){
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, "game", MFD_ALLOW_SEALING);
+
+    if (fd != -1) {
+        *in_memory = true;
+        return fd;
     }
+#endif
 
-    return buf + i;
+    // the game file is created by startup.sh with the right owner and mode,
+    // which O_TRUNC keeps
+    *in_memory = false;
+    return open(GAMEPATH, O_RDWR | O_CREAT | O_TRUNC, 0755);
 }
 
-int mesh_decrypt_game(unsigned char *inputBuffer, loff_t game_size){
-    struct AES_ctx ctx;
-    uint8_t* nonce = calloc(16,sizeof(uint8_t));
-    char * key;
+// this function runs the game that was written to fd. It only returns if the
+// game could not be started.
+void run_game(int fd, bool in_memory){
+    char *game_argv[] = { "game", NULL };
+
+    // exec throws away anything still buffered
+    fflush(stdout);
+
+    if (!in_memory) {
+        close(fd);
+        execv(GAMEPATH, game_argv);
+        return;
+    }
 
-    strncat(nonce, NONCE, 8);
-    key = KEY;
+#ifdef F_ADD_SEALS
+    // nothing can change the game once it has been loaded
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    fexecve(fd, game_argv, environ);
+}
 
-    printf("Decrypt, Here is your KEY: %s", key);
-    printf("Decrypt, Here is your NONCE: %s", nonce);
+// this function writes len bytes of buf to fd, carrying on after short writes
+int write_all(int fd, unsigned char *buf, int len){
+    int written = 0;
+    int ret;
 
-    AES_init_ctx_iv(&ctx, (uint8_t*) key, (uint8_t *) nonce);
-    AES_CTR_xcrypt_buffer(&ctx, (uint8_t *) inputBuffer, game_size);
+    while (written < len) {
+        ret = write(fd, buf + written, len - written);
+        if (ret < 0)
+            return -1;
+        written += ret;
+    }
 
-    return 0;
+    return written;
+}
+
+// this function returns the number of microseconds between two times
+long elapsed_us(struct timespec *start, struct timespec *end){
+    return (end->tv_sec - start->tv_sec) * 1000000L +
+           (end->tv_nsec - start->tv_nsec) / 1000;
 }
 
 /*
@@ -63,11 +134,22 @@ int main(int argc, char **argv)
     unsigned char *map;
     unsigned char *map_tmp;
     int gameSize;
-    FILE * gameFp;
+    int gameOffset;
+    int gameFd;
+    bool inMemory;
+    int headerLines = HEADER_LINES;
+    int skipped;
     int written;
+    int offset;
+    int length;
+    int ret;
+    struct timespec start, end, boot;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    // open the memory device
-    fd = open(MEMPATH, O_RDWR | O_SYNC);
+    // open the game memory. mesh-game-mem maps it cached, so the game is
+    // read at memory speed rather than one uncached word at a time
+    fd = open(MEMPATH, O_RDONLY);
 
     if (fd == -1) {
         printf("mem open failed\r\n");
@@ -75,48 +157,83 @@ int main(int argc, char **argv)
     }
 
     // map the memory device so your can access it like a chunk of memory
-    map = mmap(0, MAPSIZE, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, BASE_ADDR);
+    map = mmap(0, MAPSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("mem map failed\r\n");
+        return 1;
+    }
     gameSize = *(int *)map;
+    if (*((int *)map + 1) != GAME_DECRYPTED) {
+        printf("Game was not decrypted by uboot\r\n");
+        return 1;
+    }
+    gameOffset = *((int *)map + 2);
+    if (gameOffset < GAME_OFFSET || gameOffset >= GAME_OFFSET_MAX)
+        gameOffset = GAME_OFFSET;
 
-    gameFp = NULL;
+    if (gameSize < 0 || gameSize > MAPSIZE - gameOffset) {
+        printf("Bad game size %d\r\n", gameSize);
+        return 1;
+    }
 
-    gameFp = fopen(GAMEPATH, "w+b");
+    gameFd = open_game_file(&inMemory);
 
-    if (gameFp == NULL) {
+    if (gameFd == -1) {
         printf("Error opening game file\r\n");
         return 1;
     }
-    printf("Here is the NONCE: %s\n", NONCE);
-    printf("Here is the KEY: %s\n", KEY);
     printf("Launching game from reserved ddr. Game Size: %d\r\n", gameSize);
 
     // jump ahead to the reserved region for the game binary
-    map += 0x40;
-
-    mesh_decrypt_game(map, gameSize);
-
-    for(int i=0; i < 25; i++)
-    {
-      printf("%c\n", map[i]);
+    map += gameOffset;
+
+    // write the game a chunk at a time straight out of the mapping into the
+    // game file
+    written = 0;
+    ret = 0;
+    for (offset = 0; offset < gameSize; offset += length) {
+        length = gameSize - offset < CHUNK_SIZE ? gameSize - offset : CHUNK_SIZE;
+
+        map_tmp = map + offset;
+        if (offset == 0) {
+            for(int i=0; i < 25 && i < length; i++)
+            {
+              printf("%c\n", map[i]);
+            }
+        }
+
+        // dump the header lines of the game so it is executable
+        skipped = skip_header(map_tmp, length, &headerLines);
+
+        ret = write_all(gameFd, map_tmp + skipped, length - skipped);
+        if (ret < 0) {
+            printf("write error.\r\n");
+            break;
+        }
+        written += ret;
     }
 
-    // dump first 3 header lines of the game so it is executable
-    map_tmp = map;
-    for (int i=0; i < 3; i++){
-        map_tmp = skip_line(map_tmp);
-    }
+    printf("%d bytes written\r\n", written);
 
-    // write the game
-    written = fwrite(map_tmp, sizeof(char), gameSize - (map_tmp - map), gameFp);
+    munmap(map - gameOffset, MAPSIZE);
+    close(fd);
 
-    if (ferror(gameFp)) {
-        printf("fwrite error.\r\n");
-    }
-
-    printf("%d bytes written\r\n", written);
+    // report how long the load took, and how long after the kernel started
+    // the game is ready to run
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    printf("Game loaded %s in %ld us, %ld.%03ld s after boot\r\n",
+           inMemory ? "into memory" : "to " GAMEPATH,
+           elapsed_us(&start, &end), (long) boot.tv_sec, boot.tv_nsec / 1000000);
 
+    if (ret < 0) {
+        close(gameFd);
+        return 1;
+    }
 
-    fclose(gameFp);
+    run_game(gameFd, inMemory);
+    printf("Could not start the game\r\n");
+    close(gameFd);
 
     return 1;
 }
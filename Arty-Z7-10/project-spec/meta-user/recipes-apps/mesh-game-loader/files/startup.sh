@@ -30,9 +30,10 @@ start ()
     # login ectf
     /bin/login -f ectf
 
-    # load and launch game
+    # load and launch game, the loader runs the game itself once it is loaded
+    # from /dev/mesh_game
+    modprobe mesh-game-mem
     mesh-game-loader
-    game
 
     # restart so user doesnt fall through to petalinux shell
     echo "Game over. Restarting system..."
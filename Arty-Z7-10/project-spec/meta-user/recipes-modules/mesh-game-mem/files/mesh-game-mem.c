@@ -0,0 +1,103 @@
+/*
+ * mesh-game-mem.c: gives mesh-game-loader the memory u-boot loads games into
+ *
+ * u-boot loads the game into the mesh_game reserved-memory region (see
+ * system-user.dtsi). The region is no-map, so it isn't part of the kernel's
+ * RAM and /dev/mem can stay restricted with STRICT_DEVMEM. This driver
+ * exposes just that region as /dev/mesh_game, which root can map read only.
+ * The mapping is cached like ordinary memory, so the loader reads the game at
+ * memory speed.
+ *
+ * GPLv2 License
+ */
+
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/platform_device.h>
+
+static struct resource mesh_game_res;
+
+static int mesh_game_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+		return -EPERM;
+	if (offset >= resource_size(&mesh_game_res) ||
+	    size > resource_size(&mesh_game_res) - offset)
+		return -EINVAL;
+
+	/* nor can it be made writable later with mprotect */
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       (mesh_game_res.start + offset) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
+static const struct file_operations mesh_game_fops = {
+	.owner = THIS_MODULE,
+	.mmap = mesh_game_mmap,
+};
+
+static struct miscdevice mesh_game_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mesh_game",
+	.fops = &mesh_game_fops,
+	.mode = 0400,
+};
+
+static int mesh_game_probe(struct platform_device *pdev)
+{
+	struct device_node *np;
+	int ret;
+
+	np = of_parse_phandle(pdev->dev.of_node, "memory-region", 0);
+	if (!np) {
+		dev_err(&pdev->dev, "no memory-region\n");
+		return -ENODEV;
+	}
+	ret = of_address_to_resource(np, 0, &mesh_game_res);
+	of_node_put(np);
+	if (ret) {
+		dev_err(&pdev->dev, "bad memory-region\n");
+		return ret;
+	}
+
+	ret = misc_register(&mesh_game_misc);
+	if (ret)
+		return ret;
+
+	dev_info(&pdev->dev, "game memory %pR\n", &mesh_game_res);
+	return 0;
+}
+
+static int mesh_game_remove(struct platform_device *pdev)
+{
+	misc_deregister(&mesh_game_misc);
+	return 0;
+}
+
+static const struct of_device_id mesh_game_of_match[] = {
+	{ .compatible = "mesh,game-mem", },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, mesh_game_of_match);
+
+static struct platform_driver mesh_game_driver = {
+	.driver = {
+		.name = "mesh-game-mem",
+		.of_match_table = mesh_game_of_match,
+	},
+	.probe = mesh_game_probe,
+	.remove = mesh_game_remove,
+};
+module_platform_driver(mesh_game_driver);
+
+MODULE_DESCRIPTION("Read only access to the mesh game memory");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,307 @@
+#include "./aes.c"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Known answer test and throughput benchmark for the AES-256 CTR code in
+// aes.c, which is shared with u-boot and the game loader. It also checks
+// AES_CTR_xcrypt_buffer against encrypting one counter at a time with the
+// scalar cipher, which covers the AES_NEON code when that is built in. With
+// AES_THREADS it also checks AES_CTR_xcrypt_buffer_threads against it and
+// reports the throughput for each number of threads up to the given maximum.
+//
+//   gcc -O2 -o aesBench aesBench.c
+//   gcc -O2 -mssse3 -DAES_NEON=1 -o aesBench aesBench.c     (AES_NEON on a PC)
+//   gcc -O2 -DAES_THREADS=1 -pthread -o aesBench aesBench.c
+//   ./aesBench [MB to encrypt for the benchmark, default 64] [max threads, default the online CPUs]
+
+// NIST SP 800-38A F.5.5 (CTR-AES256.Encrypt), the last plaintext block is also F.1.5 (ECB-AES256)
+static const uint8_t kat_key[32] = {
+  0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+  0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4 };
+
+static const uint8_t kat_ctr[16] = {
+  0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+static const uint8_t kat_plain[64] = {
+  0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+  0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+  0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+
+static const uint8_t kat_ctr_cipher[64] = {
+  0x60, 0x1e, 0xc3, 0x13, 0x77, 0x57, 0x89, 0xa5, 0xb7, 0xa7, 0xf5, 0x04, 0xbb, 0xf3, 0xd2, 0x28,
+  0xf4, 0x43, 0xe3, 0xca, 0x4d, 0x62, 0xb5, 0x9a, 0xca, 0x84, 0xe9, 0x90, 0xca, 0xca, 0xf5, 0xc5,
+  0x2b, 0x09, 0x30, 0xda, 0xa2, 0x3d, 0xe9, 0x4c, 0xe8, 0x70, 0x17, 0xba, 0x2d, 0x84, 0x98, 0x8d,
+  0xdf, 0xc9, 0xc5, 0x8d, 0xb6, 0x7a, 0xad, 0xa6, 0x13, 0xc2, 0xdd, 0x08, 0x45, 0x79, 0x41, 0xa6 };
+
+static const uint8_t kat_ecb_cipher[16] = {
+  0xf3, 0xee, 0xd1, 0xbd, 0xb5, 0xd2, 0xa0, 0x3c, 0x06, 0x4b, 0x5a, 0x7e, 0x3d, 0xb1, 0x81, 0xf8 };
+
+// Checks the cipher against the NIST vectors and checks that splitting a
+// buffer up or misaligning it doesn't change the CTR output. Returns the
+// number of failed checks.
+static int known_answer_test(void)
+{
+  struct AES_ctx ctx;
+  uint8_t buf[64 + 3];
+  uint8_t keystream[64];
+  uint8_t block[16];
+  int failed = 0;
+  int i;
+
+  // ECB, one block
+  memcpy(block, kat_plain, 16);
+  AES_init_ctx(&ctx, kat_key);
+  AES_ECB_encrypt(&ctx, block);
+  if (memcmp(block, kat_ecb_cipher, 16))
+  {
+    printf("FAIL: ECB-AES256 encrypt\n");
+    failed++;
+  }
+  AES_ECB_decrypt(&ctx, block);
+  if (memcmp(block, kat_plain, 16))
+  {
+    printf("FAIL: ECB-AES256 decrypt\n");
+    failed++;
+  }
+
+  // CTR, whole buffer at once
+  memcpy(buf, kat_plain, 64);
+  AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+  AES_CTR_xcrypt_buffer(&ctx, buf, 64);
+  if (memcmp(buf, kat_ctr_cipher, 64))
+  {
+    printf("FAIL: CTR-AES256 encrypt\n");
+    failed++;
+  }
+
+  // CTR, keystream generated up front
+  AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+  AES_CTR_keystream(&ctx, keystream, 4);
+  for (i = 0; i < 64; ++i)
+  {
+    if ((kat_plain[i] ^ keystream[i]) != kat_ctr_cipher[i])
+    {
+      printf("FAIL: CTR-AES256 keystream\n");
+      failed++;
+      break;
+    }
+  }
+
+  // CTR, unaligned buffer split at block boundaries
+  memcpy(buf + 3, kat_ctr_cipher, 64);
+  AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+  AES_CTR_xcrypt_buffer(&ctx, buf + 3, 16);
+  AES_CTR_xcrypt_buffer(&ctx, buf + 3 + 16, 48);
+  if (memcmp(buf + 3, kat_plain, 64))
+  {
+    printf("FAIL: CTR-AES256 decrypt, unaligned\n");
+    failed++;
+  }
+
+  // CTR, length that isn't a multiple of the block size
+  memcpy(buf, kat_plain, 64);
+  AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+  AES_CTR_xcrypt_buffer(&ctx, buf, 61);
+  if (memcmp(buf, kat_ctr_cipher, 61) || memcmp(buf + 61, kat_plain + 61, 3))
+  {
+    printf("FAIL: CTR-AES256 partial block\n");
+    failed++;
+  }
+
+  return failed;
+}
+
+// CTR one block at a time with the scalar cipher
+static void reference_ctr(const uint8_t* key, const uint8_t* iv, uint8_t* buf, uint32_t length)
+{
+  struct AES_ctx ctx;
+  uint8_t keystream[AES_BLOCKLEN];
+  uint32_t i;
+
+  AES_init_ctx_iv(&ctx, key, iv);
+  for (i = 0; i < length; ++i)
+  {
+    if (i % AES_BLOCKLEN == 0)
+    {
+      Cipher(ctx.Iv, keystream, ctx.RoundKeyW);
+      IncrementIv(ctx.Iv);
+    }
+    buf[i] ^= keystream[i % AES_BLOCKLEN];
+  }
+}
+
+// Compares AES_CTR_xcrypt_buffer with reference_ctr for random keys, counters
+// (some about to wrap), lengths and alignments. Returns the number of failures.
+static int cross_check(void)
+{
+  struct AES_ctx ctx;
+  uint8_t key[32], iv[16];
+  uint8_t data[1024 + 3], expect[1024 + 3];
+  uint32_t length, offset, i;
+  int failed = 0;
+  int trial;
+
+  srand(1);
+  for (trial = 0; trial < 2000; ++trial)
+  {
+    for (i = 0; i < sizeof(key); ++i)
+      key[i] = rand();
+    for (i = 0; i < sizeof(iv); ++i)
+      iv[i] = (trial % 4 == 0 && i >= 8) ? 0xff : rand();
+    for (i = 0; i < sizeof(data); ++i)
+      data[i] = expect[i] = rand();
+
+    length = rand() % 1025;
+    offset = rand() % 4;
+
+    reference_ctr(key, iv, expect + offset, length);
+
+    AES_init_ctx_iv(&ctx, key, iv);
+    AES_CTR_xcrypt_buffer(&ctx, data + offset, length);
+
+    if (memcmp(data, expect, sizeof(data)))
+    {
+      printf("FAIL: CTR cross check, length %u offset %u\n", length, offset);
+      failed++;
+    }
+  }
+
+  return failed;
+}
+
+#if defined(AES_THREADS) && (AES_THREADS == 1)
+// Compares AES_CTR_xcrypt_buffer_threads with AES_CTR_xcrypt_buffer for random
+// lengths, alignments and thread counts, including carrying the counter on
+// into a second call. Returns the number of failures.
+static int thread_check(void)
+{
+  struct AES_ctx ctx, ctx_threads;
+  uint8_t key[32], iv[16];
+  static uint8_t data[4 * AES_THREAD_MIN + 3], expect[4 * AES_THREAD_MIN + 3];
+  uint32_t length, offset, split, i;
+  int nthreads;
+  int failed = 0;
+  int trial;
+
+  srand(2);
+  for (trial = 0; trial < 200; ++trial)
+  {
+    for (i = 0; i < sizeof(key); ++i)
+      key[i] = rand();
+    for (i = 0; i < sizeof(iv); ++i)
+      iv[i] = (trial % 4 == 0 && i >= 8) ? 0xff : rand();
+    for (i = 0; i < sizeof(data); ++i)
+      data[i] = expect[i] = rand();
+
+    length = rand() % (4 * AES_THREAD_MIN + 1);
+    offset = rand() % 4;
+    split = rand() % (length / AES_BLOCKLEN + 1) * AES_BLOCKLEN;
+    nthreads = 1 + rand() % AES_THREAD_MAX;
+
+    AES_init_ctx_iv(&ctx, key, iv);
+    AES_CTR_xcrypt_buffer(&ctx, expect + offset, length);
+
+    AES_init_ctx_iv(&ctx_threads, key, iv);
+    AES_CTR_xcrypt_buffer_threads(&ctx_threads, data + offset, split, nthreads);
+    AES_CTR_xcrypt_buffer_threads(&ctx_threads, data + offset + split, length - split, nthreads);
+
+    if (memcmp(data, expect, sizeof(data)) || memcmp(ctx.Iv, ctx_threads.Iv, AES_BLOCKLEN))
+    {
+      printf("FAIL: CTR thread check, length %u offset %u split %u threads %d\n", length, offset, split, nthreads);
+      failed++;
+    }
+  }
+
+  return failed;
+}
+#endif
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *const argv[])
+{
+  struct AES_ctx ctx;
+  size_t mb = 64;
+  size_t size;
+  uint8_t * buffer;
+  double start, elapsed;
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (argc > 1)
+  {
+    mb = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2)
+  {
+    max_threads = atoi(argv[2]);
+  }
+
+  if (known_answer_test())
+  {
+    printf("Known answer test failed\n");
+    return 1;
+  }
+  printf("Known answer test passed\n");
+
+  if (cross_check())
+  {
+    printf("Cross check against the scalar cipher failed\n");
+    return 1;
+  }
+  printf("Cross check against the scalar cipher passed%s\n", AES_NEON ? " (AES_NEON)" : "");
+
+#if defined(AES_THREADS) && (AES_THREADS == 1)
+  if (thread_check())
+  {
+    printf("Threaded CTR check failed\n");
+    return 1;
+  }
+  printf("Threaded CTR check passed\n");
+#endif
+
+  if (mb == 0)
+  {
+    return 0;
+  }
+
+  size = mb << 20;
+  buffer = calloc(size, sizeof(uint8_t));
+  if (buffer == NULL)
+  {
+    printf("Failed to allocate %zu MB\n", mb);
+    return 1;
+  }
+
+  AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+  start = now();
+  AES_CTR_xcrypt_buffer(&ctx, buffer, size);
+  elapsed = now() - start;
+
+  printf("AES-256-CTR: %zu MB in %.3f s, %.1f MB/s\n", mb, elapsed, mb / elapsed);
+
+#if defined(AES_THREADS) && (AES_THREADS == 1)
+  for (int nthreads = 1; nthreads <= max_threads && nthreads <= AES_THREAD_MAX; ++nthreads)
+  {
+    AES_init_ctx_iv(&ctx, kat_key, kat_ctr);
+    start = now();
+    AES_CTR_xcrypt_buffer_threads(&ctx, buffer, size, nthreads);
+    elapsed = now() - start;
+
+    printf("AES-256-CTR, %d thread%s: %zu MB in %.3f s, %.1f MB/s\n",
+           nthreads, nthreads == 1 ? "" : "s", mb, elapsed, mb / elapsed);
+  }
+#else
+  (void)max_threads;
+#endif
+
+  free(buffer);
+  return 0;
+}
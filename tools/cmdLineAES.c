@@ -1,64 +1,314 @@
-#include "./aes.c"
-#include <stdlib.h>
-#include <stdio.h>
-
-int main(int argc, char *const argv[])
-{
-  // do the AES
-  struct AES_ctx ctx;
-  uint32_t  game_size;
-  char * path_to_game;
-  char * key = calloc(32, sizeof(char));
-  char * pre_nonce = calloc(8, sizeof(char));
-  uint8_t * nonce = calloc(16,sizeof(uint8_t));
-  char * game_buffer;
-
-
-  //Grab the arguments
-  path_to_game = argv[1];
-  memcpy(key, argv[2], 32);
-  memcpy(pre_nonce, argv[3], 8);
-
-
-  FILE * game = fopen(path_to_game, "rb");
-  // get the size of the game
-  // Seek to the end of the file
-  fseek(game, 0L, SEEK_END);
-  // Use ftell to grab the size of the game file at the end
-  game_size = ftell(game);
-  // set the buffer to correct size
-  game_buffer = (char *) calloc(game_size, sizeof(char));
-  // reset the file pointer
-  fseek(game, 0L, SEEK_SET);
-
-  // Insert the NONCE into the nonce buffer that is 16 bytes and keeps the last 8 bytes NULL <-- we should change this
-  strncat(nonce, pre_nonce, 8);
-
-  printf("Here is your key, %s\n", key);
-  printf("Here is your nonce, %s\n", nonce);
-  printf("Here is the path to the game, %s\n", path_to_game);
-
-  //read the file  into the buffer
-  fread(game_buffer, sizeof(char), game_size, game);
-  fclose(game);
-
-  // Initialize the ctx
-  AES_init_ctx_iv(&ctx, (uint8_t*) key, (uint8_t *) nonce);
-  // Decrypt the game
-  AES_CTR_xcrypt_buffer(&ctx, (uint8_t *) game_buffer, game_size);
-
-  // write the game buffer out to a file.  File name is _enc for now.
-
-  // create a string of size path_to_game + 5 to include "_enc" and null terminator
-  char * encrypted_game = calloc(strlen(path_to_game), sizeof(char));
-  // append to the end the file_name
-  strncat(encrypted_game, path_to_game, strlen(path_to_game));
-  // Open the file for write binary mode
-  FILE * enc_game = fopen(encrypted_game, "wb");
-  // Write to the file
-  fwrite(game_buffer, game_size, sizeof(char), enc_game);
-  // Close file
-  fclose(enc_game);
-  // End of function
-  return 0;
-}
+#include "./aes.c"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Encrypts or decrypts files with AES-256-CTR (the same operation) a chunk at
+// a time, so a file never has to fit in memory. The counter carries on from
+// one chunk to the next, so the output is the same as doing the whole file at
+// once.
+//
+//   gcc -O2 -o cmdAES cmdLineAES.c
+//   ./cmdAES <file> <key> <nonce>                     (in place, as before)
+//   ./cmdAES [--bench] [--chunk bytes] [-o out] -k <key> -n <nonce> <file>...
+//
+// Files are done in place through mmap, falling back to reading and writing
+// each chunk back when the file can't be mapped. With -o a single file is
+// streamed to out instead. --bench prints the MB/s for each file.
+
+// Default number of bytes encrypted at a time. It must be a multiple of
+// AES_BLOCKLEN for the counter to carry on.
+#define CHUNK_SIZE (1 << 20)
+
+struct options
+{
+  uint8_t key[AES_KEYLEN];
+  uint8_t nonce[AES_BLOCKLEN];
+  const char* out;
+  size_t chunk;
+  int bench;
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The key is the first AES_KEYLEN bytes of the argument and the counter starts
+// as the first 8 bytes of the nonce followed by zeros
+static void set_key(struct options* opts, const char* key, const char* nonce)
+{
+  memset(opts->key, 0, sizeof(opts->key));
+  memcpy(opts->key, key, strnlen(key, AES_KEYLEN));
+  memset(opts->nonce, 0, sizeof(opts->nonce));
+  memcpy(opts->nonce, nonce, strnlen(nonce, 8));
+}
+
+// Runs CTR over length bytes of buf a chunk at a time
+static void xcrypt_chunks(struct AES_ctx* ctx, uint8_t* buf, size_t length, size_t chunk)
+{
+  size_t n;
+
+  for (; length > 0; buf += n, length -= n)
+  {
+    n = length < chunk ? length : chunk;
+    AES_CTR_xcrypt_buffer(ctx, buf, n);
+  }
+}
+
+// Encrypts fd in place by reading each chunk, encrypting it and writing it
+// back over itself. Used for files that can't be mapped.
+static int xcrypt_fd_in_place(struct AES_ctx* ctx, int fd, size_t chunk, size_t* done)
+{
+  uint8_t* buf = malloc(chunk);
+  off_t offset = 0;
+  ssize_t n, w;
+
+  if (buf == NULL)
+  {
+    return -1;
+  }
+
+  while ((n = pread(fd, buf, chunk, offset)) > 0)
+  {
+    AES_CTR_xcrypt_buffer(ctx, buf, n);
+    for (w = 0; w < n; )
+    {
+      ssize_t ret = pwrite(fd, buf + w, n - w, offset + w);
+      if (ret < 0)
+      {
+        free(buf);
+        return -1;
+      }
+      w += ret;
+    }
+    offset += n;
+  }
+
+  free(buf);
+  *done = offset;
+  return n < 0 ? -1 : 0;
+}
+
+// Encrypts the file at path in place. The file is mapped, so its pages are
+// read in and written back by the kernel as they are encrypted rather than
+// all being held in memory at once.
+static int xcrypt_in_place(struct AES_ctx* ctx, const char* path, size_t chunk, size_t* done)
+{
+  struct stat st;
+  uint8_t* map;
+  int fd;
+  int ret = 0;
+
+  fd = open(path, O_RDWR);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return -1;
+  }
+
+  *done = 0;
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    ret = xcrypt_fd_in_place(ctx, fd, chunk, done);
+    close(fd);
+    return ret;
+  }
+
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  xcrypt_chunks(ctx, map, st.st_size, chunk);
+  *done = st.st_size;
+
+  if (munmap(map, st.st_size) < 0)
+  {
+    ret = -1;
+  }
+  if (close(fd) < 0)
+  {
+    ret = -1;
+  }
+  return ret;
+}
+
+// Encrypts the file at path into out a chunk at a time
+static int xcrypt_to_file(struct AES_ctx* ctx, const char* path, const char* out, size_t chunk, size_t* done)
+{
+  FILE* in = fopen(path, "rb");
+  FILE* enc_game;
+  uint8_t* buf;
+  size_t n;
+  int ret = 0;
+
+  *done = 0;
+  if (in == NULL)
+  {
+    return -1;
+  }
+  enc_game = fopen(out, "wb");
+  buf = malloc(chunk);
+  if (enc_game == NULL || buf == NULL)
+  {
+    if (enc_game)
+    {
+      fclose(enc_game);
+    }
+    fclose(in);
+    free(buf);
+    return -1;
+  }
+
+  // fread only comes back short at the end of the file, so every chunk
+  // before the last is a whole number of AES blocks
+  while ((n = fread(buf, 1, chunk, in)) > 0)
+  {
+    AES_CTR_xcrypt_buffer(ctx, buf, n);
+    if (fwrite(buf, 1, n, enc_game) != n)
+    {
+      ret = -1;
+      break;
+    }
+    *done += n;
+  }
+  if (ferror(in))
+  {
+    ret = -1;
+  }
+
+  free(buf);
+  fclose(in);
+  if (fclose(enc_game) != 0)
+  {
+    ret = -1;
+  }
+  return ret;
+}
+
+static int usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s <file> <key> <nonce>\n"
+          "       %s [--bench] [--chunk bytes] [-o out] -k <key> -n <nonce> <file>...\n",
+          prog, prog);
+  return 2;
+}
+
+int main(int argc, char *const argv[])
+{
+  struct options opts = { .chunk = CHUNK_SIZE };
+  const char* key = NULL;
+  const char* nonce = NULL;
+  char *const * files;
+  int nfiles;
+  int failed = 0;
+  int i;
+
+  // the original form, which provisioning scripts may still call
+  if (argc == 4 && argv[1][0] != '-')
+  {
+    files = &argv[1];
+    nfiles = 1;
+    key = argv[2];
+    nonce = argv[3];
+  }
+  else
+  {
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+    {
+      if (strcmp(argv[i], "--bench") == 0)
+      {
+        opts.bench = 1;
+      }
+      else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc)
+      {
+        opts.chunk = strtoul(argv[++i], NULL, 0);
+      }
+      else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      {
+        opts.out = argv[++i];
+      }
+      else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+      {
+        key = argv[++i];
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      {
+        nonce = argv[++i];
+      }
+      else if (strcmp(argv[i], "--") == 0)
+      {
+        ++i;
+        break;
+      }
+      else
+      {
+        return usage(argv[0]);
+      }
+    }
+    files = &argv[i];
+    nfiles = argc - i;
+  }
+
+  if (key == NULL || nonce == NULL || nfiles < 1 || (opts.out && nfiles != 1))
+  {
+    return usage(argv[0]);
+  }
+  if (opts.chunk == 0 || opts.chunk % AES_BLOCKLEN || opts.chunk > UINT32_MAX)
+  {
+    fprintf(stderr, "chunk size must be a multiple of %d bytes\n", AES_BLOCKLEN);
+    return 2;
+  }
+  set_key(&opts, key, nonce);
+
+  // every file starts from the same counter, as if each was done on its own
+  for (i = 0; i < nfiles; ++i)
+  {
+    struct AES_ctx ctx;
+    size_t done;
+    double start = now();
+    double elapsed;
+    int ret;
+
+    AES_init_ctx_iv(&ctx, opts.key, opts.nonce);
+    if (opts.out)
+    {
+      ret = xcrypt_to_file(&ctx, files[i], opts.out, opts.chunk, &done);
+    }
+    else
+    {
+      ret = xcrypt_in_place(&ctx, files[i], opts.chunk, &done);
+    }
+    elapsed = now() - start;
+
+    if (ret < 0)
+    {
+      fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+      failed++;
+      continue;
+    }
+
+    if (opts.bench)
+    {
+      printf("%s: %zu bytes in %.3f s, %.1f MB/s\n", files[i], done, elapsed,
+             elapsed > 0 ? done / elapsed / (1 << 20) : 0.0);
+    }
+  }
+
+  return failed ? 1 : 0;
+}
@@ -8,6 +8,9 @@ import argparse
 BOOT_MNT = '/mnt/zynq/boot/'
 GAMES_MNT = '/mnt/zynq/games'
 
+# directory provisionGames.py stores the chunks of deduplicated games in
+CHUNK_DIR = 'chunks'
+
 # the names to copy the boot and mes files to on the sd card
 BOOT_FILE = 'BOOT.bin'
 MES_FILE = 'MES.bin'
@@ -58,7 +61,8 @@ def copy_games(device, games):
     device: the path to the device to copy the games to, ie /dev/sdb.
     games: the path to the directory that contains the games to copy to the
             sd card. This script will copy ALL regular files in the root of
-            the specified directory, so make sure it is a clean directory.
+            the specified directory, so make sure it is a clean directory,
+            and the chunks directory deduplicated games are stored in.
     """
 
     print("Copying Games...")
@@ -72,6 +76,9 @@ def copy_games(device, games):
         full_path = os.path.join(games, file_name)
         try:
             print("    %s-> %s2/" % (full_path, device))
+            if file_name == CHUNK_DIR and os.path.isdir(full_path):
+                subprocess.check_call("sudo cp -r %s %s" % (full_path, GAMES_MNT), shell=True)
+                continue
             copy_file(full_path, GAMES_MNT)
         except IOError as e:
             print(e)
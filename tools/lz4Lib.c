@@ -0,0 +1,244 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// LZ4 frame compression for provisionGames.py, which loads it with ctypes
+// like aesLib.c. Frames are written the way u-boot's ulz4fn (lib/lz4_wrapper.c)
+// reads them: independent blocks of up to 64 KiB, no content size and no
+// checksums. The compressor is the plain greedy one from the LZ4 reference,
+// which is all the game chunks need; decompression speed doesn't depend on
+// how hard the compressor looked for matches.
+//
+//   gcc -O2 -shared -fPIC -o liblz4.so lz4Lib.c
+
+#define LZ4F_MAGIC 0x184D2204
+#define LZ4F_FLG 0x60 // version 1, independent blocks
+#define LZ4F_BD 0x40  // 64 KiB blocks
+#define LZ4_BLOCK_MAX 65536
+#define LZ4F_UNCOMPRESSED 0x80000000 // block size flag
+
+#define MINMATCH 4
+#define LASTLITERALS 5 // the last bytes of a block are always literals
+#define MFLIMIT 12     // and no match starts closer than this to the end
+#define MAX_DISTANCE 65535
+#define HASH_LOG 12
+
+#define PRIME32_1 2654435761U
+#define PRIME32_2 2246822519U
+#define PRIME32_3 3266489917U
+#define PRIME32_4 668265263U
+#define PRIME32_5 374761393U
+
+static uint32_t read32(const uint8_t* p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static void write32(uint8_t* p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint32_t rotl32(uint32_t v, int n)
+{
+  return (v << n) | (v >> (32 - n));
+}
+
+// xxHash32 of fewer than 16 bytes, which is all a frame descriptor ever is
+static uint32_t xxh32_short(const uint8_t* p, size_t len, uint32_t seed)
+{
+  uint32_t h = seed + PRIME32_5 + (uint32_t)len;
+
+  for (; len >= 4; p += 4, len -= 4)
+  {
+    h += read32(p) * PRIME32_3;
+    h = rotl32(h, 17) * PRIME32_4;
+  }
+  for (; len > 0; ++p, --len)
+  {
+    h += *p * PRIME32_5;
+    h = rotl32(h, 11) * PRIME32_1;
+  }
+
+  h ^= h >> 15;
+  h *= PRIME32_2;
+  h ^= h >> 13;
+  h *= PRIME32_3;
+  h ^= h >> 16;
+  return h;
+}
+
+static uint32_t hash_position(const uint8_t* p)
+{
+  return (read32(p) * PRIME32_1) >> (32 - HASH_LOG);
+}
+
+static uint8_t* write_length(uint8_t* op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+  {
+    *op++ = 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+// Writes one sequence: literals from anchor, then a match of match_len bytes
+// offset bytes back, or just the literals if match_len is 0. Returns NULL if
+// it doesn't fit before end.
+static uint8_t* write_sequence(uint8_t* op, uint8_t* end, const uint8_t* anchor,
+                               size_t literals, size_t offset, size_t match_len)
+{
+  uint8_t* token = op++;
+  size_t need = 1 + literals + literals / 255 + 1;
+
+  if (match_len)
+  {
+    need += 2 + (match_len - MINMATCH) / 255 + 1;
+  }
+  if (need > (size_t)(end - token))
+  {
+    return NULL;
+  }
+
+  if (literals >= 15)
+  {
+    *token = 15 << 4;
+    op = write_length(op, literals - 15);
+  }
+  else
+  {
+    *token = literals << 4;
+  }
+  memcpy(op, anchor, literals);
+  op += literals;
+
+  if (match_len == 0)
+  {
+    return op;
+  }
+
+  *op++ = offset;
+  *op++ = offset >> 8;
+  match_len -= MINMATCH;
+  if (match_len >= 15)
+  {
+    *token |= 15;
+    op = write_length(op, match_len - 15);
+  }
+  else
+  {
+    *token |= match_len;
+  }
+  return op;
+}
+
+// Compresses len bytes of src, at most LZ4_BLOCK_MAX, into one LZ4 block at
+// dst. Returns the size of the block, or 0 if it doesn't fit in cap bytes.
+static size_t lz4_compress_block(const uint8_t* src, size_t len, uint8_t* dst, size_t cap)
+{
+  uint32_t table[1 << HASH_LOG] = { 0 };
+  const uint8_t* ip = src;
+  const uint8_t* anchor = src;
+  const uint8_t* end = src + len;
+  const uint8_t* mflimit = end - MFLIMIT;
+  const uint8_t* matchlimit = end - LASTLITERALS;
+  uint8_t* op = dst;
+  uint8_t* op_end = dst + cap;
+
+  if (len > MFLIMIT)
+  {
+    while (ip < mflimit)
+    {
+      uint32_t h = hash_position(ip);
+      const uint8_t* ref = src + table[h];
+      size_t match_len;
+
+      table[h] = ip - src;
+      if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != read32(ip))
+      {
+        ++ip;
+        continue;
+      }
+
+      // take in any literals the match also covers
+      while (ip > anchor && ref > src && ip[-1] == ref[-1])
+      {
+        --ip;
+        --ref;
+      }
+      for (match_len = MINMATCH; ip + match_len < matchlimit && ip[match_len] == ref[match_len]; ++match_len)
+      {
+      }
+
+      op = write_sequence(op, op_end, anchor, ip - anchor, ip - ref, match_len);
+      if (op == NULL)
+      {
+        return 0;
+      }
+      ip += match_len;
+      anchor = ip;
+    }
+  }
+
+  op = write_sequence(op, op_end, anchor, end - anchor, 0, 0);
+  return op ? (size_t)(op - dst) : 0;
+}
+
+// Compresses len bytes of src into an LZ4 frame at dst. Returns the size of
+// the frame, or 0 if it doesn't fit in cap bytes, which callers use to only
+// keep frames that came out smaller than the data.
+size_t lz4_compress_frame(const uint8_t* src, size_t len, uint8_t* dst, size_t cap)
+{
+  uint8_t* op = dst;
+  size_t n;
+  size_t block;
+
+  // header: magic, descriptor and descriptor checksum, then the end mark
+  if (cap < 7 + 4)
+  {
+    return 0;
+  }
+  write32(op, LZ4F_MAGIC);
+  op[4] = LZ4F_FLG;
+  op[5] = LZ4F_BD;
+  op[6] = xxh32_short(op + 4, 2, 0) >> 8;
+  op += 7;
+  cap -= 7 + 4;
+
+  for (; len > 0; src += n, len -= n)
+  {
+    n = len < LZ4_BLOCK_MAX ? len : LZ4_BLOCK_MAX;
+    if (cap < 4)
+    {
+      return 0;
+    }
+
+    // a block that doesn't get any smaller is stored as it is
+    block = lz4_compress_block(src, n, op + 4, (cap - 4 < n ? cap - 4 : n - 1));
+    if (block != 0)
+    {
+      write32(op, block);
+    }
+    else if (cap - 4 >= n)
+    {
+      block = n;
+      write32(op, block | LZ4F_UNCOMPRESSED);
+      memcpy(op + 4, src, n);
+    }
+    else
+    {
+      return 0;
+    }
+    op += 4 + block;
+    cap -= 4 + block;
+  }
+
+  write32(op, 0);
+  return op + 4 - dst;
+}
@@ -2,17 +2,65 @@
 
 from Crypto.Signature import PKCS1_v1_5
 from Crypto.Hash import SHA256
+from concurrent.futures import ThreadPoolExecutor
+import ctypes
 import os
 import argparse
 import hashlib
+import hmac
 import re
+import struct
 import subprocess
+import threading
+import time
 
 # Path to the generated games folder
 gen_path = "files/generated/games"
 
+# Games are streamed through this many bytes at a time. It must be a multiple
+# of the AES block size so the CTR counter carries on from one block to the
+# next.
 block_size = 65536
 
+# aes.c built as a shared library, see aesLib.c
+aes_lib_fn = "files/generated/libaes.so"
+aes_lib_srcs = ["aesLib.c", "aes.c", "aes.h"]
+
+# LZ4 frame compression built as a shared library, see lz4Lib.c
+lz4_lib_fn = "files/generated/liblz4.so"
+lz4_lib_srcs = ["lz4Lib.c"]
+
+# Name of the game index written next to the games. Must match
+# MESH_INDEX_FILE in include/mesh.h
+index_fn = "mesh.index"
+# Index file layout. Must match struct mesh_index_header and
+# struct mesh_index_entry in include/mesh.h
+index_magic = 0x5844494d  # "MIDX"
+index_version = 2
+index_header_fmt = "<IIII"
+index_entry_fmt = "<32s32sIII80sII64s32s"
+max_game_length = 31
+max_username_length = 15
+max_num_users = 5
+
+# Deduplicated games. Each game file is a manifest listing the chunks of the
+# game binary, which are stored once in chunk_dir however many games use
+# them. Must match MESH_CHUNK_DIR, struct mesh_manifest_header and struct
+# mesh_manifest_chunk in include/mesh.h. chunk_size must be a multiple of the
+# cache line size and no bigger than MESH_HASH_RING_CHUNK.
+chunk_dir = "chunks"
+manifest_magic = 0x4e414d4d  # "MMAN"
+manifest_version = 2
+manifest_header_fmt = "<IIIIII"
+manifest_chunk_fmt = "<16s16sII"
+chunk_size = 65536
+
+# A game's chunks are stored as LZ4 frames if that makes the game at most
+# this much of its size; the rest aren't worth decompressing on the board.
+# Within a compressed game, chunks that don't get smaller are stored as they
+# are.
+lz4_max_ratio = 0.9
+
 
 def gen_cipher(content):
     content = [x.strip() for x in content]
@@ -21,11 +69,82 @@ def gen_cipher(content):
     return (key, nonce)
 
 
-def provision_game(line, cipher):
-    """Given a line from games.txt, provision a game and write to the
-    appropriate directory
+def build_lib(lib_fn, srcs):
+    """Build srcs[0] into the shared library lib_fn, unless it is newer than
+    all of srcs already, and load it.
+    """
+    lib_mtime = os.path.getmtime(lib_fn) if os.path.exists(lib_fn) else 0
+    if any(os.path.getmtime(src) > lib_mtime for src in srcs):
+        subprocess.check_call(["gcc", "-O2", "-shared", "-fPIC", "-o",
+                               lib_fn, srcs[0]])
+
+    return ctypes.CDLL(os.path.abspath(lib_fn))
+
+
+def load_aes():
+    """Build aes.c into a shared library and load it. Every game is encrypted
+    through this one library, and since ctypes lets go of the GIL for each
+    call several games can be encrypted at once from a thread pool.
+    """
+    lib = build_lib(aes_lib_fn, aes_lib_srcs)
+    lib.AES_ctx_size.restype = ctypes.c_size_t
+    lib.AES_init_ctx_iv.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                    ctypes.c_char_p]
+    lib.AES_CTR_xcrypt_buffer.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                          ctypes.c_uint32]
+    return lib
+
+
+def load_lz4():
+    """Build lz4Lib.c into a shared library and load it"""
+    lib = build_lib(lz4_lib_fn, lz4_lib_srcs)
+    lib.lz4_compress_frame.restype = ctypes.c_size_t
+    lib.lz4_compress_frame.argtypes = [ctypes.c_char_p, ctypes.c_size_t,
+                                       ctypes.c_void_p, ctypes.c_size_t]
+    return lib
+
+
+def lz4_frame(lz4, data):
+    """Compress data into an LZ4 frame, or return None if the frame wouldn't
+    be smaller than data
+    """
+    out = ctypes.create_string_buffer(len(data))
+    n = lz4.lz4_compress_frame(bytes(data), len(data), out, len(data) - 1)
+    return out.raw[:n] if n else None
+
+
+class GameCipher:
+    """AES-256-CTR through aes.c, the same as cmdLineAES.c: the key is the
+    first 32 bytes of the factory key and the counter starts at iv. Data has
+    to be given a multiple of the AES block size at a time, except for the
+    end of the data.
+    """
+
+    def __init__(self, lib, key, iv):
+        self.lib = lib
+        self.ctx = ctypes.create_string_buffer(lib.AES_ctx_size())
+        lib.AES_init_ctx_iv(self.ctx, key[:32].ljust(32, b"\0"), iv)
+
+    def encrypt(self, data):
+        buf = bytearray(data)
+        if buf:
+            c_buf = (ctypes.c_char * len(buf)).from_buffer(buf)
+            self.lib.AES_CTR_xcrypt_buffer(self.ctx, c_buf, len(buf))
+        return buf
+
+
+def game_iv(cipher):
+    """Counter a game starts from: the 8 byte nonce followed by zeros"""
+    return cipher[1][:8].split(b"\0")[0].ljust(16, b"\0")
+
+
+def parse_game_line(line):
+    """Parse a line from games.txt
 
     line: string from games.txt to create a game for
+
+    Returns a tuple of (game path, name, version, users), or None if the line
+    doesn't describe a game.
     """
     # Regular expression to parse out the necessary parts of the line in the
     # games.txt file. The regular expression works as follows:
@@ -38,16 +157,155 @@ def provision_game(line, cipher):
     reg = r'^\s*([\w\/\-.\_]+)\s+([\w\-.\_]+)\s+(\d+\.\d+|\d+)((?:\s+\w+)+)'
     m = re.match(reg, line)
     if not m:
-        return
+        return None
+
+    # Path to the game, name of the game, game version and list of users
+    # (strings) that are allowed to play this game
+    return (m.group(1), m.group(2), m.group(3), m.group(4).split())
+
+
+def game_header(version, name, users):
+    """The header written in front of a game. It takes the form of the
+    version, name, and user information one separate lines, prefaced with
+    the information for what the data is (version, name, users), separated
+    by a colon. User information is space separated
+    For example:
+    version:1.0
+    name:2048
+    users:drew ben lou hunter
+    """
+    header = bytes("version:%s\n" % (version), "utf-8")
+    header += bytes("name:%s\n" % (name), "utf-8")
+    header += bytes("users:%s\n" % (" ".join(users)), "utf-8")
+    return header
+
+
+def write_chunk(lib, cipher, data, frame=None):
+    """Store a chunk of a game binary in chunk_dir, unless a chunk with the
+    same contents is already there. The chunk is named and encrypted by an
+    HMAC of what is stored keyed with the factory key, so equal chunks always
+    end up as the same file and different chunks never share a counter.
+    With frame the chunk is stored as that LZ4 frame of data instead, which
+    is told apart from the same bytes stored as they are in the HMAC.
+
+    Returns the manifest entry for the chunk and whether it was new.
+    """
+    stored = data if frame is None else frame
+    tag = b"" if frame is None else b"lz4"
+    mac = hmac.new(cipher[0], tag + stored, hashlib.sha256).digest()
+    (chunk_id, iv) = (mac[:16], mac[16:])
+    path = os.path.join(gen_path, chunk_dir, chunk_id.hex())
+
+    new = not os.path.exists(path)
+    if new:
+        # another worker may be writing the same chunk, so write it under a
+        # name of our own and move it into place
+        tmp = "%s.%d.tmp" % (path, threading.get_ident())
+        with open(tmp, "wb") as f:
+            f.write(GameCipher(lib, cipher[0], iv).encrypt(stored))
+        os.replace(tmp, path)
+
+    return (struct.pack(manifest_chunk_fmt, chunk_id, iv, len(data),
+                        len(stored)), new)
+
+
+def provision_game(game, lib, cipher, dedup=True, lz4=None):
+    """Provision a game parsed from games.txt and write it to the appropriate
+    directory. The game is read, hashed and encrypted in one pass. With dedup
+    the game file is a manifest and the game binary is stored as chunks
+    shared with every other game, otherwise the game file holds the whole
+    encrypted game. With lz4 the chunks are compressed too, if that makes
+    the game enough smaller (see lz4_max_ratio).
+
+    game: tuple returned by parse_game_line
+    lib: aes.c library returned by load_aes
+    cipher: (key, nonce) tuple from gen_cipher
+    lz4: LZ4 library returned by load_lz4, or None not to compress
+
+    Returns a tuple of (file name, name, version, users, size, header size,
+    hash, manifest hash) describing the provisioned game for the game index,
+    and the set of chunk files the game uses. The manifest hash is the
+    SHA-256 of the game file if it is a manifest, and empty otherwise.
+    """
+    if not dedup:
+        return (provision_plain_game(game, lib, cipher), set())
+
+    start = time.perf_counter()
+    (g_path, name, version, users) = game
+    f_out_name = name + "-v" + version
+    header = game_header(version, name, users)
+
+    # Hash the plain game and split its binary into chunks, compressing
+    # each one to measure how well the game compresses
+    hasher = hashlib.sha256()
+    hasher.update(header)
+    data = []
+    frames = []
+    try:
+        with open(g_path, "rb") as f:
+            for chunk in iter(lambda: f.read(chunk_size), b""):
+                hasher.update(chunk)
+                data.append(chunk)
+                frames.append(lz4_frame(lz4, chunk) if lz4 else None)
+    except Exception as e:
+        print("Error, could not chunk game %s: %s" % (g_path, e))
+        exit(1)
+
+    binary_size = sum(len(d) for d in data)
+    compressed_size = sum(len(f or d) for (d, f) in zip(data, frames))
+    if compressed_size > binary_size * lz4_max_ratio:
+        frames = [None] * len(data)
+        compressed_size = binary_size
+
+    # Store the chunks
+    chunks = []
+    names = set()
+    new = 0
+    size = len(header) + binary_size
+    try:
+        for (chunk, frame) in zip(data, frames):
+            (entry, is_new) = write_chunk(lib, cipher, chunk, frame)
+            chunks.append(entry)
+            names.add(entry[:16].hex())
+            new += is_new
+    except Exception as e:
+        print("Error, could not write chunks of game %s: %s" % (g_path, e))
+        exit(1)
 
-    # Path to the game
-    g_path = m.group(1)
-    # Name of the game
-    name = m.group(2)
-    # Game version
-    version = m.group(3)
-    # List of users (strings) that are allowed to play this game
-    users = m.group(4).split()
+    # The manifest, followed by the header encrypted like the start of a
+    # plain game
+    manifest = struct.pack(manifest_header_fmt, manifest_magic,
+                           manifest_version, size, len(header), chunk_size,
+                           len(chunks))
+    manifest += b"".join(chunks)
+    manifest += GameCipher(lib, cipher[0], game_iv(cipher)).encrypt(header)
+
+    try:
+        with open(os.path.join(gen_path, f_out_name), "wb") as f_out:
+            f_out.write(manifest)
+        open(os.path.join(gen_path, f_out_name + ".SHA256.SIG"), "wb").close()
+        with open(os.path.join(gen_path, f_out_name + ".SHA256"), "w+") as hash:
+            hash.write(hasher.hexdigest())
+    except Exception as e:
+        print("Error, could not write game %s: %s" % (f_out_name, e))
+        exit(1)
+
+    # one write per line so lines from different workers don't run together
+    print("    %s -> %s (%d bytes, %d stored, %d of %d chunks new, %.2f s)\n" %
+          (g_path, os.path.join(gen_path, f_out_name), size,
+           len(header) + compressed_size, new, len(chunks),
+           time.perf_counter() - start), end="")
+
+    return ((f_out_name, name, version, users, size, len(header),
+             hasher.hexdigest(), hashlib.sha256(manifest).digest()), names)
+
+
+def provision_plain_game(game, lib, cipher):
+    """Provision a game as one encrypted file, see provision_game. The header
+    and game are written, hashed and encrypted in one pass over the game.
+    """
+    start = time.perf_counter()
+    (g_path, name, version, users) = game
 
     # Open the path to the games in binary mode
     try:
@@ -67,90 +325,78 @@ def provision_game(line, cipher):
         f.close()
         exit(1)
 
-    # Write the game header to the top of the file
-    # The game header takes the form of the version, name, and user information
-    # one separate lines, prefaced with the information for what the data is
-    # (version, name, users), separated by a colon. User information is space
-    # separated
-    # For example:
-    # version:1.0
-    # name:2048
-    # users:drew ben lou hunter
-    #f_out = f_out.name
-    f_out.write(bytes("version:%s\n" % (version), "utf-8"))
-    f_out.write(bytes("name:%s\n" % (name), "utf-8"))
-    f_out.write(bytes("users:%s\n" % (" ".join(users)), "utf-8"))
-
-    # Read in the binary source
-    # block_size used as
-    # we can't be sure of the size of each game
-    # best be careful by reading a certain number of bytes each time
-    g_src = f.read(block_size)
-    while g_src:
-        f_out.write(g_src)
-        g_src = f.read(block_size)
-
-    # Close the files
-    f_out.close()
-    f.close()
-
-    # Write the binary source
-    f_hash_out = f_out_name + ".SHA256"
-    f_hash_sig_out = f_hash_out + ".SIG"
+    header = game_header(version, name, users)
+
+    # Stream the header and game through the hash of the plain game and the
+    # cipher in block_size pieces, the first of which starts with the header,
+    # so every piece but the last is a whole number of AES blocks
+    hasher = hashlib.sha256()
+    aes = GameCipher(lib, cipher[0], game_iv(cipher))
+    size = 0
     try:
-        f_sign = open(os.path.join(gen_path, f_hash_sig_out), "wb")
+        g_src = header + f.read(block_size - len(header) % block_size)
+        while g_src:
+            hasher.update(g_src)
+            f_out.write(aes.encrypt(g_src))
+            size += len(g_src)
+            g_src = f.read(block_size)
     except Exception as e:
-        print("Error, could not open signature output file: %s" % e)
-        f_sign.close()
+        print("Error, could not write or encrypt game %s: %s" % (f_out_name, e))
         exit(1)
-    try:
-        hasher = hashlib.sha256()
-        # print(str(f_out.name))
-        #path = str(os.path.join(gen_path, f_out.name))
-        # print(path)
-        # hash game and save to file, tested locally
-        with open(f_out.name, 'rb') as to_hash:
-            buf = to_hash.read(block_size)
-            while len(buf) > 0:
-                hasher.update(buf)
-                buf = to_hash.read(block_size)
-        print("wrote contents to binary: " + f_out.name)
-        # to_hash/f_out closed implicitly outside of with
+    finally:
+        f_out.close()
+        f.close()
 
+    # Write the hash of the plain game next to it
+    f_hash_out = f_out_name + ".SHA256"
+    f_hash_sig_out = f_hash_out + ".SIG"
+    try:
+        open(os.path.join(gen_path, f_hash_sig_out), "wb").close()
         with open(os.path.join(gen_path, f_hash_out), "w+") as hash:
             hash.write(hasher.hexdigest())
-        f_out.close()
-        print("wrote hash to file: " + str(os.path.join(gen_path, f_hash_out)))
+    except Exception as e:
+        print("Error, could not write hash of %s: %s" % (f_out_name, e))
+        exit(1)
 
-    # need to verify here cuz why not
+    # one write per line so lines from different workers don't run together
+    print("    %s -> %s (%d bytes, %.2f s)\n" %
+          (g_path, os.path.join(gen_path, f_out_name), size,
+           time.perf_counter() - start), end="")
 
-    # this is all in 1 try/catch block because we cannot have one
-    # part (writing header, hashing, signing, etc) to fail whilst the others continue
+    return (f_out_name, name, version, users, size, len(header),
+            hasher.hexdigest(), b"")
 
-    except Exception as e:
-        print("Error, could write OR hash binary OR write signature to source: %s" % (e))
-        # f_out.close()
-        # exit(1)
 
-    # encrypt games
-    # 1. GCC the cmdLineAES.c with
-    try:
-        subprocess.check_call("gcc -o cmdAES cmdLineAES.c", shell=True)
-    except Exception as e:
-        print("NOPE: ", e)
-    # 2. Create Subprocess with arguments
-    try:
-        print("Gen_path: ", gen_path)
-        print("Key: ", cipher[0])
-        print("Nonce: ", cipher[1])
-        print("File Name: ", f_out_name)
-        subprocess.check_call("./cmdAES %s %s %s" % (gen_path+"/"+f_out_name,
-                                                     cipher[0].decode('utf-8'), cipher[1].decode('utf-8')), shell=True)
-
-    except Exception as e:
-        print("NOPENOPE: ", e)
+def write_game_index(games, cipher):
+    """Write the game index that lets the mesh shell look up a game's header,
+    size and hash without reading or decrypting the game itself. The index
+    is authenticated with an HMAC-SHA256 over its contents using the factory
+    key, and holds the hash of every manifest so manifests are covered too.
 
-    print("    %s -> %s" % (g_path, os.path.join(gen_path, f_out_name)))
+    games: list of tuples returned by provision_game
+    cipher: (key, nonce) tuple from gen_cipher
+    """
+    data = struct.pack(index_header_fmt, index_magic, index_version,
+                       len(games), struct.calcsize(index_entry_fmt))
+    for (f_name, name, version, users, size, header_size, digest,
+         manifest_digest) in games:
+        # the mesh shell only keeps this many users of this length, same
+        # as when it parses the game header
+        users = users[:max_num_users]
+        users_field = b"".join(
+            struct.pack("16s", u[:max_username_length].encode()) for u in users)
+        major, _, minor = version.partition(".")
+        data += struct.pack(index_entry_fmt,
+                            f_name[:max_game_length].encode(),
+                            name[:max_game_length].encode(),
+                            int(major), int(minor or 0), len(users),
+                            users_field, size, header_size, digest.encode(),
+                            manifest_digest)
+    data += hmac.new(cipher[0], data, hashlib.sha256).digest()
+
+    with open(os.path.join(gen_path, index_fn), "wb") as f:
+        f.write(data)
+    print("    wrote game index: %s" % (os.path.join(gen_path, index_fn)))
 
 
 def main():
@@ -162,6 +408,15 @@ def main():
     parser.add_argument('games',
                         help=("A text file containing game information in a "
                               "MITRE defined format."))
+    parser.add_argument('--no-dedup', action='store_true',
+                        help=("Write every game as one uncompressed encrypted file "
+                              "instead of a manifest of shared chunks"))
+    parser.add_argument('--no-compress', action='store_true',
+                        help=("Store the chunks of every game uncompressed "
+                              "instead of as LZ4 frames where that helps"))
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help=("Number of games to provision at once "
+                              "(default: number of CPUs)"))
     args = parser.parse_args()
 
     # open factory secrets
@@ -181,13 +436,44 @@ def main():
 
     cipher = gen_cipher(content)
 
-    subprocess.check_call("mkdir -p %s" % (gen_path), shell=True)
+    subprocess.check_call("mkdir -p %s" % (os.path.join(gen_path, chunk_dir)),
+                          shell=True)
 
-    print("Provision Games...")
+    lib = load_aes()
+    lz4 = None if args.no_compress or args.no_dedup else load_lz4()
 
-    # Provision each line in the games file
-    for line in f_games:
-        provision_game(line, cipher)
+    print("Provision Games...")
+    start = time.perf_counter()
+
+    # Games that share an output file would race each other, so only the last
+    # line for each one is provisioned, which is the one that used to end up
+    # in the file
+    lines = [g for g in map(parse_game_line, f_games) if g]
+    last = {(g[1], g[2]): i for (i, g) in enumerate(lines)}
+    for (i, g) in enumerate(lines):
+        if last[(g[1], g[2])] != i:
+            print("    %s-v%s is listed more than once, using the last line" %
+                  (g[1], g[2]))
+    lines = [g for (i, g) in enumerate(lines) if last[(g[1], g[2])] == i]
+
+    # Provision the games across a pool of workers, keeping the order of the
+    # games file for the index
+    with ThreadPoolExecutor(max_workers=max(args.jobs, 1)) as pool:
+        results = list(pool.map(
+            lambda g: provision_game(g, lib, cipher, not args.no_dedup, lz4),
+            lines))
+    games = [game for (game, _) in results]
+
+    # Remove chunks no game uses any more, left over from earlier runs
+    used = set().union(*[names for (_, names) in results])
+    for fn in os.listdir(os.path.join(gen_path, chunk_dir)):
+        if fn not in used:
+            os.remove(os.path.join(gen_path, chunk_dir, fn))
+
+    write_game_index(games, cipher)
+
+    print("Provisioned %d games in %.2f s" %
+          (len(games), time.perf_counter() - start))
 
     print("Done Provision Games")
 
@@ -9,15 +9,30 @@ import argparse
 import binascii
 import random
 import string
+import struct
+import zlib
 
-# Path to the mesh_users header file
-mesh_users_fn = os.environ["ECTF_UBOOT"] + "/include/mesh_users.h"
-# Path to Petalinux mesh_users header file
-mesh_users_fn2 = "/home/vagrant/MES/Arty-Z7-10/project-spec/meta-user/recipes-apps/mesh-game-loader/files/mesh_users.h"
-# Path to the default_games header file
-default_games_hpath = os.environ["ECTF_UBOOT"] + "/include/default_games.h"
 # Path where generated files will go
 gen_path = "files/generated"
+# File name for the provisioning data loaded beside u-boot
+mesh_data_fn = "MES.data"
+# Where the FSBL loads the provisioning data (MESH_DATA_ADDR in mesh.h)
+mesh_data_addr = 0x0ff00000
+# Largest provisioning data u-boot accepts (MESH_DATA_MAX_SIZE in mesh.h)
+mesh_data_max_size = 0x00100000
+# Provisioning data layout: struct mesh_data_header, struct mesh_user and
+# default game names of MAX_STR_LEN bytes, all from mesh.h
+mesh_data_magic = 0x5441444d
+mesh_data_version = 1
+mesh_data_header_fmt = "<IIIIII48s16s"
+mesh_user_fmt = "<16s65s17s"
+mesh_game_fmt = "<64s"
+# Longest username a struct mesh_user holds
+max_username_length = 15
+# Directory the petalinux build leaves its images in
+images_path = os.environ["ECTF_PETALINUX"] + "/Arty-Z7-10/images/linux"
+# Images provisioning needs from the petalinux build
+image_fns = ["Arty_Z7_10_wrapper.bit", "u-boot.elf", "image.ub"]
 # File name for the bif file
 system_image_fn = "SystemImage.bif"
 # File name for the factory secrets
@@ -63,79 +78,17 @@ def validate_users(lines):
     return lines
 
 
-def write_mesh_users_h(h_users, f):
-    """Write user inforation to a header file
-
-    users: list of tuples of (username, pin)
-    f: open file object for the header file to be written
-    """
-    # write users to header file
-    f.write("""
-/*
-* This is an automatically generated file by provisionSystem.py
-*
-*
-*/
-
-#ifndef __MESH_USERS_H__
-#define __MESH_USERS_H__
-
-#define NUM_MESH_USERS {num_users}
-
-struct MeshUser {{
-    char username[16];
-    char pin[64+1];
-    char salt[16+1];
-}};
-
-static struct MeshUser mesh_users[] = {{
-""".format(num_users=len(h_users)))
-
-    for (user, pin, salt) in h_users:
-        data = '    {.username="%s", .pin="%s", .salt="%s"},\n' % (user, pin, salt)
-        f.write(data)
-
-    f.write("""
-};
-
-#endif /* __MESH_USERS_H__ */
-""")
-    data = '#define NONCE "%s"\n' % nonce
-    f.write(data)
-    data = '#define KEY "%s"\n' % key
-    f.write(data)
-
-
-def write_mesh_default_h(default_txt_path, header_path):
-    """Turn the default.txt into a C header file for MESH
+def read_default_games(default_txt_path):
+    """Read the default.txt into a list of gamename-vmajor.minor names
 
     default_txt_path: path to the default.txt file to be read from
-    header_path: path to the C header file to be written
     """
 
     # Open the file and read into a variable
     with open(default_txt_path, 'r') as f:
         lines = f.read().split('\n')
 
-    # Base string to write
-    s = """
-/*
-* This is an automatically generated file by provisionSystem.py
-*
-*
-*/
-
-#ifndef __MESH_DEFAULT_TXT_H__
-#define __MESH_DEFAULT_TXT_H__
-
-"""
-
-    # Write the number of default games
-    s += "#define NUM_DEFAULT_GAMES %s\n" % sum(1 for line in lines if line)
-    # For each line, write the game information
-    s += """
-static char* default_games[] = {
-"""
+    games = []
     for line in lines:
         # Ignore blank lines
         if not line:
@@ -149,16 +102,39 @@ static char* default_games[] = {
         line = line[1].split('.')
         major = line[0]
         minor = line[1]
-        # Write the information as gamename-vmajor.minor to the header file
-        s += "    \"%s-v%s.%s\",\n" % (game_name, major, minor)
+        # Name the game as gamename-vmajor.minor
+        games.append("%s-v%s.%s" % (game_name, major, minor))
+
+    return games
 
-    s += """
-};
 
-#endif /* __MESH_DEFAULT_TXT_H__ */
-"""
-    with open(header_path, 'w') as f:
-        f.write(s)
+def write_mesh_data(h_users, default_games, f):
+    """Write the users, game key and default games as the provisioning data
+    u-boot loads at startup (mesh_data_init in mesh.c). This is everything
+    that changes from one provisioning to the next, so it is the only image
+    that has to be made again.
+
+    h_users: list of tuples of (username, pin hash, salt)
+    default_games: list of gamename-vmajor.minor names
+    f: open binary file to write the provisioning data to
+    """
+    body = b""
+    for (user, pin, salt) in h_users:
+        body += struct.pack(mesh_user_fmt, user.encode(), pin.encode(), salt.encode())
+    for game in default_games:
+        body += struct.pack(mesh_game_fmt, game.encode())
+
+    size = struct.calcsize(mesh_data_header_fmt) + len(body)
+    header = struct.pack(mesh_data_header_fmt, mesh_data_magic, mesh_data_version,
+                         size, zlib.crc32(body), len(h_users), len(default_games),
+                         key.encode(), nonce.encode())
+    f.write(header + body)
+    return size
+
+
+def images_built():
+    """Whether the petalinux build has already left every image we need"""
+    return all(os.path.isfile(os.path.join(images_path, fn)) for fn in image_fns)
 
 
 def build_images():
@@ -173,10 +149,11 @@ def build_images():
     print("Done Building Images to %s" % (os.environ["ECTF_PETALINUX"] + '/Arty-Z7-10/images'))
 
 
-def write_system_image_bif(f):
+def write_system_image_bif(f, data_path):
     """Write the bif file
 
     f: open file to write the bif to
+    data_path: absolute path of the provisioning data
     """
     f.write("""
 MITRE_Entertainment_System: {{
@@ -186,8 +163,11 @@ MITRE_Entertainment_System: {{
     // Paritcipants Images
     {path}/Arty-Z7-10/images/linux/u-boot.elf
     [load=0x10000000] {path}/Arty-Z7-10/images/linux/image.ub
+    // Provisioning data
+    [load={data_addr:#010x}] {data_path}
 }}
-    """.format(path=os.environ["ECTF_PETALINUX"]))
+    """.format(path=os.environ["ECTF_PETALINUX"], data_addr=mesh_data_addr,
+               data_path=data_path))
 
 
 def write_factory_secrets(f):
@@ -217,6 +197,11 @@ def main():
     game_foo 1.1
     game_bar 2.0
         """)
+    parser.add_argument('--rebuild', action='store_true',
+                        help=("Clean and build u-boot and image.ub again even "
+                              "if they have already been built. Only needed "
+                              "after changing the sources; users, the game "
+                              "key and the default games are in %s" % mesh_data_fn))
     args = parser.parse_args()
 
     # open arg file
@@ -231,15 +216,9 @@ def main():
     subprocess.check_call("mkdir -p " + gen_path, shell=True)
     # Try to open each file that we'll need to write to, report error messages
     try:
-        f_mesh_users_out = open(mesh_users_fn, "w+")
+        f_mesh_data = open(os.path.join(gen_path, mesh_data_fn), "wb")
     except Exception as e:
-        print("Unable to open generated users header file: %s" % (e,))
-        exit(2)
-
-    try:
-        f_mesh_users_out2 = open(mesh_users_fn2, "w+")
-    except Exception as e:
-        print("Unable to open generated users header file2: %s" % (e,))
+        print("Unable to open %s: %s" % (mesh_data_fn, e,))
         exit(2)
 
     try:
@@ -267,27 +246,32 @@ def main():
     # Add the demo user, which must always exist, per the rules
     users.append(("demo", "00000000"))
 
+    for (user, pin) in users:
+        if len(user) > max_username_length:
+            print("Username %s is longer than %d characters." % (user, max_username_length))
+            exit(2)
+
     # hash user pins
     hashed_users = hash_pins(users)
 
-    # write mesh users to uboot header
-    write_mesh_users_h(hashed_users, f_mesh_users_out)
-    f_mesh_users_out.close()
-    print("Generated mesh_users.h file: %s" % (mesh_users_fn))
-
-    write_mesh_users_h(hashed_users, f_mesh_users_out2)
-    f_mesh_users_out2.close()
-    print("Generated mesh_users.h file: %s" % (mesh_users_fn2))
-
-    # Write the default games file
-    write_mesh_default_h(args.DEFAULT_FILE, default_games_hpath)
-    print("Generated default_games.h file")
+    # write users, the game key and default games to the provisioning data
+    size = write_mesh_data(hashed_users, read_default_games(args.DEFAULT_FILE), f_mesh_data)
+    f_mesh_data.close()
+    if size > mesh_data_max_size:
+        print("Too many users and default games: %s is %d bytes, more than %d."
+              % (mesh_data_fn, size, mesh_data_max_size))
+        exit(2)
+    print("Generated %s file: %s" % (mesh_data_fn, os.path.join(gen_path, mesh_data_fn)))
 
-    # build MES.bin
-    build_images()
+    # build the images that go in MES.bin. Nothing in them depends on the
+    # users or keys, so once they exist only the provisioning data changes
+    if args.rebuild or not images_built():
+        build_images()
+    else:
+        print("Using the images already built in %s" % (images_path))
 
     # write system image bif
-    write_system_image_bif(f_system_image)
+    write_system_image_bif(f_system_image, os.path.abspath(os.path.join(gen_path, mesh_data_fn)))
     f_system_image.close()
     print("Generated SystemImage file: %s" % (os.path.join(gen_path, system_image_fn)))
 